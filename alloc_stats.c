@@ -0,0 +1,41 @@
+#include "alloc_stats.h"
+#include <stddef.h>
+
+#ifdef NSPT_COUNT_ALLOCS
+/* built with -DNSPT_COUNT_ALLOCS (make count-allocs), malloc family is interposed to count calls,
+ * which also counts allocations made inside libc
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long count = 0;
+
+void *malloc(size_t size)
+{
+	count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count++;
+	return __libc_realloc(ptr, size);
+}
+
+unsigned long alloc_count()
+{
+	return count;
+}
+#else
+unsigned long alloc_count()
+{
+	return 0;
+}
+#endif
@@ -0,0 +1,6 @@
+#ifndef NSPT_ALLOC_STATS
+#define NSPT_ALLOC_STATS
+
+unsigned long alloc_count();
+
+#endif
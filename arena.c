@@ -0,0 +1,109 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <assert.h>
+#include <syslog.h>
+
+#define ARENA_CHUNK_LEN 4096
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	alignas(max_align_t) char data[];
+};
+
+static void new_chunk(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	if (size < ARENA_CHUNK_LEN)
+		size = ARENA_CHUNK_LEN;
+	if ((chunk = malloc(sizeof(struct arena_chunk) + size)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate arena chunk: %m");
+		exit(EXIT_FAILURE);
+	}
+	chunk->next = arena->head;
+	chunk->size = size;
+	arena->head = chunk;
+	arena->used = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	assert(arena != NULL);
+
+	void *ptr;
+
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+	if (arena->head == NULL || arena->head->size - arena->used < size)
+		new_chunk(arena, size);
+	ptr = arena->head->data + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t length)
+{
+	char *copy = arena_alloc(arena, length + 1);
+
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+/* free everything allocated, the oldest chunk is kept for next use */
+void arena_reset(struct arena *arena)
+{
+	assert(arena != NULL);
+
+	struct arena_chunk *chunk, *next;
+
+	if (arena->head == NULL)
+		return;
+	for (chunk = arena->head; chunk->next != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->head = chunk;
+	arena->used = 0;
+}
+
+struct arena_mark arena_mark(const struct arena *arena)
+{
+	struct arena_mark mark = {arena->head, arena->used};
+	return mark;
+}
+
+/* free what has been allocated since mark was taken, so nested users can share one arena */
+void arena_release(struct arena *arena, struct arena_mark mark)
+{
+	assert(arena != NULL);
+
+	struct arena_chunk *next;
+
+	if (mark.head == NULL) {
+		arena_reset(arena);
+		return;
+	}
+	while (arena->head != mark.head) {
+		next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+	arena->used = mark.used;
+}
+
+/* free everything, chunk kept by arena_reset() too, for arenas that go away */
+void arena_free(struct arena *arena)
+{
+	assert(arena != NULL);
+
+	struct arena_chunk *next;
+
+	for (; arena->head != NULL; arena->head = next) {
+		next = arena->head->next;
+		free(arena->head);
+	}
+	arena->used = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef NSPT_ARENA
+#define NSPT_ARENA
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+/* bump allocator, everything allocated from an arena is freed at once by arena_reset() */
+struct arena {
+	struct arena_chunk *head;  //chunk being allocated from, older chunks follow
+	size_t used;               //bytes used in head
+};
+
+/* allocation state of an arena, arena_release() frees what has been allocated since */
+struct arena_mark {
+	struct arena_chunk *head;
+	size_t used;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strndup(struct arena *arena, const char *str, size_t length);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+struct arena_mark arena_mark(const struct arena *arena);
+void arena_release(struct arena *arena, struct arena_mark mark);
+
+#endif
@@ -0,0 +1,19 @@
+# heap allocations per command line once the shell has warmed up, counted by a
+# -DNSPT_COUNT_ALLOCS build (see make count-allocs), libc's own allocations included
+. bench/lib.sh
+
+RUNS=100
+gcc *.c -o "$BENCH_TMP/nspt_sh_allocs" -Wall -ldl -DNSPT_COUNT_ALLOCS || exit 1
+while read -r line; do
+	count=$(lines $RUNS "$line" | "$BENCH_TMP/nspt_sh_allocs" 2>&1 >/dev/null |
+		sed -n 's/^\[heap allocations: \([0-9]*\)\]$/\1/p' | tail -n 1)
+	printf "  %-40s %6s allocations\n" "$line" "$count"
+done <<'LINES'
+true
+X=abc
+echo a b c >/dev/null
+/bin/true
+echo a | cat >/dev/null
+for i in 1 2 3; do X=$i; done
+X=$(echo a)
+LINES
@@ -0,0 +1,16 @@
+# batch mode: commands per second from a script, -c string and piped stdin
+# each line launches /bin/true, so the rate is bound by process creation
+. bench/lib.sh
+
+N=100000
+C_N=10000 #one argument is limited to 128KB (MAX_ARG_STRLEN), 13107 lines of /bin/true
+lines $N /bin/true >"$BENCH_TMP/script.sh"
+c_string=$(lines $C_N /bin/true)
+report "script, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/script.sh")"
+report "-c string, $C_N lines" $C_N "$(wall_us "$NSPT_SH" -c "$c_string")"
+start=${EPOCHREALTIME/./}
+"$NSPT_SH" <"$BENCH_TMP/script.sh" >/dev/null 2>&1
+report "piped stdin, $N lines" $N $(( ${EPOCHREALTIME/./} - start ))
+if have bash; then
+	report "bash script, $N lines" $N "$(wall_us bash "$BENCH_TMP/script.sh")"
+fi
@@ -0,0 +1,19 @@
+# core builtins run in the shell, against the same commands run as external programs
+. bench/lib.sh
+
+N=10000
+cat >"$BENCH_TMP/builtins.txt" <<'LINES'
+[ -f /etc/passwd ]
+echo x >/dev/null
+true
+printf '%s\n' x >/dev/null
+LINES
+sed 's|^\[|/usr/bin/[|; s|^echo|/bin/echo|; s|^true|/bin/true|; s|^printf|/usr/bin/printf|' \
+	"$BENCH_TMP/builtins.txt" >"$BENCH_TMP/externals.txt"
+for ((i = 0; i < N / 4; ++i)); do cat "$BENCH_TMP/builtins.txt"; done >"$BENCH_TMP/builtins.sh"
+for ((i = 0; i < N / 4; ++i)); do cat "$BENCH_TMP/externals.txt"; done >"$BENCH_TMP/externals.sh"
+report "builtins, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/builtins.sh")"
+report "external programs, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/externals.sh")"
+if have bash; then
+	report "bash builtins, $N lines" $N "$(wall_us bash "$BENCH_TMP/builtins.sh")"
+fi
@@ -0,0 +1,35 @@
+# compiled script cache: a 20000-line script and a 120-line wrapper of the kind that sets up
+# an environment, run with the cache cold (compiled and stored), warm (mapped), and without it
+. bench/lib.sh
+
+RUNS=9
+for ((i = 0; i < 5000; ++i)); do
+	echo "X$((i % 50))=value$i"
+	echo "if [ -n \"\$X$((i % 50))\" ]; then Y=\$X$((i % 50)); else Y=none; fi"
+	echo "case \$Y in value*) Z=1 ;; *) Z=0 ;; esac"
+	echo ": \"\$Y\" \"\$Z\""
+done >"$BENCH_TMP/big.sh"
+{
+	for ((i = 0; i < 119; ++i)); do
+		echo "export APP_SETTING_$i=\"\$HOME/app/default$i\""
+	done
+	echo true
+} >"$BENCH_TMP/wrapper.sh"
+
+cold()
+{
+	rm -rf "$XDG_CACHE_HOME"
+	"$NSPT_SH" "$1"
+}
+
+for script in big wrapper; do
+	path=$BENCH_TMP/$script.sh
+	label="$(wc -l <"$path") lines"
+	report "cold cache, $label" 1 "$(median_us $RUNS cold "$path")"
+	"$NSPT_SH" "$path" </dev/null
+	report "warm cache, $label" 1 "$(median_us $RUNS "$NSPT_SH" "$path")"
+	report "no cache, $label" 1 "$(median_us $RUNS "$NSPT_SH" --no-script-cache "$path")"
+	if have bash; then
+		report "bash, $label" 1 "$(median_us $RUNS bash "$path")"
+	fi
+done
@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+# Tab completion in a directory of 100k files: the first Tab lists the directory,
+# later ones revalidate the cached listing by mtime; and command names from PATH
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, 'bench')
+from ptylib import BACKSPACE, PROMPT, TAB, Shell, median, report
+
+FILES = 100000
+
+
+def tabs(sh, word, label):
+	"""first Tab after word, then later Tabs, each after retyping the last char so none lists"""
+	sh.write(word)
+	sh.quiet()
+	report('first Tab, %s' % label, sh.key(TAB)[0])
+	later = []
+	for _ in range(100):
+		sh.key(BACKSPACE)
+		sh.key(word[-1:])
+		later.append(sh.key(TAB)[0])
+	report('later Tab, %s' % label, median(later))
+	report('second Tab, matches listed', sh.key(TAB)[0])
+
+
+with tempfile.TemporaryDirectory(prefix='nspt_bench.') as tmp:
+	for i in range(FILES):
+		open(os.path.join(tmp, 'file%06d' % i), 'w').close()
+	sh = Shell()
+	sh.write(b'cd ' + tmp.encode() + b'\r')
+	sh.read_until(PROMPT)
+	tabs(sh, b'cat file01234', '%d files' % FILES)
+	sh.close()
+	sh = Shell()
+	tabs(sh, b'gre', 'command name')
+	sh.close()
@@ -0,0 +1,35 @@
+# shell variables: launches with 5000 exported variables, with the environment unchanged between
+# launches and with one exported variable set before each, and variable lookups among them
+. bench/lib.sh
+
+VARS=5000
+N=1000
+LOOKUP_N=50000
+for ((i = 0; i < VARS; ++i)); do
+	echo "export V$i=value$i"
+done >"$BENCH_TMP/vars.sh"
+lines $N /bin/true >"$BENCH_TMP/same.txt"
+for ((i = 0; i < N; ++i)); do
+	echo "V$((i % VARS))=changed$i"
+	echo /bin/true
+done >"$BENCH_TMP/changed.txt"
+lines $LOOKUP_N 'X=$V2500' >"$BENCH_TMP/lookup.txt"
+for name in same changed lookup; do
+	cat "$BENCH_TMP/vars.sh" "$BENCH_TMP/$name.txt" >"$BENCH_TMP/$name.sh"
+done
+#bash builds its environment again for each launch after a change, 100 launches do for it
+BASH_CHANGED_N=100
+cat "$BENCH_TMP/vars.sh" - <"$BENCH_TMP/changed.txt" | head -n $((VARS + 2 * BASH_CHANGED_N)) >"$BENCH_TMP/bash_changed.sh"
+
+vars_us=$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/vars.sh")
+report "/bin/true, env unchanged" $N $(( $(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/same.sh") - vars_us ))
+report "/bin/true, an export set before each" $N \
+	$(( $(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/changed.sh") - vars_us ))
+report "X=\$V2500 among $VARS" $LOOKUP_N $(( $(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/lookup.sh") - vars_us ))
+if have bash; then
+	vars_us=$(wall_us bash "$BENCH_TMP/vars.sh")
+	report "bash /bin/true, env unchanged" $N $(( $(wall_us bash "$BENCH_TMP/same.sh") - vars_us ))
+	report "bash /bin/true, an export set before each" $BASH_CHANGED_N \
+		$(( $(wall_us bash "$BENCH_TMP/bash_changed.sh") - vars_us ))
+	report "bash X=\$V2500 among $VARS" $LOOKUP_N $(( $(wall_us bash "$BENCH_TMP/lookup.sh") - vars_us ))
+fi
@@ -0,0 +1,70 @@
+/* gap buffer microbenchmark: cursor moves, inserts and deletes at the middle of 1 KB, 64 KB and 1 MB
+ * lines, each should cost the same whatever the line length
+ */
+#include "gap_buf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 2000
+#define STEPS 500
+
+static double now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *op, size_t size, double ns, long count)
+{
+	printf("  %-10s %5zu KB line %9.2f ns each\n", op, size / 1024, ns / count);
+}
+
+int main()
+{
+	static const size_t sizes[] = {1024, 64 * 1024, 1024 * 1024};
+	struct gap_buf buf;
+	double start, move_ns, insert_ns, delete_ns;
+	size_t i, mid;
+	char *text;
+	int round, step;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		text = malloc(sizes[i]);
+		memset(text, 'x', sizes[i]);
+		gap_buf_init(&buf, 256);
+		gap_buf_insert(&buf, text, sizes[i]);
+		mid = sizes[i] / 2;
+		gap_buf_move(&buf, mid);
+		move_ns = insert_ns = delete_ns = 0;
+		for (round = 0; round < ROUNDS; ++round) {
+			start = now_ns();
+			for (step = 0; step < STEPS; ++step)
+				gap_buf_move(&buf, gap_buf_cursor(&buf) - 1);
+			for (step = 0; step < STEPS; ++step)
+				gap_buf_move(&buf, gap_buf_cursor(&buf) + 1);
+			move_ns += now_ns() - start;
+			start = now_ns();
+			for (step = 0; step < STEPS; ++step)
+				gap_buf_insert(&buf, "y", 1);
+			insert_ns += now_ns() - start;
+			start = now_ns();
+			for (step = 0; step < STEPS; ++step)
+				gap_buf_delete(&buf, 1);
+			delete_ns += now_ns() - start;
+		}
+		if (gap_buf_len(&buf) != sizes[i] || gap_buf_cursor(&buf) != mid) {
+			fprintf(stderr, "gap_buf: line changed\n");
+			return EXIT_FAILURE;
+		}
+		report("move", sizes[i], move_ns, (long)ROUNDS * STEPS * 2);
+		report("insert", sizes[i], insert_ns, (long)ROUNDS * STEPS);
+		report("delete", sizes[i], delete_ns, (long)ROUNDS * STEPS);
+		free(buf.data);
+		free(text);
+	}
+	return 0;
+}
@@ -0,0 +1,18 @@
+# PATH lookup: commands found at the end of a long PATH, and type answered from the cache
+. bench/lib.sh
+
+N=5000
+dirs=
+for ((i = 0; i < 40; ++i)); do
+	mkdir "$BENCH_TMP/d$i"
+	dirs=$dirs$BENCH_TMP/d$i:
+done
+lines $N "env" >"$BENCH_TMP/launch.sh"
+lines $N "type env cat ls" >"$BENCH_TMP/type.sh"
+PATH=$dirs$PATH
+report "env after 40 PATH dirs, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/launch.sh")"
+report "type of 3 names, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/type.sh")"
+if have bash; then
+	report "bash env after 40 PATH dirs, $N lines" $N "$(wall_us bash "$BENCH_TMP/launch.sh")"
+	report "bash type of 3 names, $N lines" $N "$(wall_us bash "$BENCH_TMP/type.sh")"
+fi
@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+# history of 5M entries: startup (the file is mapped, not read), Up, and Ctrl-R searches
+# for a recent entry, the oldest one and a pattern found nowhere
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, 'bench')
+from ptylib import CTRL_R, UP, Shell, median, report
+
+ENTRIES = 5000000
+CTRL_G = b'\x07'
+
+
+def search(sh, pattern):
+	"""type Ctrl-R and pattern a key at a time, return the slowest key"""
+	slowest = sh.key(CTRL_R)[0]
+	for ch in pattern:
+		slowest = max(slowest, sh.key(bytes([ch]))[0])
+	sh.key(CTRL_G)
+	return slowest
+
+
+with tempfile.TemporaryDirectory(prefix='nspt_bench.') as tmp:
+	path = os.path.join(tmp, 'history')
+	with open(path, 'w') as f:
+		f.write('echo oldest_entry\n')
+		for start in range(1, ENTRIES, 100000):
+			f.write(''.join('make -C src/module%d target%d -j8\n' % (i % 997, i)
+				for i in range(start, min(start + 100000, ENTRIES))))
+	print('  history of %d entries, %d MB' % (ENTRIES, os.path.getsize(path) >> 20))
+	startup = []
+	for _ in range(5):
+		sh = Shell(env={'HISTFILE': path})
+		startup.append(sh.startup)
+		sh.close()
+	report('startup to first prompt', median(startup))
+	sh = Shell(env={'HISTFILE': path})
+	report('Up, first', sh.key(UP)[0])
+	report('Up', median([sh.key(UP)[0] for _ in range(100)]))
+	report('Ctrl-R recent entry, slowest key', median([search(sh, b'target4999990') for _ in range(5)]))
+	report('Ctrl-R oldest entry, slowest key', median([search(sh, b'oldest_entry') for _ in range(5)]))
+	report('Ctrl-R no match, slowest key', median([search(sh, b'no_such_entry') for _ in range(5)]))
+	sh.close()
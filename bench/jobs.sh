@@ -0,0 +1,12 @@
+# job table: start many background jobs, then list them
+. bench/lib.sh
+
+N=2000
+{
+	lines $N "/bin/true &"
+	echo jobs
+} >"$BENCH_TMP/jobs.sh"
+report "$N background jobs and jobs" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/jobs.sh")"
+if have bash; then
+	report "bash $N background jobs and jobs" $N "$(wall_us bash "$BENCH_TMP/jobs.sh")"
+fi
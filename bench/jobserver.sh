@@ -0,0 +1,32 @@
+# 4 builds of 16 -O2 units started together: each with make -j16, and sharing the shell's
+# jobserver, which keeps the compilers running at once to the number of CPUs
+. bench/lib.sh
+
+BUILDS=4
+UNITS=16
+have make && have gcc || { echo "  make and gcc needed"; exit 0; }
+for ((b = 1; b <= BUILDS; ++b)); do
+	mkdir "$BENCH_TMP/p$b"
+	for ((u = 1; u <= UNITS; ++u)); do
+		for ((f = 0; f < 10; ++f)); do
+			echo "double f${u}_$f(double *v, int n) { double s = 0; for (int i = 0; i < n; ++i) s += v[i] * v[(i * $f) % n]; return s; }"
+		done >"$BENCH_TMP/p$b/u$u.c"
+	done
+	printf 'all: $(patsubst %%.c,%%.o,$(wildcard *.c))\n%%.o: %%.c\n\tgcc -O2 -c $< -o $@\n' >"$BENCH_TMP/p$b/Makefile"
+done
+builds=
+for ((b = 1; b <= BUILDS; ++b)); do
+	builds="$builds 'make -s -C $BENCH_TMP/p$b JOBS'"
+done
+clean()
+{
+	rm -f "$BENCH_TMP"/p*/*.o
+}
+
+clean
+report "$BUILDS builds, make -j$UNITS each" $((BUILDS * UNITS)) \
+	"$(wall_us "$NSPT_SH" -c "parallel -j $BUILDS -u ${builds//JOBS/-j$UNITS}")"
+clean
+report "$BUILDS builds, jobserver on" $((BUILDS * UNITS)) \
+	"$(wall_us "$NSPT_SH" -c "jobserver on; parallel -j $BUILDS -u ${builds//JOBS/}")"
+ls "$BENCH_TMP"/p*/*.o | wc -l | awk -v n=$((BUILDS * UNITS)) '$1 != n {print "  only " $1 " of " n " units built"}'
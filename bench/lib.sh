@@ -0,0 +1,47 @@
+# helpers sourced by the bench/*.sh drivers, run them from the top of the tree (make bench)
+# NSPT_SH picks the shell binary, other shells are compared when they are installed
+
+NSPT_SH=${NSPT_SH:-$PWD/nspt_sh}
+BENCH_TMP=$(mktemp -d /tmp/nspt_bench.XXXXXX)
+trap 'rm -rf "$BENCH_TMP"' EXIT
+export PATH=/usr/local/bin:/usr/bin:/bin
+export XDG_CACHE_HOME=$BENCH_TMP/cache HISTFILE=$BENCH_TMP/history
+
+# print N lines of text
+lines()
+{
+	local n=$1
+	shift
+	yes "$*" | head -n "$n"
+}
+
+have()
+{
+	command -v "$1" >/dev/null 2>&1
+}
+
+# wall time of command in microseconds, stdin from /dev/null, output dropped
+wall_us()
+{
+	local start=${EPOCHREALTIME/./}
+	"$@" </dev/null >/dev/null 2>&1
+	echo $(( ${EPOCHREALTIME/./} - start ))
+}
+
+# median wall time of runs runs of command in microseconds
+median_us()
+{
+	local runs=$1
+	shift
+	for ((i = 0; i < runs; ++i)); do
+		wall_us "$@"
+	done | sort -n | awk '{t[NR] = $1} END {print t[int((NR + 1) / 2)]}'
+}
+
+# report label count us: time taken by count operations, and their rate
+report()
+{
+	awk -v label="$1" -v n="$2" -v us="$3" 'BEGIN {
+		printf "  %-40s %9.3f s  %9.0f/s  %9.2f us each\n", label, us / 1e6, n / (us / 1e6), us / n
+	}'
+}
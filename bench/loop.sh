@@ -0,0 +1,11 @@
+# interpreter loop: a million iterations of a for loop over $(seq) with an assignment and a builtin
+. bench/lib.sh
+
+N=1000000
+echo "for i in \$(seq $N); do X=\$i; : \"\$X\"; done" >"$BENCH_TMP/loop.sh"
+report "for loop, $N iterations" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/loop.sh")"
+for sh in bash dash; do
+	if have $sh; then
+		report "$sh for loop, $N iterations" $N "$(wall_us $sh "$BENCH_TMP/loop.sh")"
+	fi
+done
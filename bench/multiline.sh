@@ -0,0 +1,16 @@
+# a compound command spread over many lines, each line read only checks whether the
+# command can be complete yet, so reading stays linear in the number of lines
+. bench/lib.sh
+
+N=3000
+{
+	echo "i=0"
+	echo "while [ \$i = 0 ]; do"
+	lines $N "	X=a"
+	echo "	i=1"
+	echo "done"
+} >"$BENCH_TMP/loop.sh"
+report "$N-line while loop, piped stdin" $N "$(wall_us sh -c 'cat "$2" | "$1"' sh "$NSPT_SH" "$BENCH_TMP/loop.sh")"
+if have bash; then
+	report "bash $N-line while loop, piped stdin" $N "$(wall_us sh -c 'cat "$1" | bash' sh "$BENCH_TMP/loop.sh")"
+fi
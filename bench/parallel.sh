@@ -0,0 +1,21 @@
+# parallel: builtin items (each in a forked shell) and programs, wall time and the shell's peak RSS,
+# which stays flat however many items are run
+. bench/lib.sh
+
+JOBS=8
+run()
+{
+	local n=$1 item=$2 start=${EPOCHREALTIME/./} hwm
+	hwm=$(lines "$n" "$item" | "$NSPT_SH" -c "parallel -j $JOBS -u; grep VmHWM /proc/\$\$/status" 2>/dev/null |
+		awk '/^VmHWM:/ {print $2}')
+	report "$item, $n items, peak RSS $hwm kB" "$n" $(( ${EPOCHREALTIME/./} - start ))
+}
+
+run 1000 true
+run 10000 true
+run 10000 /bin/true
+if have xargs; then
+	start=${EPOCHREALTIME/./}
+	lines 10000 x | xargs -P $JOBS -n 1 /bin/true
+	report "xargs -P $JOBS /bin/true, 10000 items" 10000 $(( ${EPOCHREALTIME/./} - start ))
+fi
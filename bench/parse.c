@@ -0,0 +1,36 @@
+/* parser microbenchmark: a 72 byte pipeline with quotes and a redirection parsed into an arena,
+ * the arena is reset after each line as do_cmd() does
+ */
+#include "arena.h"
+#include "parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LINES 2000000
+
+static const char line[] = "grep -n \"foo bar\" 'src/a b.c' | sort -k2n | uniq -c | head -20 > out.txt";
+
+int main()
+{
+	struct arena arena = {NULL, 0};
+	struct pipeline *pl;
+	struct timespec start, end;
+	double ns;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < LINES; ++i) {
+		if (parse_cmd(&arena, line, &pl) != 0 || pl == NULL || pl->count != 4) {
+			fprintf(stderr, "parse: can't parse %s\n", line);
+			return EXIT_FAILURE;
+		}
+		arena_reset(&arena);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("  %zu byte pipeline, %d lines %9.3f s  %9.1f ns each\n", strlen(line), LINES, ns / 1e9, ns / LINES);
+	arena_free(&arena);
+	return 0;
+}
@@ -0,0 +1,21 @@
+#!/usr/bin/env python3
+# bracketed paste of a long generated command: time until it is shown, and until it has run
+import sys
+import time
+
+sys.path.insert(0, 'bench')
+from ptylib import PASTE_END, PASTE_START, PROMPT, Shell, report
+
+for size in (100 * 1024, 1024 * 1024):
+	sh = Shell()
+	word = b'x' * (size - 16)
+	shown, _ = sh.key(PASTE_START + b'echo ' + word + b' | wc -c' + PASTE_END)
+	start = time.perf_counter()
+	sh.write(b'\r')
+	out = sh.read_until(PROMPT)
+	ran = time.perf_counter() - start
+	if str(len(word) + 1).encode() not in out:
+		sys.exit('paste of %d bytes lost input: %r' % (size, out[-100:]))
+	report('paste %d KB, shown' % (size // 1024), shown)
+	report('paste %d KB, run' % (size // 1024), ran)
+	sh.close()
@@ -0,0 +1,13 @@
+# launch and teardown of a 32-stage pipeline, all stages are started by the shell itself
+. bench/lib.sh
+
+RUNS=200
+line="echo x"
+for ((i = 1; i < 32; ++i)); do
+	line="$line | cat"
+done
+lines $RUNS "$line" >"$BENCH_TMP/pipe.sh"
+report "32-stage pipeline, $RUNS runs" $RUNS "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/pipe.sh")"
+if have bash; then
+	report "bash 32-stage pipeline, $RUNS runs" $RUNS "$(wall_us bash "$BENCH_TMP/pipe.sh")"
+fi
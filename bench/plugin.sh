@@ -0,0 +1,22 @@
+# a loaded builtin plugin against the program it stands for, and builtin dispatch with plugins loaded
+. bench/lib.sh
+
+N=5000
+DISPATCH_N=50000
+make -s plugins || exit 1
+enable="enable -f $PWD/plugins/pathname.so basename dirname"
+{
+	echo "$enable"
+	lines $N "basename /usr/share/doc/readme.txt .txt >/dev/null"
+} >"$BENCH_TMP/plugin.sh"
+lines $N "/usr/bin/basename /usr/share/doc/readme.txt .txt >/dev/null" >"$BENCH_TMP/external.sh"
+lines $DISPATCH_N "[ x ]" >"$BENCH_TMP/test.sh"
+{
+	echo "$enable"
+	cat "$BENCH_TMP/test.sh"
+} >"$BENCH_TMP/test_plugins.sh"
+report "basename plugin, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/plugin.sh")"
+report "/usr/bin/basename, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/external.sh")"
+report "[ x ], $DISPATCH_N lines" $DISPATCH_N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/test.sh")"
+report "[ x ] with plugins loaded, $DISPATCH_N lines" $DISPATCH_N \
+	"$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/test_plugins.sh")"
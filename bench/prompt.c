@@ -0,0 +1,54 @@
+/* prompt microbenchmark: a format using every segment rendered 100k times, with nothing changed
+ * between renders, with the exit status changing, and with cwd changing (git dir searched again)
+ */
+#include "prompt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#define RENDERS 100000
+
+static const char format[] = "\\[\\e[1;32m\\]\\u@\\h \\H\\[\\e[0m\\]:\\[\\e[1;34m\\]\\w\\[\\e[0m\\] \\W"
+		" [\\?] \\j jobs \\C (\\b)\\n\\$ ";
+
+int main()
+{
+	static const char *const cases[] = {"nothing changed", "exit status changed", "cwd changed"};
+	struct prompt_input in;
+	struct timespec start, end;
+	char cwd[PATH_MAX];
+	size_t length, width;
+	double ns;
+	int c;
+	long i;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("prompt: getcwd");
+		return EXIT_FAILURE;
+	}
+	in.user = "user";
+	in.host = "build-host.example.com";
+	in.home = "/home/user";
+	in.cwd = cwd;
+	in.cwd_gen = 1;
+	in.last_status = 0;
+	in.job_count = 2;
+	prompt_render(format, &in, &length, &width);
+	printf("  prompt of %zu bytes, %zu columns\n", length, width);
+	for (c = 0; c < 3; ++c) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < RENDERS; ++i) {
+			if (c == 1)
+				in.last_status = i & 1;
+			else if (c == 2)
+				in.cwd_gen++;
+			prompt_render(format, &in, &length, &width);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		printf("  %-20s %d renders %9.3f s  %9.1f ns each\n", cases[c], RENDERS, ns / 1e9, ns / RENDERS);
+	}
+	return 0;
+}
@@ -0,0 +1,105 @@
+# helpers for the bench/*.py drivers that run nspt_sh interactively under a pty
+# NSPT_SH picks the shell binary, run them from the top of the tree (make bench)
+import fcntl
+import os
+import pty
+import select
+import shutil
+import signal
+import struct
+import tempfile
+import termios
+import time
+
+PROMPT = b'PROMPT> '
+TIMEOUT = 30
+PASTE_START = b'\x1b[200~'
+PASTE_END = b'\x1b[201~'
+LEFT = b'\x1b[D'
+RIGHT = b'\x1b[C'
+UP = b'\x1b[A'
+BACKSPACE = b'\x7f'
+CTRL_R = b'\x12'
+CTRL_C = b'\x03'
+TAB = b'\t'
+
+
+class Shell:
+	"""nspt_sh on a 200x50 pty, with its own HISTFILE and cache unless env sets them"""
+
+	def __init__(self, env=None, cwd=None):
+		self.home = tempfile.mkdtemp(prefix='nspt_bench.')
+		shell = os.path.abspath(os.environ.get('NSPT_SH', './nspt_sh'))
+		child_env = {
+			'PATH': '/usr/local/bin:/usr/bin:/bin',
+			'HOME': self.home,
+			'PS1': PROMPT.decode(),
+			'HISTFILE': os.path.join(self.home, 'history'),
+			'XDG_CACHE_HOME': self.home,
+			'TERM': 'xterm',
+		}
+		child_env.update(env or {})
+		start = time.perf_counter()
+		self.pid, self.fd = pty.fork()
+		if self.pid == 0:
+			if cwd is not None:
+				os.chdir(cwd)
+			os.execve(shell, [shell], child_env)
+		fcntl.ioctl(self.fd, termios.TIOCSWINSZ, struct.pack('HHHH', 50, 200, 0, 0))
+		self.read_until(PROMPT)
+		self.startup = time.perf_counter() - start  #until the first prompt is shown
+		self.quiet()
+
+	def write(self, data):
+		while data:
+			n = os.write(self.fd, data)
+			data = data[n:]
+
+	def read_until(self, token):
+		buf = b''
+		end = time.time() + TIMEOUT
+		while token not in buf:
+			ready, _, _ = select.select([self.fd], [], [], max(0, end - time.time()))
+			if not ready:
+				raise RuntimeError('timed out waiting for %r, got %r' % (token, buf[-200:]))
+			buf += os.read(self.fd, 65536)
+		return buf
+
+	def quiet(self, idle=0.2):
+		"""read output until there is none for idle seconds, return how much there was"""
+		total = 0
+		while select.select([self.fd], [], [], idle)[0]:
+			total += len(os.read(self.fd, 65536))
+		return total
+
+	def key(self, data, idle=0.005):
+		"""send one key, return (seconds until the last of its screen update, bytes of update)"""
+		start = time.perf_counter()
+		self.write(data)
+		if not select.select([self.fd], [], [], TIMEOUT)[0]:
+			raise RuntimeError('no screen update for key %r' % data)
+		total = len(os.read(self.fd, 65536))
+		last = time.perf_counter()
+		while select.select([self.fd], [], [], idle)[0]:
+			total += len(os.read(self.fd, 65536))
+			last = time.perf_counter()
+		return last - start, total
+
+	def paste(self, text):
+		self.write(PASTE_START + text + PASTE_END)
+		return self.quiet()
+
+	def close(self):
+		os.kill(self.pid, signal.SIGKILL)
+		os.waitpid(self.pid, 0)
+		os.close(self.fd)
+		shutil.rmtree(self.home, ignore_errors=True)
+
+
+def median(values):
+	values = sorted(values)
+	return values[len(values) // 2]
+
+
+def report(label, seconds, extra=''):
+	print('  %-40s %9.1f us%s' % (label, seconds * 1e6, extra))
@@ -0,0 +1,19 @@
+#!/usr/bin/env python3
+# keystroke to echo latency when editing in the middle of a long line, and the bytes of
+# screen update sent per key (the wrapped tail after the cursor, in one write)
+import sys
+
+sys.path.insert(0, 'bench')
+from ptylib import BACKSPACE, LEFT, Shell, median, report
+
+KEYS = 200
+
+for size in (4096, 65536):
+	sh = Shell()
+	sh.paste(b'x' * size)
+	sh.write(LEFT * (size // 2))
+	sh.quiet()
+	for name, key in (('insert', b'y'), ('backspace', BACKSPACE)):
+		times, sizes = zip(*(sh.key(key) for _ in range(KEYS)))
+		report('%s, %d KB line' % (name, size // 1024), median(times), '  %6d bytes' % median(sizes))
+	sh.close()
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# run benchmark drivers in bench/, all of them or the ones named: bench/run.sh [name...]
+# NAME.sh runs with bash, NAME.py with python3, NAME.c is built by make as bench/NAME first
+
+cd "$(dirname "$0")/.." || exit 1
+if [ $# -eq 0 ]; then
+	for f in bench/*.sh bench/*.py bench/*.c; do
+		[ -e "$f" ] || continue
+		name=${f#bench/}
+		case $name in
+			lib.sh|run.sh|ptylib.py) ;;
+			*) set -- "$@" "${name%.*}" ;;
+		esac
+	done
+fi
+for name; do
+	echo "== $name"
+	if [ -f "bench/$name.sh" ]; then
+		bash "bench/$name.sh"
+	elif [ -f "bench/$name.py" ]; then
+		python3 "bench/$name.py"
+	elif [ -f "bench/$name.c" ]; then
+		make -s "bench/$name" && "bench/$name"
+	else
+		echo "no benchmark $name" >&2
+		exit 1
+	fi
+done
@@ -0,0 +1,176 @@
+/* word scanning microbenchmark: scalar, sse2 and avx2 versions of scan_word_end() over lists
+ * of command options and of long words (paths, data) from 1 KB to 1 MB, all versions must agree
+ * on every word, against a baseline of the strtok splitting the shell did before the lexer
+ */
+#include "../scan.c"
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#define TOTAL (256L << 20)  //bytes scanned per size and version
+
+struct version {
+	const char *name;
+	size_t (*scan)(const char *str);
+	int supported;
+};
+
+/* strip_space() and split_cmd() as tools.c had them before the lexer */
+static void strip_space(char *str, size_t *length)
+{
+	assert(str != NULL);
+
+	size_t i, spare_length;
+	
+	if (length == NULL) {
+		spare_length = strlen(str);
+		length = &spare_length;
+	}
+	/*strip space at tail*/
+	for (i = *length - 1; isspace(str[i]); --i) {
+		str[i] = '\0';
+		(*length)--;
+	}
+	/*strip space at head*/
+	for (i = 0; isspace(str[i]); ++i);
+	for (size_t j = 0, k = i; k <= spare_length; ++j,++k)
+		str[j] = str[k];
+	*length = *length - i;
+}
+
+static char **split_cmd(char *cmd_buf, const char *delimiter, size_t *number)
+{
+	assert(cmd_buf != NULL && delimiter != NULL);
+
+	char **args;
+	size_t arg_num = 0;
+
+	args = calloc(strlen(cmd_buf) / 2 + 1, sizeof(char *)); //allocate absolutely sufficient memory
+	if (args == NULL) {
+		syslog(LOG_ERR, "Can't allocate cmd_buf: %m");
+		exit(EXIT_FAILURE);
+	}
+
+	args[0] = strtok(cmd_buf, delimiter);
+	if (args[0] == NULL) { //command is empty or full of delimiter
+		free(args);
+		if (number)
+			*number = 0;
+		return NULL;
+	}
+	arg_num++;
+	for (size_t i = 1; (args[i] = strtok(NULL, delimiter)) != NULL; i++, arg_num++);
+
+	args = realloc(args, (arg_num + 1) * sizeof(char *));
+	args[arg_num] = NULL;
+	if (number)
+		*number = arg_num;
+	return args;
+}
+
+/* words of str split the old way: a copy of the line is trimmed, split at '|',
+ * then each stage at '>' and its command at blanks, return the number of words
+ */
+static size_t strtok_words(const char *str, char *copy)
+{
+	char **stages, **parts, **args;
+	size_t count = 0, stage_count, n, i;
+
+	strcpy(copy, str);
+	strip_space(copy, NULL);
+	if ((stages = split_cmd(copy, "|", &stage_count)) == NULL)
+		return 0;
+	for (i = 0; i < stage_count; ++i) {
+		if ((parts = split_cmd(stages[i], ">", NULL)) == NULL)
+			continue;
+		if ((args = split_cmd(parts[0], " \t\n", &n)) != NULL)
+			count += n;
+		free(args);
+		free(parts);
+	}
+	free(stages);
+	return count;
+}
+
+/* walk over every word of str, return the number of words */
+static size_t words(size_t (*scan)(const char *str), const char *str)
+{
+	size_t count = 0, len;
+
+	while (*str != '\0') {
+		if ((len = scan(str)) == 0) {
+			++str;
+			continue;
+		}
+		str += len;
+		++count;
+	}
+	return count;
+}
+
+int main()
+{
+	static const size_t sizes[] = {1024, 16 * 1024, 1024 * 1024};
+	static const char *const kinds[] = {"options", "long words"};
+	const struct version versions[] = {
+		{"scalar", scan_scalar, 1},
+#ifdef SCAN_X86
+		{"sse2", scan_sse2, __builtin_cpu_supports("sse2")},
+		{"avx2", scan_avx2, __builtin_cpu_supports("avx2")},
+#endif
+	};
+	struct timespec start, end;
+	size_t i, k, v, len, expect, count;
+	long round, rounds;
+	double ns;
+	char *list, *copy;
+
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k)
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		//page aligned like a line buffer, so vector loads past the end stay in mapped memory
+		list = aligned_alloc(4096, sizes[i] + 4096);
+		for (len = 0; len + 256 < sizes[i]; ) {
+			if (k == 0)
+				len += sprintf(list + len, "--option-%zu=value ", len);
+			else
+				len += sprintf(list + len, "%0200zu ", len);
+		}
+		list[len] = '\0';
+		expect = words(scan_scalar, list);
+		rounds = TOTAL / len;
+		copy = malloc(len + 1);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (round = 0; round < rounds; ++round) {
+			if ((count = strtok_words(list, copy)) != expect) {
+				fprintf(stderr, "scan: strtok found %zu words, not %zu\n", count, expect);
+				return EXIT_FAILURE;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		printf("  %-6s %-10s %5zu KB %8.2f GB/s\n", "strtok", kinds[k], sizes[i] / 1024,
+				(double)rounds * len / ns);
+		for (v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v) {
+			if (!versions[v].supported)
+				continue;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (round = 0; round < rounds; ++round) {
+				if ((count = words(versions[v].scan, list)) != expect) {
+					fprintf(stderr, "scan: %s found %zu words, not %zu\n", versions[v].name, count, expect);
+					return EXIT_FAILURE;
+				}
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+			printf("  %-6s %-10s %5zu KB %8.2f GB/s\n", versions[v].name, kinds[k], sizes[i] / 1024,
+					(double)rounds * len / ns);
+		}
+		free(copy);
+		free(list);
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+# launch cost of external commands, posix_spawn() doesn't copy the shell's memory map,
+# so it stays the same when the shell's heap has grown (here by 50000 variables)
+. bench/lib.sh
+
+N=5000
+lines $N /bin/true >"$BENCH_TMP/plain.sh"
+for ((i = 0; i < 50000; ++i)); do
+	echo "V$i=xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+done >"$BENCH_TMP/vars.sh"
+cat "$BENCH_TMP/vars.sh" "$BENCH_TMP/plain.sh" >"$BENCH_TMP/heap.sh"
+vars_us=$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/vars.sh")
+heap_us=$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/heap.sh")
+report "/bin/true, $N lines" $N "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/plain.sh")"
+report "/bin/true after heap grew, $N lines" $N $((heap_us - vars_us))
+if have bash; then
+	report "bash /bin/true, $N lines" $N "$(wall_us bash "$BENCH_TMP/plain.sh")"
+fi
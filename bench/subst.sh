@@ -0,0 +1,19 @@
+# command substitution: builtins evaluated in the shell, a builtin writing through a file,
+# an external program, and a plain assignment for the cost of the line itself
+. bench/lib.sh
+
+N=10000
+EXTERNAL_N=2000
+while read -r n line; do
+	lines "$n" "$line" >"$BENCH_TMP/subst.sh"
+	report "$line" "$n" "$(wall_us "$NSPT_SH" --no-script-cache "$BENCH_TMP/subst.sh")"
+	if have bash; then
+		report "bash $line" "$n" "$(wall_us bash "$BENCH_TMP/subst.sh")"
+	fi
+done <<LINES
+$N X=a
+$N X=\$(pwd)
+$N X=\$(echo a b c)
+$EXTERNAL_N X=\$(pwd >/dev/stdout)
+$EXTERNAL_N X=\$(/bin/echo a)
+LINES
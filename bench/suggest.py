@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+# inline suggestions from a 1M-entry history: startup with the newest entries indexed,
+# and the round trip of a typed key with the suggestion looked up and drawn
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, 'bench')
+from ptylib import BACKSPACE, RIGHT, Shell, median, report
+
+ENTRIES = 1000000
+TYPED = b'make -C src/module4 targ'
+
+with tempfile.TemporaryDirectory(prefix='nspt_bench.') as tmp:
+	path = os.path.join(tmp, 'history')
+	with open(path, 'w') as f:
+		for start in range(0, ENTRIES, 100000):
+			f.write(''.join('make -C src/module%d target%d -j8\n' % (i % 997, i)
+				for i in range(start, start + 100000)))
+	startup = []
+	for _ in range(5):
+		sh = Shell(env={'HISTFILE': path})
+		startup.append(sh.startup)
+		sh.close()
+	report('startup to first prompt', median(startup))
+	sh = Shell(env={'HISTFILE': path})
+	keys = []
+	for _ in range(5):
+		keys += [sh.key(bytes([ch]))[0] for ch in TYPED]
+		accept = sh.key(RIGHT)[0]
+		sh.write(BACKSPACE * 100)
+		sh.quiet()
+	report('typed key with suggestion', median(keys))
+	report('Right arrow, suggestion taken', accept)
+	sh.close()
@@ -9,10 +9,20 @@
 #include <syslog.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <limits.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
 #include "exec_cmd.h"
+#include "path_cache.h"
 #include "sh_env.h"
 #include "tools.h"
 #include "tty_ctl.h"
+#include "nspt_builtin.h"
+#include "parallel.h"
+#include "jobserver.h"
+#include "vars.h"
+#include "interp.h"
 
 static int build_in_cd(char **argv);
 static int build_in_type(char **argv);
@@ -20,44 +30,225 @@ static int build_in_jobs(char **argv);
 static int build_in_fg(char **argv);
 static int build_in_bg(char **argv);
 static int build_in_exit(char **argv);
+static int build_in_hash(char **argv);
+static int build_in_set(char **argv);
+static int build_in_true(char **argv);
+static int build_in_false(char **argv);
+static int build_in_echo(char **argv);
+static int build_in_printf(char **argv);
+static int build_in_pwd(char **argv);
+static int build_in_test(char **argv);
+static int build_in_enable(char **argv);
+static int build_in_parallel(char **argv);
+static int build_in_jobserver(char **argv);
+static int build_in_export(char **argv);
+static int build_in_unset(char **argv);
+static int build_in_break(char **argv);
+static int build_in_return(char **argv);
+static int build_in_shift(char **argv);
 
 struct buildin {
-	char *cmd;
+	const char *cmd;
 	int (*func)(char **argv);
+	int capture;                        //only writes stdout through stdio and leaves shell state alone
+	const struct nspt_builtin *plugin;  //builtin loaded by enable -f, func is NULL
+	void *handle;                       //dlopen handle, each loaded builtin holds one reference
+	char *path;                         //lib the builtin is loaded from
 };
 
-static struct buildin build_in_cmds[] = {
+static const struct buildin default_cmds[] = {
 	{"cd", build_in_cd},
-	{"type", build_in_type},
-	{"jobs", build_in_jobs},
+	{"type", build_in_type, 1},
+	{"jobs", build_in_jobs},  //reaps and drops exited jobs
 	{"fg", build_in_fg},
 	{"bg", build_in_bg},
-	{"exit", build_in_exit}
+	{"exit", build_in_exit},
+	{"hash", build_in_hash},
+	{"set", build_in_set},
+	{"true", build_in_true, 1},
+	{":", build_in_true, 1},
+	{"false", build_in_false, 1},
+	{"echo", build_in_echo, 1},
+	{"printf", build_in_printf, 1},
+	{"pwd", build_in_pwd, 1},
+	{"test", build_in_test, 1},
+	{"[", build_in_test, 1},
+	{"enable", build_in_enable},
+	{"parallel", build_in_parallel},
+	{"jobserver", build_in_jobserver},
+	{"export", build_in_export},
+	{"unset", build_in_unset},
+	{"break", build_in_break},
+	{"continue", build_in_break},
+	{"return", build_in_return},
+	{"shift", build_in_shift}
 };
+#define DEFAULT_CMD_COUNT  (sizeof(default_cmds)/sizeof(struct buildin))
+#define BUILD_IN_MIN_SLOTS 32
 
-int is_build_in(char *cmd, size_t *idx)
+/* enabled builtins, looked up through an open addressing hash of their names,
+ * table only changes on enable, so slots are simply rebuilt then
+ */
+static struct build_in_table {
+	struct buildin *cmds;
+	size_t count, cap;
+	size_t *slots;       //idx + 1 of cmd, 0 if slot is empty
+	size_t slot_count;
+	unsigned long generation;  //changes whenever builtins move to other indexes
+} table = {NULL, 0, 0, NULL, 0, 0};
+
+static size_t hash_name(const char *name)
 {
-	assert(cmd != NULL);
-	for (size_t i = 0; i < sizeof(build_in_cmds)/sizeof(struct buildin); ++i) {
-		if (strcmp(build_in_cmds[i].cmd, cmd) == 0) {
-			if (idx)
-				*idx = i;
-			return 1;
+	size_t hash = 14695981039346656037UL;
+	for (; *name; ++name) {
+		hash ^= (unsigned char)*name;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+static void rebuild_slots()
+{
+	size_t slot_count = BUILD_IN_MIN_SLOTS, pos;
+
+	while (slot_count < table.count * 2)
+		slot_count *= 2;
+	free(table.slots);
+	if ((table.slots = calloc(slot_count, sizeof(size_t))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate builtin hash slots: %m");
+		exit(EXIT_FAILURE);
+	}
+	table.slot_count = slot_count;
+	table.generation++;
+	for (size_t i = 0; i < table.count; ++i) {
+		for (pos = hash_name(table.cmds[i].cmd) & (slot_count - 1); table.slots[pos] != 0; pos = (pos + 1) & (slot_count - 1));
+		table.slots[pos] = i + 1;
+	}
+}
+
+static void build_in_init()
+{
+	table.cap = DEFAULT_CMD_COUNT * 2;
+	if ((table.cmds = malloc(table.cap * sizeof(struct buildin))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate builtin table: %m");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(table.cmds, default_cmds, sizeof(default_cmds));
+	table.count = DEFAULT_CMD_COUNT;
+	rebuild_slots();
+}
+
+/* index of builtin cmd, -1 if it isn't enabled */
+static ssize_t find_build_in(const char *cmd)
+{
+	size_t pos, idx;
+
+	if (table.cmds == NULL)
+		build_in_init();
+	for (pos = hash_name(cmd) & (table.slot_count - 1); (idx = table.slots[pos]) != 0; pos = (pos + 1) & (table.slot_count - 1)) {
+		if (strcmp(table.cmds[idx - 1].cmd, cmd) == 0)
+			return idx - 1;
+	}
+	return -1;
+}
+
+static void release_build_in(struct buildin *b)
+{
+	if (b->handle != NULL) {
+		dlclose(b->handle);
+		free(b->path);
+	}
+}
+
+/* add builtin, one with the same name is replaced */
+static void add_build_in(const struct buildin *b)
+{
+	ssize_t idx = find_build_in(b->cmd);
+
+	if (idx >= 0) {
+		release_build_in(&table.cmds[idx]);
+		table.cmds[idx] = *b;
+		return;
+	}
+	if (table.count == table.cap) {
+		table.cap *= 2;
+		if ((table.cmds = realloc(table.cmds, table.cap * sizeof(struct buildin))) == NULL) {
+			syslog(LOG_ERR, "Can't reallocate builtin table: %m");
+			exit(EXIT_FAILURE);
 		}
 	}
-	return 0;
+	table.cmds[table.count++] = *b;
+	rebuild_slots();
+}
+
+static void remove_build_in(size_t idx)
+{
+	release_build_in(&table.cmds[idx]);
+	table.cmds[idx] = table.cmds[--table.count];
+	rebuild_slots();
+}
+
+int is_build_in(char *cmd, size_t *idx)
+{
+	assert(cmd != NULL);
+
+	ssize_t found = find_build_in(cmd);
+	if (found < 0)
+		return 0;
+	if (idx)
+		*idx = found;
+	return 1;
+}
+
+/* indexes found before the generation changes may refer to other builtins since */
+unsigned long build_in_generation()
+{
+	return table.generation;
+}
+
+/* builtin idx can run in shell with its stdout captured into memory, see command_output() */
+int build_in_capturable(size_t idx)
+{
+	return table.cmds[idx].capture;
+}
+
+/* name of builtin idx, NULL if idx is past the last one */
+const char *build_in_name(size_t idx)
+{
+	if (table.cmds == NULL)
+		build_in_init();
+	return idx < table.count ? table.cmds[idx].cmd : NULL;
 }
 
-void do_build_in(int index, char *args[])
+/* run builtin index, loaded builtins read in_fd, all builtins write stdout
+ * return exit status, builtins return -1 on error, which becomes 1
+ */
+int do_build_in(int index, char *args[], int in_fd)
 {
-	assert(index >= 0 && index < sizeof(build_in_cmds)/sizeof(struct buildin));
+	assert(index >= 0 && index < table.count);
 	assert(args != NULL && args[0] != NULL);
-	build_in_cmds[index].func(args);
+
+	const struct buildin *b = &table.cmds[index];
+	int result;
+
+	if (b->plugin != NULL) {
+		fflush(stdout);
+		result = b->plugin->func(args, in_fd, STDOUT_FILENO);
+	} else {
+		result = b->func(args);
+	}
+	return result < 0 ? 1 : result;
 }
 
 static int build_in_exit(char **argv)
 {
-	exit(EXIT_SUCCESS);
+	int status = argv[1] != NULL ? atoi(argv[1]) : get_last_status();
+
+	if (getpid() != vars_shell_pid()) { //forked stage or subshell, terminal is left to shell
+		fflush(stdout);
+		_exit(status);
+	}
+	exit(status);
 }
 
 static int build_in_cd(char **argv)
@@ -79,81 +270,202 @@ static int build_in_cd(char **argv)
 
 static int build_in_type(char **argv)
 {
-	char *cmd, *which_cmd;
-	FILE *which_pipe;
-	int which_output;
+	char *cmd;
+	const char *path;
 
 	for(size_t i = 1; (cmd = argv[i]) != NULL; i++) {
+		if (find_function(cmd) != NULL) {
+			printf("%s: shell function\n", cmd);
+			continue;
+		}
 		if (is_build_in(cmd, NULL)) {
 			printf("%s: shell buildin\n", cmd);
 			continue;
 		}
-		which_cmd = malloc(strlen("which ") + strlen(cmd) + 1); //+1 for '\0'
-		if (which_cmd == NULL) {
-			syslog(LOG_ERR, "type: can't allocate memory: %m");
-			return -1;
-		}
-		strcpy(which_cmd, "which ");
-		strcat(which_cmd, cmd);
-		which_pipe = popen(which_cmd, "r");
-		free(which_cmd);
-		if ((which_output = fgetc(which_pipe)) != EOF) {
-			if (which_output == '/') {
-				printf("%s: ", cmd);
-				do {
-					putchar(which_output);
-				} while((which_output = fgetc(which_pipe)) != EOF);
-			}
-		} else {
+		if ((path = path_cache_lookup(cmd)) != NULL)
+			printf("%s: %s\n", cmd, path);
+		else
 			printf("%s: not found\n", cmd);
-		}
-		pclose(which_pipe);
 	}
 	return 0;
 }
 
+/* hash:           list cached command locations with hit counts
+ * hash -r:        forget all cached locations
+ * hash name...:   look up names and add them to cache
+ */
+static int build_in_hash(char **argv)
+{
+	int result = 0;
+
+	if (argv[1] == NULL) {
+		path_cache_output();
+		return 0;
+	}
+	if (strcmp(argv[1], "-r") == 0) {
+		path_cache_clear();
+		return 0;
+	}
+	for (size_t i = 1; argv[i] != NULL; ++i) {
+		if (path_cache_lookup(argv[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", argv[i]);
+			result = -1;
+		}
+	}
+	return result;
+}
+
+/* jobs:    list background jobs
+ * jobs -l: also show resource usage of exited processes of each job
+ */
 static int build_in_jobs(char **argv)
 {
-	output_jobs();
+	int long_format = 0;
+
+	if (argv[1] != NULL) {
+		if (strcmp(argv[1], "-l") != 0 || argv[2] != NULL) {
+			fprintf(stderr, "jobs: usage: jobs [-l]\n");
+			return -1;
+		}
+		long_format = 1;
+	}
+	update_job_state(0, NULL, 0);
+	output_jobs(long_format);
+	return 0;
+}
+
+/* set -o pipefail: status of pipe job is the last non-zero exit code of its processes
+ * set +o pipefail: status of pipe job is exit code of its end process
+ */
+static int build_in_set(char **argv)
+{
+	if (argv[1] == NULL || argv[2] == NULL || strcmp(argv[2], "pipefail") != 0
+	|| (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0)) {
+		fprintf(stderr, "set: usage: set -o|+o pipefail\n");
+		return -1;
+	}
+	set_pipefail(argv[1][0] == '-');
+	return 0;
+}
+
+/* load builtin name from lib, it replaces a builtin with the same name */
+static int load_build_in(const char *lib, const char *name)
+{
+	struct buildin b = {NULL, NULL, 0, NULL, NULL, NULL};
+	char *sym;
+
+	if ((b.handle = dlopen(lib, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		fprintf(stderr, "enable: %s\n", dlerror());
+		return -1;
+	}
+	if (asprintf(&sym, "%s_builtin", name) == -1) {
+		syslog(LOG_ERR, "Can't allocate builtin symbol name: %m");
+		exit(EXIT_FAILURE);
+	}
+	b.plugin = dlsym(b.handle, sym);
+	free(sym);
+	if (b.plugin == NULL || b.plugin->abi != NSPT_BUILTIN_ABI || b.plugin->func == NULL
+	|| b.plugin->name == NULL || strcmp(b.plugin->name, name) != 0) {
+		fprintf(stderr, "enable: %s: not a builtin of %s (ABI %d)\n", name, lib, NSPT_BUILTIN_ABI);
+		dlclose(b.handle);
+		return -1;
+	}
+	if ((b.path = strdup(lib)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate builtin lib path: %m");
+		exit(EXIT_FAILURE);
+	}
+	b.cmd = b.plugin->name;
+	add_build_in(&b);
 	return 0;
 }
 
+/* enable:                   list builtins
+ * enable -f lib.so name...: load builtins from lib.so, see nspt_builtin.h
+ * enable -n name...:        remove builtins, loaded ones are unloaded
+ * enable name...:           restore removed builtins that are compiled in
+ */
+static int build_in_enable(char **argv)
+{
+	ssize_t idx;
+	size_t i;
+	int result = 0;
+
+	if (argv[1] == NULL) {
+		for (i = 0; i < table.count; ++i) {
+			if (table.cmds[i].plugin != NULL)
+				printf("enable -f %s %s\n", table.cmds[i].path, table.cmds[i].cmd);
+			else
+				printf("enable %s\n", table.cmds[i].cmd);
+		}
+		return 0;
+	}
+	if (strcmp(argv[1], "-f") == 0) {
+		if (argv[2] == NULL || argv[3] == NULL) {
+			fprintf(stderr, "enable: usage: enable -f lib.so name...\n");
+			return -1;
+		}
+		for (i = 3; argv[i] != NULL; ++i) {
+			if (load_build_in(argv[2], argv[i]) != 0)
+				result = -1;
+		}
+		return result;
+	}
+	if (strcmp(argv[1], "-n") == 0) {
+		for (i = 2; argv[i] != NULL; ++i) {
+			if ((idx = find_build_in(argv[i])) < 0) {
+				fprintf(stderr, "enable: %s: not a shell builtin\n", argv[i]);
+				result = -1;
+				continue;
+			}
+			remove_build_in(idx);
+		}
+		return result;
+	}
+	for (i = 1; argv[i] != NULL; ++i) {
+		if (find_build_in(argv[i]) >= 0)
+			continue;
+		for (idx = 0; idx < DEFAULT_CMD_COUNT && strcmp(default_cmds[idx].cmd, argv[i]) != 0; ++idx);
+		if (idx == DEFAULT_CMD_COUNT) {
+			fprintf(stderr, "enable: %s: not a shell builtin\n", argv[i]);
+			result = -1;
+			continue;
+		}
+		add_build_in(&default_cmds[idx]);
+	}
+	return result;
+}
+
 static int build_in_fg(char **argv)
 {
 	struct job_state job;
-	sigset_t oldmask, wait_chld_mask, allmask;
+	sigset_t oldmask, allmask;
 
 	if (argv[1] == NULL) {
-		fprintf(stderr, "fg: usage: fg <job_id>\n");
+		fprintf(stderr, "fg: usage: fg <%%job_id | pgid>\n");
+		return -1;
+	}
+	if ((job.pgid = job_spec_to_pgid(argv[1])) == 0) {
+		fprintf(stderr, "fg: no such job\n");
 		return -1;
 	}
-	job.pgid = (pid_t)atoll(argv[1]);
-	job.pgid = job.pgid < 0 ? -job.pgid : job.pgid;
 
-	sigfillset(&wait_chld_mask);
 	sigfillset(&allmask);
-	sigdelset(&wait_chld_mask, SIGCHLD);
 	sigprocmask(SIG_SETMASK, &allmask, &oldmask);
-	if (!bg2fg(job.pgid)) {
-		fprintf(stderr, "fg: no such job\n");
-		return -1;
-	} else if (tcsetpgrp(STDIN_FILENO, job.pgid) != 0) {
-		syslog(LOG_ERR, "Can't hand over terminal to job: %lu :%m", (unsigned long)job.pgid);
+	bg2fg(job.pgid);
+	if (is_interactive()) {
+		if (tcsetpgrp(STDIN_FILENO, job.pgid) != 0)
+			syslog(LOG_ERR, "Can't hand over terminal to job: %lu :%m", (unsigned long)job.pgid);
+		tty_reset();
 	}
-	tty_reset();
 	kill(-job.pgid, SIGCONT);
-	while (1) {
-		sigsuspend(&wait_chld_mask);
-		update_job_state(0, &job, 1);
-		if (job.state == 'e' || job.state == 's') {
-			break;
+	wait_job(&job);
+	if (is_interactive()) {
+		if (tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
+			syslog(LOG_ERR, "Can't hand over terminal to parent: %m");
+			exit(EXIT_FAILURE);
 		}
+		tty_cbreak();
 	}
-	if (tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
-		syslog(LOG_ERR, "Can't hand over terminal to parent: %m");
-		exit(EXIT_FAILURE);
-	}
-	tty_cbreak();
 	sigprocmask(SIG_SETMASK, &oldmask, NULL);
 	return 0;
 }
@@ -162,15 +474,662 @@ static int build_in_bg(char **argv)
 {
 	pid_t pgid;
 	if (argv[1] == NULL) {
-		fprintf(stderr, "bg: usage: bg <pgid>\n");
+		fprintf(stderr, "bg: usage: bg <%%job_id | pgid>\n");
 		return -1;
 	}
-	pgid = (pid_t)atoll(argv[1]);
-	pgid = pgid < 0 ? -pgid : pgid;
-	if (!is_bgpgid(pgid, NULL)) {
+	if ((pgid = job_spec_to_pgid(argv[1])) == 0) {
 		fprintf(stderr, "bg: no such job\n");
 		return -1;
 	}
 	kill(-pgid, SIGCONT);
 	return 0;
 }
+
+static int build_in_true(char **argv)
+{
+	return 0;
+}
+
+static int build_in_false(char **argv)
+{
+	return 1;
+}
+
+static int build_in_pwd(char **argv)
+{
+	char cwd[PATH_MAX];
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		fprintf(stderr, "pwd: %s\n", strerror(errno));
+		return -1;
+	}
+	puts(cwd);
+	return 0;
+}
+
+/* write escape whose letter is at p (just after backslash) to stdout, as echo -e and printf do,
+ * octal escapes are \0nnn if zero_octal is non-zero (echo, %b), \nnn otherwise (printf format),
+ * *stop is set on \c
+ * return pointer to last char of escape
+ */
+static const char *put_escape(const char *p, int zero_octal, int *stop)
+{
+	static const char *letters = "abefnrtv\\", *values = "\a\b\033\f\n\r\t\v\\";
+	const char *letter;
+	int value = 0, digits = 0, max;
+
+	if (*p == '\0') { //lone backslash at end
+		putchar('\\');
+		return p - 1;
+	}
+	if (*p == 'c') {
+		*stop = 1;
+		return p;
+	}
+	if ((letter = strchr(letters, *p)) != NULL) {
+		putchar(values[letter - letters]);
+		return p;
+	}
+	if (*p == 'x' && isxdigit((unsigned char)p[1])) {
+		for (; digits < 2 && isxdigit((unsigned char)p[1]); ++digits, ++p)
+			value = value * 16 + (isdigit((unsigned char)p[1]) ? p[1] - '0' : tolower((unsigned char)p[1]) - 'a' + 10);
+		putchar(value);
+		return p;
+	}
+	if (*p >= '0' && *p <= '7' && (!zero_octal || *p == '0')) {
+		max = zero_octal ? 3 : 2;
+		value = *p - '0';
+		for (; digits < max && p[1] >= '0' && p[1] <= '7'; ++digits, ++p)
+			value = value * 8 + p[1] - '0';
+		putchar(value);
+		return p;
+	}
+	putchar('\\');
+	putchar(*p);
+	return p;
+}
+
+/* return 1 if \c was seen and output should stop, 0 otherwise */
+static int put_escaped(const char *str)
+{
+	int stop = 0;
+
+	for (; *str && !stop; ++str) {
+		if (*str == '\\')
+			str = put_escape(str + 1, 1, &stop);
+		else
+			putchar(*str);
+	}
+	return stop;
+}
+
+/* echo [-neE] [arg...]: -n no trailing newline, -e expand escapes, -E don't (default) */
+static int build_in_echo(char **argv)
+{
+	int newline = 1, escapes = 0;
+	size_t i = 1;
+
+	for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' && strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); ++i) {
+		for (const char *opt = argv[i] + 1; *opt; ++opt) {
+			if (*opt == 'n')
+				newline = 0;
+			else
+				escapes = *opt == 'e';
+		}
+	}
+	for (; argv[i] != NULL; ++i) {
+		if (escapes) {
+			if (put_escaped(argv[i]))
+				return 0;
+		} else
+			fputs(argv[i], stdout);
+		if (argv[i + 1] != NULL)
+			putchar(' ');
+	}
+	if (newline)
+		putchar('\n');
+	return 0;
+}
+
+/* numeric printf argument, 'c gives code of c, bad numbers are reported and count as what was parsed */
+static long long printf_int(const char *arg, int *err)
+{
+	char *end;
+	long long value;
+
+	if (arg == NULL)
+		return 0;
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+	errno = 0;
+	value = strtoll(arg, &end, 0);
+	if (end == arg || *end != '\0' || errno != 0) {
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		*err = 1;
+	}
+	return value;
+}
+
+static double printf_float(const char *arg, int *err)
+{
+	char *end;
+	double value;
+
+	if (arg == NULL)
+		return 0;
+	value = strtod(arg, &end);
+	if (end == arg || *end != '\0') {
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		*err = 1;
+	}
+	return value;
+}
+
+/* printf format [arg...]: format is reused until all args are consumed */
+static int build_in_printf(char **argv)
+{
+	char spec[64], conv, **args = argv + 2, **round_start;
+	const char *fmt, *start, *arg;
+	int err = 0, stop = 0, width = 0, precision = 0, has_width, has_precision;
+	size_t spec_len;
+
+	if (argv[1] == NULL) {
+		fprintf(stderr, "printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+	do {
+		round_start = args;
+		for (fmt = argv[1]; *fmt; ++fmt) {
+			if (*fmt == '\\') {
+				fmt = put_escape(fmt + 1, 0, &stop);
+				if (stop)
+					return err;
+				continue;
+			}
+			if (*fmt != '%') {
+				putchar(*fmt);
+				continue;
+			}
+			if (fmt[1] == '%') {
+				putchar('%');
+				++fmt;
+				continue;
+			}
+
+			//%[flags][width|*][.precision|.*]conv, '*' takes its value from next argument
+			start = fmt++;
+			fmt += strspn(fmt, "-+ #0");
+			if ((has_width = *fmt == '*')) {
+				width = (int)printf_int(*args, &err);
+				args += *args != NULL;
+				++fmt;
+			} else
+				fmt += strspn(fmt, "0123456789");
+			has_precision = 0;
+			if (*fmt == '.') {
+				++fmt;
+				if ((has_precision = *fmt == '*')) {
+					precision = (int)printf_int(*args, &err);
+					args += *args != NULL;
+					++fmt;
+				} else
+					fmt += strspn(fmt, "0123456789");
+			}
+			if (*fmt == '\0' || strchr("diouxXcsbeEfgG", *fmt) == NULL) {
+				fprintf(stderr, "printf: %.*s: invalid format\n", (int)(fmt - start + (*fmt != '\0')), start);
+				return 1;
+			}
+			conv = *fmt;
+			arg = *args;
+			args += *args != NULL;
+			if (conv == 'b') {
+				if (arg != NULL && put_escaped(arg))
+					return err;
+				continue;
+			}
+			if ((spec_len = fmt - start) + 4 > sizeof(spec)) {
+				fprintf(stderr, "printf: format too long\n");
+				return 1;
+			}
+			memcpy(spec, start, spec_len);
+			if (strchr("diouxX", conv) != NULL) {
+				memcpy(spec + spec_len, "ll", 2);
+				spec_len += 2;
+			}
+			spec[spec_len] = conv == 'c' ? 's' : conv; //%c as one-char string, so a missing arg prints nothing
+			spec[spec_len + 1] = '\0';
+
+#define PRINTF_STAR(value) \
+			(has_width && has_precision ? printf(spec, width, precision, value) : \
+			has_width ? printf(spec, width, value) : has_precision ? printf(spec, precision, value) : printf(spec, value))
+			if (strchr("diouxX", conv) != NULL)
+				PRINTF_STAR(printf_int(arg, &err));
+			else if (conv == 'c')
+				PRINTF_STAR(((char[2]){arg != NULL ? arg[0] : '\0', '\0'}));
+			else if (conv == 's')
+				PRINTF_STAR(arg != NULL ? arg : "");
+			else
+				PRINTF_STAR(printf_float(arg, &err));
+#undef PRINTF_STAR
+		}
+	} while (*args != NULL && args != round_start); //stop if format takes no argument
+	return err;
+}
+
+/* test and [ evaluation, stat results are kept for the duration of one evaluation,
+ * so "[ -e f -a -f f -a -s f ]" stats f once
+ */
+#define TEST_STAT_CACHE 4
+
+struct test_eval {
+	char **argv;
+	int pos, end;
+	int err;
+	struct {
+		const char *path;
+		int follow;    //stat() if non-zero, lstat() otherwise
+		int ok;
+		struct stat st;
+	} stats[TEST_STAT_CACHE];
+	int stat_count;
+};
+
+static const struct stat *test_stat(struct test_eval *te, const char *path, int follow)
+{
+	int i;
+
+	for (i = 0; i < te->stat_count; ++i) {
+		if (te->stats[i].follow == follow && strcmp(te->stats[i].path, path) == 0)
+			return te->stats[i].ok ? &te->stats[i].st : NULL;
+	}
+	i = te->stat_count < TEST_STAT_CACHE ? te->stat_count++ : TEST_STAT_CACHE - 1;
+	te->stats[i].path = path;
+	te->stats[i].follow = follow;
+	te->stats[i].ok = (follow ? stat(path, &te->stats[i].st) : lstat(path, &te->stats[i].st)) == 0;
+	return te->stats[i].ok ? &te->stats[i].st : NULL;
+}
+
+static int is_unary_op(const char *op)
+{
+	return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghknprstuwxzLOGS", op[1]) != NULL;
+}
+
+static int is_binary_op(const char *op)
+{
+	static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+
+	for (size_t i = 0; ops[i] != NULL; ++i) {
+		if (strcmp(op, ops[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static long long test_int(struct test_eval *te, const char *arg)
+{
+	char *end;
+	long long value;
+
+	while (isspace((unsigned char)*arg))
+		++arg;
+	errno = 0;
+	value = strtoll(arg, &end, 10);
+	while (isspace((unsigned char)*end))
+		++end;
+	if (end == arg || *end != '\0' || errno != 0) {
+		fprintf(stderr, "test: %s: integer expression expected\n", arg);
+		te->err = 1;
+	}
+	return value;
+}
+
+static int test_unary(struct test_eval *te, char op, const char *arg)
+{
+	const struct stat *st;
+
+	switch (op) {
+		case 'n': return arg[0] != '\0';
+		case 'z': return arg[0] == '\0';
+		case 't': return isatty((int)test_int(te, arg));
+		case 'r': return access(arg, R_OK) == 0;
+		case 'w': return access(arg, W_OK) == 0;
+		case 'x': return access(arg, X_OK) == 0;
+		case 'h':
+		case 'L': return (st = test_stat(te, arg, 0)) != NULL && S_ISLNK(st->st_mode);
+	}
+	if ((st = test_stat(te, arg, 1)) == NULL)
+		return 0;
+	switch (op) {
+		case 'e': return 1;
+		case 'f': return S_ISREG(st->st_mode);
+		case 'd': return S_ISDIR(st->st_mode);
+		case 'b': return S_ISBLK(st->st_mode);
+		case 'c': return S_ISCHR(st->st_mode);
+		case 'p': return S_ISFIFO(st->st_mode);
+		case 'S': return S_ISSOCK(st->st_mode);
+		case 's': return st->st_size > 0;
+		case 'g': return (st->st_mode & S_ISGID) != 0;
+		case 'u': return (st->st_mode & S_ISUID) != 0;
+		case 'k': return (st->st_mode & S_ISVTX) != 0;
+		case 'O': return st->st_uid == geteuid();
+		case 'G': return st->st_gid == getegid();
+	}
+	return 0;
+}
+
+static int test_binary(struct test_eval *te, const char *left, const char *op, const char *right)
+{
+	const struct stat *lst, *rst;
+	struct timespec lt, rt;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(left, right) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(left, right) != 0;
+	if (strcmp(op, "<") == 0)
+		return strcmp(left, right) < 0;
+	if (strcmp(op, ">") == 0)
+		return strcmp(left, right) > 0;
+	if (op[1] == 'e' && op[2] == 'f') {
+		lst = test_stat(te, left, 1);
+		rst = test_stat(te, right, 1);
+		return lst != NULL && rst != NULL && lst->st_dev == rst->st_dev && lst->st_ino == rst->st_ino;
+	}
+	if ((op[1] == 'n' || op[1] == 'o') && op[2] == 't') { //-nt, -ot, a missing file is older than any existing one
+		lst = test_stat(te, left, 1);
+		rst = test_stat(te, right, 1);
+		if (lst == NULL || rst == NULL)
+			return op[1] == 'n' ? lst != NULL && rst == NULL : lst == NULL && rst != NULL;
+		lt = lst->st_mtim;
+		rt = rst->st_mtim;
+		if (op[1] == 'o') {
+			lt = rst->st_mtim;
+			rt = lst->st_mtim;
+		}
+		return lt.tv_sec > rt.tv_sec || (lt.tv_sec == rt.tv_sec && lt.tv_nsec > rt.tv_nsec);
+	}
+
+	long long l = test_int(te, left), r = test_int(te, right);
+	switch (op[1] * 256 + op[2]) {
+		case 'e' * 256 + 'q': return l == r;
+		case 'n' * 256 + 'e': return l != r;
+		case 'l' * 256 + 't': return l < r;
+		case 'l' * 256 + 'e': return l <= r;
+		case 'g' * 256 + 't': return l > r;
+		default:              return l >= r;
+	}
+}
+
+static int test_or(struct test_eval *te);
+
+/* primary: ( expr ) | unary-op arg | arg binary-op arg | arg */
+static int test_primary(struct test_eval *te)
+{
+	char **argv = te->argv;
+	int pos = te->pos, left = te->end - pos, result;
+
+	if (left <= 0) {
+		fprintf(stderr, "test: argument expected\n");
+		te->err = 1;
+		return 0;
+	}
+	if (left >= 3 && is_binary_op(argv[pos + 1])) {
+		te->pos += 3;
+		return test_binary(te, argv[pos], argv[pos + 1], argv[pos + 2]);
+	}
+	if (strcmp(argv[pos], "(") == 0 && left >= 2) {
+		te->pos++;
+		result = test_or(te);
+		if (te->pos >= te->end || strcmp(argv[te->pos], ")") != 0) {
+			fprintf(stderr, "test: `)' expected\n");
+			te->err = 1;
+			return 0;
+		}
+		te->pos++;
+		return result;
+	}
+	if (left >= 2 && is_unary_op(argv[pos])) {
+		te->pos += 2;
+		return test_unary(te, argv[pos][1], argv[pos + 1]);
+	}
+	te->pos++;
+	return argv[pos][0] != '\0';
+}
+
+static int test_not(struct test_eval *te)
+{
+	if (te->pos < te->end - 1 && strcmp(te->argv[te->pos], "!") == 0) {
+		te->pos++;
+		return !test_not(te);
+	}
+	return test_primary(te);
+}
+
+static int test_and(struct test_eval *te)
+{
+	int result = test_not(te);
+
+	while (!te->err && te->pos < te->end && strcmp(te->argv[te->pos], "-a") == 0) {
+		te->pos++;
+		result = test_not(te) && result;
+	}
+	return result;
+}
+
+static int test_or(struct test_eval *te)
+{
+	int result = test_and(te);
+
+	while (!te->err && te->pos < te->end && strcmp(te->argv[te->pos], "-o") == 0) {
+		te->pos++;
+		result = test_and(te) || result;
+	}
+	return result;
+}
+
+/* test expr, [ expr ]
+ * return 0 if expr is true, 1 if it is false, 2 on error
+ */
+static int build_in_test(char **argv)
+{
+	struct test_eval te;
+	int result;
+
+	te.argv = argv;
+	te.pos = 1;
+	for (te.end = 1; argv[te.end] != NULL; ++te.end);
+	te.err = 0;
+	te.stat_count = 0;
+	if (strcmp(argv[0], "[") == 0) {
+		if (te.end < 2 || strcmp(argv[te.end - 1], "]") != 0) {
+			fprintf(stderr, "[: missing `]'\n");
+			return 2;
+		}
+		te.end--;
+	}
+	if (te.pos == te.end)
+		return 1;
+	result = test_or(&te);
+	if (!te.err && te.pos != te.end) {
+		fprintf(stderr, "test: %s: unexpected argument\n", argv[te.pos]);
+		te.err = 1;
+	}
+	return te.err ? 2 : !result;
+}
+
+/* parallel [-j N] [-k] [-u] [command...]
+ * run each command argument, or each line of stdin if there is none, with at most N running at a time
+ *     -j N: number of commands running at a time, number of CPUs by default
+ *     -k:   output in the order commands were given, instead of the order they exit
+ *     -u:   ungrouped, commands write to stdout directly and their output may interleave
+ */
+static int build_in_parallel(char **argv)
+{
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int flags = 0;
+	size_t i;
+	char *end;
+
+	for (i = 1; argv[i] != NULL && argv[i][0] == '-'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			flags |= PARALLEL_KEEP_ORDER;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			flags |= PARALLEL_UNGROUPED;
+		} else if (strncmp(argv[i], "-j", 2) == 0) {
+			const char *count = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+			if (count == NULL || (jobs = strtol(count, &end, 10)) <= 0 || *end != '\0') {
+				fprintf(stderr, "parallel: -j needs a positive number\n");
+				return 2;
+			}
+		} else {
+			fprintf(stderr, "parallel: usage: parallel [-j N] [-k] [-u] [command...]\n");
+			return 2;
+		}
+	}
+	if (jobs <= 0)
+		jobs = 1;
+	return parallel_run(argv[i] != NULL ? argv + i : NULL, jobs, flags);
+}
+
+/* jobserver:        show token usage
+ * jobserver on [N]: make shell the jobserver of makes it starts, N jobs (number of CPUs by default)
+ *                   run at a time across all of them, each make holds one implicit token so
+ *                   N - 1 tokens are shared
+ * jobserver off:    stop being jobserver
+ */
+static int build_in_jobserver(char **argv)
+{
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	char *end;
+
+	if (argv[1] == NULL) {
+		jobserver_output();
+		return 0;
+	}
+	if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+		jobserver_stop();
+		return 0;
+	}
+	if (strcmp(argv[1], "on") != 0 || (argv[2] != NULL && argv[3] != NULL)) {
+		fprintf(stderr, "jobserver: usage: jobserver [on [N] | off]\n");
+		return 2;
+	}
+	if (argv[2] != NULL && ((jobs = strtol(argv[2], &end, 10)) <= 0 || *end != '\0')) {
+		fprintf(stderr, "jobserver: %s: positive number expected\n", argv[2]);
+		return 2;
+	}
+	if (jobs <= 0)
+		jobs = 1;
+	return jobserver_start(jobs - 1);
+}
+
+/* export NAME[=value]...: mark variables exported, without arguments list exported ones */
+static int build_in_export(char **argv)
+{
+	int result = 0;
+
+	if (argv[1] == NULL) {
+		vars_output_exported();
+		return 0;
+	}
+	for (char **arg = argv + 1; *arg != NULL; ++arg) {
+		if (assign_name_len(*arg) > 0)
+			vars_assign(*arg, VAR_EXPORT);
+		else if (is_var_name(*arg, strlen(*arg)))
+			vars_export(*arg);
+		else {
+			fprintf(stderr, "export: `%s': not a valid identifier\n", *arg);
+			result = 1;
+		}
+	}
+	return result;
+}
+
+/* unset NAME...:    remove variables
+ * unset -f NAME...: remove functions
+ */
+static int build_in_unset(char **argv)
+{
+	int result = 0, funcs = argv[1] != NULL && strcmp(argv[1], "-f") == 0;
+
+	for (char **arg = argv + 1 + funcs; *arg != NULL; ++arg) {
+		if (!is_var_name(*arg, strlen(*arg))) {
+			fprintf(stderr, "unset: `%s': not a valid identifier\n", *arg);
+			result = 1;
+			continue;
+		}
+		if (funcs)
+			undefine_function(*arg);
+		else
+			vars_unset(*arg);
+	}
+	return result;
+}
+
+/* positive count argument of break, continue, return and shift, 0 if it isn't one */
+static size_t count_arg(const char *arg)
+{
+	char *end;
+	unsigned long count;
+
+	errno = 0;
+	count = strtoul(arg, &end, 10);
+	return *arg >= '0' && *arg <= '9' && *end == '\0' && errno == 0 ? count : 0;
+}
+
+/* break [N]:    leave N (default 1) enclosing loops
+ * continue [N]: go on with next round of Nth enclosing loop
+ */
+static int build_in_break(char **argv)
+{
+	size_t levels = 1;
+
+	if (argv[1] != NULL && (argv[2] != NULL || (levels = count_arg(argv[1])) == 0)) {
+		fprintf(stderr, "%s: usage: %s [n], n > 0\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (interp_loop_depth() == 0) {
+		fprintf(stderr, "%s: only meaningful in a loop\n", argv[0]);
+		return 0;
+	}
+	if (levels > interp_loop_depth())
+		levels = interp_loop_depth();
+	interp_set_flow(argv[0][0] == 'b' ? FLOW_BREAK : FLOW_CONTINUE, levels);
+	return 0;
+}
+
+/* return [N]: leave function with status N (default: last status) */
+static int build_in_return(char **argv)
+{
+	int status = get_last_status();
+	char *end;
+
+	if (!interp_in_function()) {
+		fprintf(stderr, "return: can only return from a function\n");
+		return 1;
+	}
+	if (argv[1] != NULL) {
+		status = strtol(argv[1], &end, 10);
+		if (*argv[1] == '\0' || *end != '\0' || argv[2] != NULL) {
+			fprintf(stderr, "return: usage: return [n]\n");
+			return 2;
+		}
+	}
+	interp_set_flow(FLOW_RETURN, 0);
+	return status & 0xff;
+}
+
+/* shift [N]: drop first N (default 1) positional parameters */
+static int build_in_shift(char **argv)
+{
+	size_t count = 1;
+
+	if (argv[1] != NULL && ((count = count_arg(argv[1])) == 0 && strcmp(argv[1], "0") != 0)) {
+		fprintf(stderr, "shift: usage: shift [n]\n");
+		return 1;
+	}
+	return vars_shift(count) == 0 ? 0 : 1;
+}
@@ -4,5 +4,8 @@
 #include <stddef.h>
 
 int is_build_in(char *cmd, size_t *idx);
-void do_build_in(int index, char *args[]);
+int do_build_in(int index, char *args[], int in_fd);
+int build_in_capturable(size_t idx);
+unsigned long build_in_generation();
+const char *build_in_name(size_t idx);
 #endif
\ No newline at end of file
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include "complete.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "build_in.h"
+#include "path_cache.h"
+#include "sh_env.h"
+
+#define DIR_CACHE_MAX 32
+
+/* listings of directories read for completion are kept sorted by name, most recently used first,
+ * a listing is read again only when mtime of its directory changes,
+ * so Tab in a huge directory costs a stat() and a binary search
+ */
+struct dir_item {
+	size_t off;          //name offset in pool
+	unsigned char type;  //d_type from readdir()
+};
+
+struct dir_listing {
+	char *dir;
+	struct timespec mtime;
+	struct str_buf pool;
+	struct dir_item *items;
+	size_t count, cap;
+	struct dir_listing *next;
+};
+
+struct cand {
+	size_t off;  //name offset in cands.names, names are copied since a listing can be dropped meanwhile
+	int is_dir;
+};
+
+static struct dir_listing *listings = NULL;
+static size_t listing_count = 0;
+
+static struct {
+	struct cand *list;
+	size_t count, cap;
+	struct str_buf names, path;
+} cands = {NULL, 0, 0, {NULL, 0, 0}, {NULL, 0, 0}};
+
+static int cmp_item(const void *a, const void *b, void *pool)
+{
+	return strcmp((char *)pool + ((const struct dir_item *)a)->off, (char *)pool + ((const struct dir_item *)b)->off);
+}
+
+static void read_listing(struct dir_listing *listing)
+{
+	DIR *dp;
+	struct dirent *entry;
+
+	listing->pool.len = 0;
+	listing->count = 0;
+	if ((dp = opendir(listing->dir)) == NULL)
+		return;
+	while ((entry = readdir(dp)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		if (listing->count == listing->cap) {
+			listing->cap = listing->cap == 0 ? 64 : listing->cap * 2;
+			if ((listing->items = realloc(listing->items, listing->cap * sizeof(struct dir_item))) == NULL) {
+				syslog(LOG_ERR, "Can't allocate directory listing: %m");
+				exit(EXIT_FAILURE);
+			}
+		}
+		listing->items[listing->count].off = listing->pool.len;
+		listing->items[listing->count++].type = entry->d_type;
+		str_buf_append(&listing->pool, entry->d_name, strlen(entry->d_name) + 1);
+	}
+	closedir(dp);
+	qsort_r(listing->items, listing->count, sizeof(struct dir_item), cmp_item, listing->pool.data);
+}
+
+/* cached listing of dir, read again if dir has changed
+ * return NULL if dir can't be accessed
+ */
+static struct dir_listing *get_listing(const char *dir)
+{
+	struct dir_listing **link, *listing;
+	struct stat dir_stat;
+
+	if (stat(dir, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode))
+		return NULL;
+
+	for (link = &listings; *link != NULL && strcmp((*link)->dir, dir) != 0; link = &(*link)->next);
+	if ((listing = *link) != NULL) {
+		*link = listing->next;
+		if (listing->mtime.tv_sec != dir_stat.st_mtim.tv_sec || listing->mtime.tv_nsec != dir_stat.st_mtim.tv_nsec) {
+			listing->mtime = dir_stat.st_mtim;
+			read_listing(listing);
+		}
+	} else {
+		if (listing_count == DIR_CACHE_MAX) { //drop least recently used
+			for (link = &listings; (*link)->next != NULL; link = &(*link)->next);
+			listing = *link;
+			*link = NULL;
+			free(listing->dir);
+		} else {
+			if ((listing = calloc(1, sizeof(struct dir_listing))) == NULL) {
+				syslog(LOG_ERR, "Can't allocate directory listing: %m");
+				exit(EXIT_FAILURE);
+			}
+			listing_count++;
+		}
+		if ((listing->dir = strdup(dir)) == NULL) {
+			syslog(LOG_ERR, "Can't allocate directory listing: %m");
+			exit(EXIT_FAILURE);
+		}
+		listing->mtime = dir_stat.st_mtim;
+		read_listing(listing);
+	}
+	listing->next = listings;
+	listings = listing;
+	return listing;
+}
+
+static const char *item_name(const struct dir_listing *listing, size_t idx)
+{
+	return listing->pool.data + listing->items[idx].off;
+}
+
+/* index of first name in listing not less than prefix */
+static size_t lower_bound(const struct dir_listing *listing, const char *prefix, size_t length)
+{
+	size_t lo = 0, hi = listing->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(item_name(listing, mid), prefix, length) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void add_cand(const char *name, int is_dir)
+{
+	if (cands.count == cands.cap) {
+		cands.cap = cands.cap == 0 ? 64 : cands.cap * 2;
+		if ((cands.list = realloc(cands.list, cands.cap * sizeof(struct cand))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate completion candidates: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	cands.list[cands.count].off = cands.names.len;
+	cands.list[cands.count++].is_dir = is_dir;
+	str_buf_append(&cands.names, name, strlen(name) + 1);
+}
+
+/* dir/name into cands.path */
+static const char *join_path(const char *dir, const char *name)
+{
+	cands.path.len = 0;
+	str_buf_printf(&cands.path, "%s/%s", dir, name);
+	return cands.path.data;
+}
+
+/* names in dir starting with prefix, dotfiles only if prefix starts with '.',
+ * exec selects executable files only, otherwise dirs are flagged
+ */
+static void add_dir_cands(const char *dir, const char *prefix, size_t length, int exec)
+{
+	struct dir_listing *listing;
+	struct stat file_stat;
+	const char *name;
+	int is_dir;
+
+	if ((listing = get_listing(dir)) == NULL)
+		return;
+	for (size_t i = lower_bound(listing, prefix, length); i < listing->count; ++i) {
+		name = item_name(listing, i);
+		if (strncmp(name, prefix, length) != 0)
+			break;
+		if (name[0] == '.' && (length == 0 || prefix[0] != '.'))
+			continue;
+		is_dir = listing->items[i].type == DT_DIR;
+		if (listing->items[i].type == DT_LNK || listing->items[i].type == DT_UNKNOWN)
+			is_dir = stat(join_path(dir, name), &file_stat) == 0 && S_ISDIR(file_stat.st_mode);
+		if (exec) {
+			if (is_dir || access(join_path(dir, name), X_OK) != 0)
+				continue;
+			is_dir = 0;
+		}
+		add_cand(name, is_dir);
+	}
+}
+
+static const char *cand_name(size_t idx)
+{
+	return cands.names.data + cands.list[idx].off;
+}
+
+static int cmp_cand(const void *a, const void *b)
+{
+	return strcmp(cands.names.data + ((const struct cand *)a)->off, cands.names.data + ((const struct cand *)b)->off);
+}
+
+static void collect_commands(const char *prefix, size_t length)
+{
+	const char *name, *dir;
+	size_t kept = 0;
+
+	for (size_t i = 0; (name = build_in_name(i)) != NULL; ++i) {
+		if (strncmp(name, prefix, length) == 0)
+			add_cand(name, 0);
+	}
+	path_cache_revalidate();
+	for (size_t i = 0; (dir = path_cache_dir(i)) != NULL; ++i)
+		add_dir_cands(dir, prefix, length, 1);
+
+	qsort(cands.list, cands.count, sizeof(struct cand), cmp_cand);
+	for (size_t i = 0; i < cands.count; ++i) { //same command in several dirs
+		if (kept == 0 || strcmp(cand_name(kept - 1), cand_name(i)) != 0)
+			cands.list[kept++] = cands.list[i];
+	}
+	cands.count = kept;
+}
+
+static void collect_files(const char *word, size_t length, const char **base)
+{
+	static struct str_buf dir = {NULL, 0, 0};
+	const char *slash = memrchr(word, '/', length);
+
+	dir.len = 0;
+	if (slash == NULL) {
+		str_buf_append(&dir, ".", 1);
+		*base = word;
+	} else {
+		if (word[0] == '~' && word + 1 == slash) //~/ is home dir
+			str_buf_printf(&dir, "%s", get_home_dir());
+		else
+			str_buf_append(&dir, word, slash - word);
+		if (slash == word)
+			str_buf_append(&dir, "/", 1);
+		*base = slash + 1;
+	}
+	add_dir_cands(dir.data, *base, word + length - *base, 0);
+}
+
+static void format_listing(struct str_buf *listing, size_t width)
+{
+	size_t max_len = 0, len, col_width, cols, rows, idx;
+
+	for (size_t i = 0; i < cands.count; ++i) {
+		len = strlen(cand_name(i)) + cands.list[i].is_dir;
+		if (len > max_len)
+			max_len = len;
+	}
+	col_width = max_len + 2;
+	cols = width / col_width > 0 ? width / col_width : 1;
+	rows = (cands.count + cols - 1) / cols;
+
+	listing->len = 0;
+	for (size_t row = 0; row < rows; ++row) {
+		for (size_t col = 0; col < cols && (idx = col * rows + row) < cands.count; ++col) {
+			len = strlen(cand_name(idx)) + cands.list[idx].is_dir;
+			str_buf_printf(listing, "%s%s", cand_name(idx), cands.list[idx].is_dir ? "/" : "");
+			if (col + 1 < cols && idx + rows < cands.count)
+				str_buf_printf(listing, "%*s", (int)(col_width - len), "");
+		}
+		str_buf_append(listing, "\n", 1);
+	}
+}
+
+/* complete word, a command name if command is non-zero and word has no '/', a file path otherwise,
+ * insert is set to text that should follow word: rest of the only match and a space ('/' for dirs),
+ * or the part all matches share, listing (if not NULL) gets matches in columns that fit width
+ * return number of matches
+ */
+size_t complete(const char *word, size_t length, int command, struct str_buf *insert,
+		struct str_buf *listing, size_t width)
+{
+	const char *base = word, *first;
+	size_t base_len, common;
+
+	assert(insert != NULL);
+
+	cands.count = 0;
+	cands.names.len = 0;
+	insert->len = 0;
+	str_buf_reserve(insert, 0);
+	if (command && memchr(word, '/', length) == NULL)
+		collect_commands(word, length);
+	else
+		collect_files(word, length, &base);
+	if (cands.count == 0)
+		return 0;
+
+	base_len = word + length - base;
+	first = cand_name(0);
+	if (cands.count == 1) {
+		str_buf_append(insert, first + base_len, strlen(first + base_len));
+		str_buf_append(insert, cands.list[0].is_dir ? "/" : " ", 1);
+		return 1;
+	}
+	common = strlen(first);
+	for (size_t i = 1; i < cands.count; ++i) {
+		size_t same = 0;
+		while (same < common && first[same] == cand_name(i)[same])
+			++same;
+		common = same;
+	}
+	if (common > base_len)
+		str_buf_append(insert, first + base_len, common - base_len);
+	if (listing != NULL)
+		format_listing(listing, width);
+	return cands.count;
+}
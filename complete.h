@@ -0,0 +1,10 @@
+#ifndef NSPT_COMPLETE
+#define NSPT_COMPLETE
+
+#include <stddef.h>
+#include "tools.h"
+
+size_t complete(const char *word, size_t length, int command, struct str_buf *insert,
+		struct str_buf *listing, size_t width);
+
+#endif
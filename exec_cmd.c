@@ -8,233 +8,862 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include "build_in.h"
 #include "signal_handler.h"
+#include "path_cache.h"
 #include "sh_env.h"
 #include "tools.h"
+#include "arena.h"
+#include "parse.h"
+#include "alloc_stats.h"
 #include "tty_ctl.h"
+#include "expand.h"
+#include "vars.h"
+#include "interp.h"
 
-static pid_t execute_single_cmd(char **args, int bg)
+#define SUB_READ_LEN 65536
+
+/* command list parsed from input, reset at end of run_input() */
+static struct arena cmd_arena = {NULL, 0};
+
+/* expansions and pipes of a pipeline until it has been launched or waited for,
+ * released at end of run_pipeline(), which nests when a pipeline runs a function or compound command
+ */
+static struct arena exec_arena = {NULL, 0};
+
+/* PATH dirs have been checked for changes since the pipeline being run started */
+static int path_checked;
+
+/* forked shell running part of a job, commands it launches stay in its process group */
+static int in_subshell;
+
+/* signals are blocked from the first launch of a pipeline until it has been waited for,
+ * a pipeline that runs in shell only (builtins, assignments) makes no sigprocmask() calls
+ */
+static int signals_blocked;
+static sigset_t launch_oldmask;
+
+static void block_signals()
 {
-	assert(args != NULL && args[0] != NULL);
+	sigset_t allmask;
 
-	char *cmd = args[0];
-	pid_t job_id = 0;
-	size_t buildin_idx;
+	if (!signals_blocked) {
+		sigfillset(&allmask);
+		sigprocmask(SIG_SETMASK, &allmask, &launch_oldmask);
+		signals_blocked = 1;
+	}
+}
 
-	if (is_build_in(cmd, &buildin_idx)) {
-		do_build_in(buildin_idx, args);
-	} else {
-		if ((job_id = fork()) < 0) {
-			syslog(LOG_ERR, "Can't fork: %m");
-			return 0;
-		} else if (job_id == 0) {
-			if (setpgid(0, 0) != 0) {
-				syslog(LOG_ERR, "Can't create pgrp: %m");
-				_exit(EXIT_FAILURE);
-			}
-			if (!bg && tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
-				syslog(LOG_ERR, "Can't hand over terminal to child: %m");
-				_exit(EXIT_FAILURE);
-			}
-			reset_sig_process();
-			if (!bg)
-				tty_reset();
-			execvp(cmd, args);
-			perror(cmd);
-			_exit(127);
+/* undo block_signals() done since was_blocked was read */
+static void unblock_signals(int was_blocked)
+{
+	if (signals_blocked && !was_blocked) {
+		sigprocmask(SIG_SETMASK, &launch_oldmask, NULL);
+		signals_blocked = 0;
+	}
+}
+
+/* number of command substitutions run so far */
+static unsigned long subst_count;
+
+/* launch external command with posix_spawn (vfork-style, no page table copy)
+ * child joins process group pgid (new group led by itself if pgid is 0),
+ * gets signal dispositions and mask the shell was started with,
+ * and in_fd/out_fd as its stdin/stdout
+ * NAME=value prefixes of cmd are overlaid on the exported variables for the child only
+ * foreground child of interactive shell takes over terminal
+ * return child pid, or 0 if it can't be launched
+ */
+static pid_t spawn_external(const struct command *cmd, const char *path, pid_t pgid, int in_fd, int out_fd, int bg)
+{
+	char **args = cmd->argv, **env;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	sigset_t sig_default, sig_mask;
+	pid_t pid = 0;
+	int err, fg_tty = !bg && is_interactive();
+
+	fflush(stdout); //child must not inherit pending output
+	block_signals();
+	get_reset_sig_attr(&sig_default, &sig_mask);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, (in_subshell ? 0 : POSIX_SPAWN_SETPGROUP) | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setpgroup(&attr, pgid);
+	posix_spawnattr_setsigdefault(&attr, &sig_default);
+	posix_spawnattr_setsigmask(&attr, &sig_mask);
+
+	posix_spawn_file_actions_init(&actions);
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 35)
+	if (fg_tty && pgid == 0) { //must precede dup2, stdin may become a pipe
+		posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+		fg_tty = 0; //handed over by child before exec
+	}
+#endif
+#endif
+	if (in_fd != STDIN_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+	if (!bg && is_interactive())
+		tty_reset();
+	env = cmd->assign_count > 0 ? vars_environ_overlay(cmd->assigns, cmd->assign_count) : vars_environ();
+	err = posix_spawn(&pid, path, &actions, &attr, args, env);
+	if (cmd->assign_count > 0)
+		vars_environ_restore();
+	if (err != 0) {
+		fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+		pid = 0;
+	} else if (fg_tty && pgid == 0 && tcsetpgrp(STDIN_FILENO, pid) != 0) {
+		syslog(LOG_ERR, "Can't hand over terminal to child: %m");
+	}
+	if (pid == 0 && !bg && is_interactive())
+		tty_cbreak();
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	return pid;
+}
+
+/* open redirections of cmd, a later one overrides an earlier one of the same direction
+ * return:
+ *     0 on success, *in_fd and *out_fd are the opened files or -1
+ *     -1 if a file can't be opened, which has been reported
+ */
+static int open_redirects(const struct command *cmd, int *in_fd, int *out_fd)
+{
+	struct redirect *redir;
+	int fd, *target_fd;
+
+	*in_fd = *out_fd = -1;
+	for (redir = cmd->redirs; redir != NULL; redir = redir->next) {
+		if (redir->type == REDIR_IN) {
+			fd = open(redir->target, O_RDONLY | O_CLOEXEC);
+			target_fd = in_fd;
+		} else {
+			fd = open(redir->target, O_CREAT | O_WRONLY | O_CLOEXEC | (redir->type == REDIR_APPEND ? O_APPEND : O_TRUNC),
+					S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+			target_fd = out_fd;
+		}
+		if (fd == -1) {
+			fprintf(stderr, "Can't redirect to %s: %s\n", redir->target, strerror(errno));
+			if (*in_fd != -1)
+				close(*in_fd);
+			if (*out_fd != -1)
+				close(*out_fd);
+			*in_fd = *out_fd = -1;
+			return -1;
 		}
+		if (*target_fd != -1)
+			close(*target_fd);
+		*target_fd = fd;
 	}
+	return 0;
+}
 
-	return job_id;
+static void close_redirects(int in_fd, int out_fd)
+{
+	if (in_fd != -1)
+		close(in_fd);
+	if (out_fd != -1)
+		close(out_fd);
 }
 
-pid_t execute_cmd(char **cmd_list, const size_t last_idx, size_t cur_idx, int out_fd, int bg)
+/* set NAME=value prefixes of a builtin running in shell, a new variable is exported for commands
+ * the builtin launches, return old values (NULL if unset) for restore_assigns()
+ */
+static char **apply_assigns(struct arena *arena, const struct command *cmd)
 {
-	assert(cmd_list != NULL && last_idx >= 0 && cur_idx >= 0);
-	char **args = NULL, *cmd = NULL, *redict_file = NULL;
-	int redict_mode, pipe_fd[2];
-	int save_stdout = dup(STDOUT_FILENO);
-	size_t buildin_idx;
-	pid_t jobid = 0, child_pid = 0;
+	char **old = arena_alloc(arena, cmd->assign_count * sizeof(char *));
+	const char *value;
+	size_t name_len;
 
-	/*parse command*/
-	for (size_t i = 0; cmd_list[cur_idx][i] != '\0'; ++i) {
-		if (cmd_list[cur_idx][i] == '>') {
-			if (cmd_list[cur_idx][i + 1] == '>') 
-				redict_mode = O_CREAT | O_WRONLY | O_APPEND;
-			else
-				redict_mode = O_CREAT | O_WRONLY | O_TRUNC;
-			break;
+	for (size_t i = 0; i < cmd->assign_count; ++i) {
+		name_len = strchr(cmd->assigns[i], '=') - cmd->assigns[i];
+		value = vars_getn(cmd->assigns[i], name_len);
+		old[i] = value != NULL ? arena_strndup(arena, value, strlen(value)) : NULL;
+		vars_assign(cmd->assigns[i], value != NULL ? VAR_KEEP : VAR_EXPORT);
+	}
+	return old;
+}
+
+static void restore_assigns(struct arena *arena, const struct command *cmd, char **old)
+{
+	char *name;
+
+	for (size_t i = cmd->assign_count; i-- > 0;) {
+		name = arena_strndup(arena, cmd->assigns[i], strchr(cmd->assigns[i], '=') - cmd->assigns[i]);
+		if (old[i] != NULL)
+			vars_set(name, old[i], VAR_KEEP);
+		else
+			vars_unset(name);
+	}
+}
+
+/* lookups kept in commands hold while this is unchanged */
+static unsigned long lookup_generation()
+{
+	return path_cache_generation() + build_in_generation() + func_generation();
+}
+
+static void check_path()
+{
+	if (!path_checked) {
+		path_cache_revalidate();
+		path_checked = 1;
+	}
+}
+
+/* find what argv[0] of cmd is: function, builtin or command in PATH, in that order
+ * found is kept in the command's lookup, so running the command again (in a loop or function)
+ * skips the search, PATH dirs are still checked for changes once per pipeline
+ * return kind of command, LOOKUP_NONE if it can't be found
+ */
+static int resolve(const struct command *cmd, struct lookup *found)
+{
+	struct lookup *kept = cmd->lookup;
+	int stable = 1;
+
+	if (kept != NULL && kept->kind != LOOKUP_NONE) {
+		if (kept->kind == LOOKUP_PATH)
+			check_path();
+		if (kept->gen == lookup_generation()) {
+			*found = *kept;
+			return found->kind;
 		}
 	}
-	if ((args = split_cmd(cmd_list[cur_idx], ">", NULL)) == NULL)
+	if ((found->func = find_function(cmd->argv[0])) != NULL) {
+		found->kind = LOOKUP_FUNC;
+	} else if (is_build_in(cmd->argv[0], &found->build_in)) {
+		found->kind = LOOKUP_BUILD_IN;
+	} else {
+		check_path();
+		if ((found->path = path_cache_resolve(cmd->argv[0], &stable)) == NULL)
+			return found->kind = LOOKUP_NONE;
+		found->kind = LOOKUP_PATH;
+	}
+	if (kept != NULL && stable) {
+		found->gen = lookup_generation();
+		*kept = *found;
+	}
+	return found->kind;
+}
+
+/* duplicate of fd for restore_fd(), -1 if to_fd is -1 and fd stays as it is */
+static int redirect_fd(int fd, int to_fd)
+{
+	int saved;
+
+	if (to_fd == -1)
+		return -1;
+	saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	dup2(to_fd, fd);
+	return saved;
+}
+
+static void restore_fd(int fd, int saved)
+{
+	if (saved != -1) {
+		dup2(saved, fd);
+		close(saved);
+	}
+}
+
+/* run compound command or function call of cmd in shell, in_fd and out_fd (if not -1)
+ * are its stdin and stdout while it runs
+ */
+static void run_in_shell(struct arena *arena, const struct command *cmd, const struct lookup *found, int in_fd, int out_fd)
+{
+	char **old_values = NULL;
+	int save_stdin, save_stdout;
+
+	fflush(stdout);
+	save_stdin = redirect_fd(STDIN_FILENO, in_fd);
+	save_stdout = redirect_fd(STDOUT_FILENO, out_fd);
+	if (cmd->body != NULL) {
+		run_list(cmd->body);
+	} else {
+		if (cmd->assign_count > 0)
+			old_values = apply_assigns(arena, cmd);
+		call_function(found->func, cmd->argv, cmd->argc);
+		if (old_values != NULL)
+			restore_assigns(arena, cmd, old_values);
+	}
+	fflush(stdout);
+	restore_fd(STDIN_FILENO, save_stdin);
+	restore_fd(STDOUT_FILENO, save_stdout);
+}
+
+static pid_t fork_stage(const struct command *cmd, const struct lookup *found, pid_t pgid, int in_fd, int out_fd,
+		int (*pipes)[2], size_t pipe_count, int bg);
+
+static pid_t execute_single_cmd(struct arena *arena, const struct command *cmd, int bg)
+{
+	assert(cmd != NULL);
+
+	char **args, **old_values = NULL;
+	struct lookup found = {LOOKUP_NONE};
+	pid_t job_id = 0;
+	unsigned long substs = subst_count;
+	int save_stdout, in_fd, out_fd;
+
+	if ((cmd = expand_cmd(arena, cmd)) == NULL) {
+		set_last_status(1);
 		return 0;
-	cmd = args[0];
-	redict_file = args[1];
-	if (redict_file != NULL && args[2] == NULL) {
-		int redict_fd;
-		strip_space(redict_file, NULL);
-		if ((redict_fd = open(redict_file, redict_mode, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH)) == -1) {
-			fprintf(stderr, "Can't redirect to %s: %s\n", redict_file, strerror(errno));
-			return 0;
-		}
-		out_fd = redict_fd;
-	} else if (redict_file != NULL && args[2] != NULL) {
-		fprintf(stderr, "Redirection syntax error\n");
+	}
+	args = cmd->argv;
+	if (open_redirects(cmd, &in_fd, &out_fd) != 0) {
+		set_last_status(1);
 		return 0;
 	}
+	if (cmd->body == NULL && args[0] == NULL) { //only assignments and redirections, files have been created
+		for (size_t i = 0; i < cmd->assign_count; ++i)
+			vars_assign(cmd->assigns[i], VAR_KEEP);
+		if (subst_count == substs) //status of the last substitution otherwise
+			set_last_status(0);
+	} else if (cmd->body == NULL && resolve(cmd, &found) == LOOKUP_NONE) {
+		fprintf(stderr, "%s: command not found\n", args[0]);
+		set_last_status(127);
+	} else if (cmd->body != NULL || found.kind == LOOKUP_FUNC) {
+		if (bg) //runs in a forked shell, like a pipeline stage
+			job_id = fork_stage(cmd, &found, 0, in_fd == -1 ? STDIN_FILENO : in_fd,
+					out_fd == -1 ? STDOUT_FILENO : out_fd, NULL, 0, bg);
+		else
+			run_in_shell(arena, cmd, &found, in_fd, out_fd);
+	} else if (found.kind == LOOKUP_BUILD_IN) {
+		if (cmd->assign_count > 0)
+			old_values = apply_assigns(arena, cmd);
+		if (out_fd == -1) {
+			set_last_status(do_build_in(found.build_in, args, in_fd == -1 ? STDIN_FILENO : in_fd));
+		} else {
+			fflush(stdout);
+			save_stdout = dup(STDOUT_FILENO);
+			dup2(out_fd, STDOUT_FILENO);
+			set_last_status(do_build_in(found.build_in, args, in_fd == -1 ? STDIN_FILENO : in_fd));
+			fflush(stdout);
+			dup2(save_stdout, STDOUT_FILENO);
+			close(save_stdout);
+		}
+		if (old_values != NULL)
+			restore_assigns(arena, cmd, old_values);
+	} else {
+		job_id = spawn_external(cmd, found.path, 0, in_fd == -1 ? STDIN_FILENO : in_fd,
+				out_fd == -1 ? STDOUT_FILENO : out_fd, bg);
+	}
 
-	if ((args = split_cmd(cmd, " \t\n", NULL)) == NULL)
+	close_redirects(in_fd, out_fd);
+	return job_id;
+}
+
+/* run builtin, function or compound command of cmd as one stage of a job in a forked shell,
+ * a forked shell running a function or compound command launches its own jobs
+ * return child pid, or 0 if fork failed
+ */
+static pid_t fork_stage(const struct command *cmd, const struct lookup *found, pid_t pgid, int in_fd, int out_fd,
+		int (*pipes)[2], size_t pipe_count, int bg)
+{
+	pid_t pid;
+	int result;
+
+	fflush(stdout);
+	block_signals();
+	if ((pid = fork()) < 0) {
+		syslog(LOG_ERR, "Can't fork: %m");
 		return 0;
-	cmd = args[0];
-
-	dup2(out_fd, STDOUT_FILENO);
-	/*no pipe, single command*/
-	if (last_idx == 0) {
-		jobid = execute_single_cmd(args, bg);
-		dup2(save_stdout, STDOUT_FILENO);
-		close(save_stdout);
-		return jobid;
-	}
-
-	/*code from here to end of function are use to do pipe job*/
-	if (last_idx == cur_idx) {
-		int pipe_tc[2];
-		pipe2(pipe_tc, O_CLOEXEC);
-		pipe2(pipe_fd, O_CLOEXEC);
-		/*fork and execute end process*/
-		if ((jobid = fork()) < 0) {
-			syslog(LOG_ERR, "Can't fork: %m");
-			_exit(127); 
-		} else if (jobid == 0) {
-			if (setpgid(0, 0) != 0) {
-				syslog(LOG_ERR, "Can't create pgrp: %m");
-				_exit(EXIT_FAILURE);
-			}
-			if (!bg && tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
-				syslog(LOG_ERR, "Can't hand over terminal to child: %m");
-				_exit(EXIT_FAILURE);
-			}
-			if (!bg)
-				tty_reset();
+	} else if (pid == 0) {
+		if (!in_subshell && setpgid(0, pgid) != 0) {
+			syslog(LOG_ERR, "Can't move child to pgrp: %m");
+			_exit(EXIT_FAILURE);
+		}
+		if (pgid == 0 && !bg && is_interactive() && tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
+			syslog(LOG_ERR, "Can't hand over terminal to child: %m");
+			_exit(EXIT_FAILURE);
+		}
+		if (cmd->body == NULL && found->kind == LOOKUP_BUILD_IN)
 			reset_sig_process();
-			dup2(pipe_fd[0], STDIN_FILENO);
-			write(pipe_tc[1], "y", 1);
-			execvp(cmd, args);
-			perror(cmd);
-			_exit(127);
-		}
-		/*fork and execute previous process*/
-		if ((child_pid = fork()) < 0) {
-			syslog(LOG_ERR, "Can't fork: %m");
-			_exit(127);                       
-		} else if (child_pid == 0) {
-			char tc_stat;
-			if ((read(pipe_tc[0], &tc_stat, 1) == 0 || tc_stat != 'y' || setpgid(0, jobid) != 0)) {
-				syslog(LOG_ERR, "Can't move child to pgrd: %m");
-				_exit(EXIT_FAILURE);
-			}
-			execute_cmd(cmd_list, last_idx, cur_idx - 1, pipe_fd[1], bg);
-			_exit(127);
-		}
-		close(pipe_fd[0]);
-		close(pipe_fd[1]);
-		close(pipe_tc[0]);
-		close(pipe_tc[1]);
-		dup2(save_stdout, STDOUT_FILENO);
-		return jobid;
-	} else if (cur_idx != 0) { //this is one of middle processes in pipe job
-		pipe2(pipe_fd, O_CLOEXEC);
-		if ((child_pid = fork()) < 0) {
-			syslog(LOG_ERR, "Can't fork: %m");
-			_exit(127);
-		} else if (child_pid == 0) {
-			execute_cmd(cmd_list, last_idx, cur_idx - 1, pipe_fd[1], bg);
-			_exit(127);
-		}
-		dup2(pipe_fd[0], STDIN_FILENO);
-		if (is_build_in(cmd, &buildin_idx)) {
-			do_build_in(buildin_idx, args);
+		else
+			reset_sig_subshell();
+		signals_blocked = 0;
+		dup2(in_fd, STDIN_FILENO);
+		dup2(out_fd, STDOUT_FILENO);
+		for (size_t i = 0; i < pipe_count; ++i) {
+			close(pipes[i][0]);
+			close(pipes[i][1]);
+		}
+		for (size_t i = 0; i < cmd->assign_count; ++i)
+			vars_assign(cmd->assigns[i], VAR_EXPORT);
+		if (cmd->body == NULL && found->kind == LOOKUP_BUILD_IN) {
+			result = do_build_in(found->build_in, cmd->argv, STDIN_FILENO);
 		} else {
-			reset_sig_process();
-			execvp(cmd, args);
-			perror(cmd);
+			in_subshell = 1;
+			leave_interactive();
+			if (cmd->body != NULL)
+				run_list(cmd->body);
+			else
+				call_function(found->func, cmd->argv, cmd->argc);
+			result = get_last_status();
+		}
+		fflush(stdout);
+		_exit(result);
+	}
+	if (!in_subshell)
+		setpgid(pid, pgid == 0 ? pid : pgid); //also done by child, whichever runs first wins
+	return pid;
+}
+
+/* launch pipe job stage[0] | stage[1] | ... | stage[count - 1]
+ * all pipes are created up front and every stage is launched directly by shell into one process group,
+ * stages are launched from the end, so the end process leads the group and its exit ends the job,
+ * a stage that can't be launched is reported and skipped, its neighbours see EOF or EPIPE
+ * stage_pids[i] is set to pid of stage i, or 0 if it wasn't launched
+ * return:
+ *     pgid of pipe job, 0 if nothing has been launched
+ */
+static pid_t execute_pipe(struct arena *arena, const struct pipeline *pl, pid_t *stage_pids)
+{
+	int (*pipes)[2], in_fd, out_fd, redir_in, redir_out;
+	size_t pipe_count = pl->count - 1, i;
+	const struct command *cmd;
+	struct lookup found;
+	pid_t pgid = 0, pid;
+
+	pipes = arena_alloc(arena, pipe_count * sizeof(int[2]));
+	for (i = 0; i < pipe_count; ++i) {
+		if (pipe2(pipes[i], O_CLOEXEC) != 0) {
+			syslog(LOG_ERR, "Can't create pipe: %m");
+			pipe_count = i;
+			goto close_and_return;
 		}
-		_exit(127);
-	} else { //this is the start process in pipe job
-		if (is_build_in(cmd, &buildin_idx)) {
-			do_build_in(buildin_idx, args);
+	}
+
+	for (i = pl->count; i-- > 0;) {
+		stage_pids[i] = 0;
+		pid = 0;
+		if ((cmd = expand_cmd(arena, &pl->stages[i])) == NULL || open_redirects(cmd, &redir_in, &redir_out) != 0)
+			goto close_used;
+		in_fd = redir_in != -1 ? redir_in : i == 0 ? STDIN_FILENO : pipes[i - 1][0];
+		out_fd = redir_out != -1 ? redir_out : i == pipe_count ? STDOUT_FILENO : pipes[i][1];
+
+		found.kind = LOOKUP_NONE;
+		if (cmd->body != NULL || cmd->argv[0] != NULL) { //a stage with only redirections launches nothing
+			if (cmd->body == NULL && resolve(cmd, &found) == LOOKUP_NONE)
+				fprintf(stderr, "%s: command not found\n", cmd->argv[0]);
+			else if (found.kind == LOOKUP_PATH)
+				pid = spawn_external(cmd, found.path, pgid, in_fd, out_fd, pl->bg);
+			else
+				pid = fork_stage(cmd, &found, pgid, in_fd, out_fd, pipes, pipe_count, pl->bg);
+		}
+		if (pgid == 0)
+			pgid = pid;
+		stage_pids[i] = pid;
+		close_redirects(redir_in, redir_out);
+
+close_used:
+		/*ends used by this stage are not needed by shell any more*/
+		if (i != 0) {
+			close(pipes[i - 1][0]);
+			pipes[i - 1][0] = -1;
+		}
+		if (i != pipe_count) {
+			close(pipes[i][1]);
+			pipes[i][1] = -1;
+		}
+	}
+
+close_and_return:
+	for (i = 0; i < pipe_count; ++i) {
+		if (pipes[i][0] != -1)
+			close(pipes[i][0]);
+		if (pipes[i][1] != -1)
+			close(pipes[i][1]);
+	}
+	return pgid;
+}
+
+/* launch parsed command line, expansions and pipes are allocated in arena
+ * stage_pids must hold pl->count pids, see execute_pipe()
+ * return:
+ *     pgid of launched job, 0 if command ran in shell or nothing has been launched,
+ *     in which case last status has been set
+ */
+static pid_t execute_cmd(struct arena *arena, const struct pipeline *pl, pid_t *stage_pids)
+{
+	assert(pl != NULL && pl->count > 0);
+
+	if (pl->count > 1)
+		return execute_pipe(arena, pl, stage_pids);
+	return stage_pids[0] = execute_single_cmd(arena, &pl->stages[0], pl->bg);
+}
+
+/* launch cmd_line as a background job for a builtin that runs commands, the job is registered
+ * without notice, caller waits for it through update_job_state() and removes it with BG_RM
+ * every stage runs in a child, builtins in a forked shell, so the job never changes state of shell
+ * cmd_line is parsed into its own arena, cmd_arena still holds the line of the builtin
+ * return:
+ *     pgid of launched job, 0 if nothing has been launched, in which case last status has been set
+ */
+pid_t launch_quiet_job(const char *cmd_line)
+{
+	assert(cmd_line != NULL);
+
+	static struct arena job_arena = {NULL, 0};
+	struct arena_mark mark = arena_mark(&job_arena); //a forked item running parallel again still uses its line
+	struct pipeline *pl;
+	pid_t *stage_pids, pgid = 0;
+
+	if (parse_cmd(&job_arena, cmd_line, &pl) != 0) {
+		set_last_status(2);
+	} else if (pl == NULL) {
+		set_last_status(0);
+	} else {
+		pl->bg = 1;
+		stage_pids = arena_alloc(&job_arena, pl->count * sizeof(pid_t));
+		fflush(stdout);
+		if ((pgid = execute_pipe(&job_arena, pl, stage_pids)) != 0) {
+			set_bg_job(pgid, cmd_line, BG_QUIET);
+			set_job_members(pgid, stage_pids, pl->count);
+		} else //a command that only assigns or redirects, or one that failed to launch
+			set_last_status(pl->count == 1 && pl->stages[0].argv[0] == NULL ? 0 : 127);
+	}
+	arena_release(&job_arena, mark);
+	return pgid;
+}
+
+/* stdout of a builtin in a command substitution goes to capture_buf */
+static struct str_buf *capture_buf;
+
+static ssize_t capture_write(void *cookie, const char *data, size_t length)
+{
+	str_buf_append(capture_buf, data, length);
+	return length;
+}
+
+/* run builtin idx in shell with stdout swapped for a stream that appends to out, no fork or pipe */
+static void capture_build_in(size_t idx, char **args, struct str_buf *out)
+{
+	static FILE *capture;
+	FILE *save = stdout;
+
+	if (capture == NULL) {
+		cookie_io_functions_t io = {NULL, capture_write, NULL, NULL};
+		if ((capture = fopencookie(NULL, "w", io)) == NULL) {
+			syslog(LOG_ERR, "Can't open capture stream: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	fflush(stdout);
+	capture_buf = out;
+	stdout = capture;
+	set_last_status(do_build_in(idx, args, STDIN_FILENO));
+	fflush(stdout);
+	stdout = save;
+}
+
+/* substitution job runs in background, a process of it that stops (on terminal input or
+ * output) is killed with its job, *killed is set when that is reported
+ */
+static void kill_subst_job(pid_t pgid, int *killed)
+{
+	if (!*killed)
+		fprintf(stderr, "nspt_sh: command substitution stopped, killed\n");
+	*killed = 1;
+	kill(-pgid, SIGKILL);
+}
+
+static void kill_stopped(pid_t pgid, const pid_t *stage_pids, size_t count, int *killed)
+{
+	siginfo_t info;
+
+	for (size_t i = 0; i < count; ++i) {
+		info.si_pid = 0;
+		if (stage_pids[i] != 0 && waitid(P_PID, stage_pids[i], &info, WSTOPPED | WNOHANG | WNOWAIT) == 0
+				&& info.si_pid != 0) {
+			kill_subst_job(pgid, killed);
+			return;
+		}
+	}
+}
+
+/* read fd until EOF straight into out, which grows SUB_READ_LEN at a time
+ * SIGCHLD is watched meanwhile, a stopped process of the job would hold the pipe open forever,
+ * a SIGCHLD consumed here is raised again, so update_job_state() still sees it
+ */
+static void read_output(int fd, struct str_buf *out, pid_t pgid, const pid_t *stage_pids, size_t count, int *killed)
+{
+	struct pollfd fds[2] = {{fd, POLLIN, 0}, {sigchld_fd, POLLIN, 0}};
+	int chld_seen = 0;
+	ssize_t len;
+
+	while (1) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "Can't poll command substitution: %m");
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			consume_sigchld();
+			chld_seen = 1;
+			kill_stopped(pgid, stage_pids, count, killed);
+		}
+		if (fds[0].revents == 0)
+			continue;
+		str_buf_reserve(out, SUB_READ_LEN);
+		if ((len = read(fd, out->data + out->len, out->cap - out->len - 1)) > 0) {
+			out->len += len;
+		} else if (len == 0 || errno != EINTR) {
+			if (len != 0)
+				syslog(LOG_ERR, "Can't read command substitution: %m");
+			break;
+		}
+	}
+	if (out->data != NULL)
+		out->data[out->len] = '\0';
+	if (chld_seen)
+		raise(SIGCHLD); //blocked, so it stays pending on sigchld_fd
+}
+
+/* wait for processes of a substitution job by pid, so exits of other jobs stay with
+ * update_job_state(), a process stopped by reading terminal is killed
+ * return status of the job
+ */
+static int wait_subst_job(pid_t pgid, const pid_t *stage_pids, size_t count, int *killed)
+{
+	int status = 0, pipefail_status = 0, term_stat;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (stage_pids[i] == 0) {
+			status = 127;
 		} else {
-			reset_sig_process();
-			execvp(cmd, args);
-			perror(cmd);
+			while (waitpid(stage_pids[i], &term_stat, WUNTRACED) == -1 && errno == EINTR);
+			if (WIFSTOPPED(term_stat)) {
+				kill_subst_job(pgid, killed);
+				i--;
+				continue;
+			}
+			status = WIFEXITED(term_stat) ? WEXITSTATUS(term_stat) : WTERMSIG(term_stat) + 128;
+		}
+		if (status != 0)
+			pipefail_status = status;
+	}
+	return get_pipefail() ? pipefail_status : status;
+}
+
+/* append output of command substitution cmd_line to out, trailing newlines are removed
+ * a builtin that only writes stdout runs in shell and its output is captured into memory,
+ * anything else runs as a job writing into a pipe, with builtins in a forked shell, so a
+ * substitution never changes state of shell, last status is set to its status
+ */
+void command_output(const char *cmd_line, struct str_buf *out)
+{
+	assert(cmd_line != NULL && out != NULL);
+
+	static struct arena arenas[EXPAND_MAX_DEPTH];
+	static size_t depth;
+	struct arena *arena = &arenas[depth];
+	const struct command *cmd;
+	struct pipeline *pl;
+	struct lookup found;
+	pid_t *stage_pids, pgid;
+	size_t start = out->len;
+	int fds[2], save_stdout, was_blocked = signals_blocked, killed = 0;
+
+	subst_count++;
+	if (parse_cmd(arena, cmd_line, &pl) != 0) {
+		set_last_status(2);
+		goto free_and_return;
+	}
+	if (pl == NULL) {
+		set_last_status(0);
+		goto free_and_return;
+	}
+	depth++;
+	if (pl->count == 1 && !pl->bg) {
+		if ((cmd = expand_cmd(arena, &pl->stages[0])) == NULL) {
+			set_last_status(1);
+			goto done;
 		}
-		_exit(127);
+		if (cmd->argv[0] != NULL && cmd->redirs == NULL && cmd->assign_count == 0
+				&& resolve(cmd, &found) == LOOKUP_BUILD_IN && build_in_capturable(found.build_in)) {
+			capture_build_in(found.build_in, cmd->argv, out);
+			goto done;
+		}
+		pl->stages[0] = *cmd; //expanded already, expand_cmd() leaves it as it is
 	}
 
-	return 0;//shouldn't reach here
+	if (pipe2(fds, O_CLOEXEC) != 0) {
+		syslog(LOG_ERR, "Can't create pipe: %m");
+		set_last_status(1);
+		goto done;
+	}
+	stage_pids = arena_alloc(arena, pl->count * sizeof(pid_t));
+	fflush(stdout);
+	save_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	dup2(fds[1], STDOUT_FILENO);
+	close(fds[1]);
+	pl->bg = 1; //never takes over terminal
+	pgid = execute_pipe(arena, pl, stage_pids);
+	dup2(save_stdout, STDOUT_FILENO);
+	close(save_stdout);
+	read_output(fds[0], out, pgid, stage_pids, pl->count, &killed);
+	close(fds[0]);
+	if (pgid != 0)
+		set_last_status(wait_subst_job(pgid, stage_pids, pl->count, &killed));
+	else //nothing launched: a command that only assigns or redirects, or one that failed to launch
+		set_last_status(pl->count == 1 && pl->stages[0].argv[0] == NULL ? 0 : 127);
+	unblock_signals(was_blocked);
+
+done:
+	depth--;
+free_and_return:
+	while (out->len > start && out->data[out->len - 1] == '\n')
+		out->len--;
+	if (out->data != NULL)
+		out->data[out->len] = '\0';
+	arena_reset(arena);
 }
 
-void do_cmd(const char *input_cmd)
+/* time builtin, report usage of job (or of shell itself if command ran in shell) to stderr */
+static void output_time(const struct job_usage *usage)
 {
-	assert(input_cmd != NULL);
+	fprintf(stderr, "\nreal\t%ldm%ld.%03lds\nuser\t%ldm%ld.%03lds\nsys\t%ldm%ld.%03lds\n"
+		"maxrss\t%ldKB\nctxsw\t%ld/%ld\n",
+		(long)usage->wall.tv_sec / 60, (long)usage->wall.tv_sec % 60, usage->wall.tv_nsec / 1000000,
+		(long)usage->utime.tv_sec / 60, (long)usage->utime.tv_sec % 60, (long)usage->utime.tv_usec / 1000,
+		(long)usage->stime.tv_sec / 60, (long)usage->stime.tv_sec % 60, (long)usage->stime.tv_usec / 1000,
+		usage->maxrss, usage->nvcsw, usage->nivcsw);
+}
+
+/* usage of a command that ran in shell, computed from shell's own rusage */
+static void self_usage(const struct rusage *start_ru, const struct timespec *start, struct job_usage *usage)
+{
+	struct rusage ru;
+	struct timespec now;
 
-	size_t input_cmd_len, cmd_count, last_cmd_idx;
-	sigset_t oldmask, wait_chld_mask, allmask;
+	getrusage(RUSAGE_SELF, &ru);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timersub(&ru.ru_utime, &start_ru->ru_utime, &usage->utime);
+	timersub(&ru.ru_stime, &start_ru->ru_stime, &usage->stime);
+	usage->maxrss = ru.ru_maxrss;
+	usage->nvcsw = ru.ru_nvcsw - start_ru->ru_nvcsw;
+	usage->nivcsw = ru.ru_nivcsw - start_ru->ru_nivcsw;
+	usage->wall.tv_sec = now.tv_sec - start->tv_sec;
+	usage->wall.tv_nsec = now.tv_nsec - start->tv_nsec;
+	if (usage->wall.tv_nsec < 0) {
+		usage->wall.tv_sec--;
+		usage->wall.tv_nsec += 1000000000L;
+	}
+}
+
+/* run pipeline and wait for it unless it is a background job, last status is set to its status
+ * a foreground job interrupted by SIGINT or stopped stops whatever interactive command runs it
+ */
+void run_pipeline(const struct pipeline *pl)
+{
+	assert(pl != NULL);
+
+	struct arena_mark mark = arena_mark(&exec_arena);
+	int was_blocked = signals_blocked;
 	struct job_state job;
-	char *cmd = NULL, **pipe_cmds = NULL;
-	int bg = 0;
-
-	if ((input_cmd_len = strlen(input_cmd)) == 0)
-		return;
-	if ((cmd = malloc(input_cmd_len + 1)) == NULL) {
-		syslog(LOG_ERR, "Can't allocate command parse buffer: %m");
-		exit(EXIT_FAILURE);
-	}
-	strcpy(cmd, input_cmd);
-	if (cmd[input_cmd_len - 1] == '&') {
-		bg = 1;
-		cmd[--input_cmd_len] = '\0';
-	}
-
-
-	pipe_cmds = split_cmd(cmd, "|", &cmd_count);
-	if (pipe_cmds == NULL)
-		goto free_and_return; //command is empty or full of '|'
-	last_cmd_idx = cmd_count - 1;
-
-	sigfillset(&wait_chld_mask);
-	sigfillset(&allmask);
-	sigdelset(&wait_chld_mask, SIGCHLD);
-	sigprocmask(SIG_SETMASK, &allmask, &oldmask);
-	job.pgid = execute_cmd(pipe_cmds, last_cmd_idx, last_cmd_idx, STDOUT_FILENO, bg);
-
-	if (job.pgid != 0 && bg == 0) {
-		set_fg_job(job.pgid, input_cmd);
-		while (1) {
-			sigsuspend(&wait_chld_mask);
-			update_job_state(0, &job, 1);
-			if (job.state == 'e' || job.state == 's') {
-				break;
+	struct rusage start_ru;
+	struct timespec start;
+	pid_t *stage_pids;
+	int timed;
+
+	path_checked = 0;
+	stage_pids = arena_alloc(&exec_arena, pl->count * sizeof(pid_t));
+	timed = pl->timed && !pl->bg;
+	if (timed) {
+		getrusage(RUSAGE_SELF, &start_ru);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+
+	job.pgid = execute_cmd(&exec_arena, pl, stage_pids);
+
+	if (job.pgid != 0 && pl->bg == 0) {
+		set_fg_job(job.pgid, pl->text);
+		set_job_members(job.pgid, stage_pids, pl->count);
+		wait_job(&job);
+		if (job.state == 'e')
+			set_last_status(get_pipefail() ? job.pipefail_status : job.status);
+		else
+			set_last_status(128 + SIGTSTP);
+		if (timed && job.state == 'e')
+			output_time(&job.usage);
+		if (is_interactive()) {
+			if (tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
+				syslog(LOG_ERR, "Can't hand over terminal to parent: %m");
+				exit(EXIT_FAILURE);
 			}
+			tty_cbreak();
+			if (job.state != 'e' || job.status == 128 + SIGINT)
+				interp_interrupt();
 		}
-		if (tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
-			syslog(LOG_ERR, "Can't hand over terminal to parent: %m");
-			exit(EXIT_FAILURE);
-		}
-		tty_cbreak();
 	} else if (job.pgid != 0) {
-		set_bg_job(job.pgid, input_cmd, BG_ADD);
+		set_bg_job(job.pgid, pl->text, BG_ADD);
+		set_job_members(job.pgid, stage_pids, pl->count);
+		set_last_status(0);
+	} else if (timed) {
+		self_usage(&start_ru, &start, &job.usage);
+		output_time(&job.usage);
 	}
-	sigprocmask(SIG_SETMASK, &oldmask, NULL);
+	unblock_signals(was_blocked);
+	arena_release(&exec_arena, mark);
+}
 
-free_and_return:
-	if (pipe_cmds)
-		free(pipe_cmds);
-	if (cmd)
-		free(cmd);
-	return;
+/* parse input, which may span lines, and run it, see parse_program()
+ * return:
+ *     0 if it has run, or had a syntax error, which has been reported
+ *     PARSE_INCOMPLETE if more is set and input ends inside a command, nothing has run then
+ */
+int run_input(const char *input, int more)
+{
+	assert(input != NULL);
+
+	struct node *list;
+	int result;
+#ifdef NSPT_COUNT_ALLOCS
+	unsigned long allocs = alloc_count();
+#endif
+
+	if ((result = parse_program(&cmd_arena, input, more, &list)) == -1)
+		set_last_status(2);
+	else if (result == 0) //an empty command leaves status as it is
+		run_program(list);
+	arena_reset(&cmd_arena);
+	fflush(stdout);
+#ifdef NSPT_COUNT_ALLOCS
+	if (result != PARSE_INCOMPLETE)
+		fprintf(stderr, "[heap allocations: %lu]\n", alloc_count() - allocs);
+#endif
+	return result == -1 ? 0 : result;
+}
+
+/* like do_cmd(), for a command that has been parsed already (see script_cache.c) */
+void do_parsed_cmd(const struct node *list)
+{
+#ifdef NSPT_COUNT_ALLOCS
+	unsigned long allocs = alloc_count();
+#endif
+
+	run_program(list);
+	fflush(stdout);
+#ifdef NSPT_COUNT_ALLOCS
+	fprintf(stderr, "[heap allocations: %lu]\n", alloc_count() - allocs);
+#endif
+}
+
+void do_cmd(const char *input_cmd)
+{
+	assert(input_cmd != NULL);
+
+	run_input(input_cmd, 0);
 }
@@ -1,4 +1,17 @@
 #ifndef NSPT_EXEC_CMD
 #define NSPT_EXEC_CMD
+
+#include <sys/types.h>
+#include "tools.h"
+
+struct pipeline;
+struct node;
+
 void do_cmd(const char * input_cmd);
+int run_input(const char *input, int more);
+void do_parsed_cmd(const struct node *list);
+void run_pipeline(const struct pipeline *pl);
+pid_t launch_quiet_job(const char *cmd_line);
+void command_output(const char *cmd_line, struct str_buf *out);
+
 #endif
\ No newline at end of file
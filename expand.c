@@ -0,0 +1,339 @@
+#include "expand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "exec_cmd.h"
+#include "sh_env.h"
+#include "tools.h"
+#include "vars.h"
+
+#define MARKERS "\001\002\004\005"
+
+/* expansion of the markers parse_cmd() left in words
+ * $NAME, ${NAME}, $?, $$, $0, $1..$9, ${10}..., $#, $@, $* and $(cmd) or `cmd`
+ * "$@" gives a field per positional parameter, none if there are none
+ * unquoted results are split into fields at blanks, a word that expands to nothing is dropped,
+ * assignments and redirection targets are never split, there is no globbing
+ * a command substitution expands its own command, so state is kept per nesting level and
+ * its buffers are reused by the next expansion at that level
+ */
+struct expansion {
+	struct arena *arena;
+	struct str_buf field;   //field being built
+	struct str_buf output;  //output of command substitution
+	struct str_buf joined;  //$* and unquoted $@
+	char **items;           //fields done
+	size_t count, cap;
+	struct var_ref *ref, *ref_end;  //slots for $NAME expansions still to come, see expand_cmd()
+};
+
+static struct expansion levels[EXPAND_MAX_DEPTH];
+static size_t depth;
+
+static int is_ifs(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\n';
+}
+
+static int is_name_char(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+static void add_field(struct expansion *exp, char *text)
+{
+	if (exp->count == exp->cap) {
+		exp->cap = exp->cap ? exp->cap * 2 : 16;
+		if ((exp->items = realloc(exp->items, exp->cap * sizeof(char *))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate expansion fields: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	exp->items[exp->count++] = text;
+}
+
+static void end_field(struct expansion *exp)
+{
+	add_field(exp, arena_strndup(exp->arena, exp->field.len ? exp->field.data : "", exp->field.len));
+	exp->field.len = 0;
+}
+
+static int is_digits(const char *str, size_t length)
+{
+	for (size_t i = 0; i < length; ++i) {
+		if (str[i] < '0' || str[i] > '9')
+			return 0;
+	}
+	return length > 0;
+}
+
+/* $@ or ${@} at pos, which "$@" expands to a field per parameter */
+static int is_all_params(const char *pos)
+{
+	return pos[0] == '@' || (pos[0] == '{' && pos[1] == '@' && pos[2] == '}');
+}
+
+/* value of the parameter named at *pos, which is moved past the name, "" if it isn't set
+ * num holds text of numeric values, ref (if not NULL) remembers where a variable was found
+ * return NULL if braces are malformed, which has been reported
+ */
+static const char *param_value(struct expansion *exp, const char **pos, char *num, size_t num_len, struct var_ref *ref)
+{
+	const char *name = *pos, *end, *value;
+	size_t name_len, count, idx;
+	char **params;
+
+	if (*name == '{') {
+		name++;
+		if ((end = strchr(name, '}')) == NULL || end == name
+				|| (end - name > 1 && !is_var_name(name, end - name) && !is_digits(name, end - name))) {
+			fprintf(stderr, "nspt_sh: bad substitution\n");
+			return NULL;
+		}
+		*pos = end + 1;
+	} else {
+		end = name + 1; //special parameters and digits are one char long
+		if (is_var_name(name, 1))
+			while (is_name_char(*end))
+				end++;
+		*pos = *end == CTL_END ? end + 1 : end;
+	}
+	name_len = end - name;
+
+	if (name_len == 1 && *name == '?') {
+		snprintf(num, num_len, "%d", get_last_status());
+		return num;
+	} else if (name_len == 1 && *name == '$') {
+		snprintf(num, num_len, "%ld", (long)vars_shell_pid());
+		return num;
+	} else if (name_len == 1 && *name == '0') {
+		return vars_arg0();
+	} else if (name_len == 1 && *name == '#') {
+		vars_params(&count);
+		snprintf(num, num_len, "%zu", count);
+		return num;
+	} else if (name_len == 1 && (*name == '@' || *name == '*')) {
+		params = vars_params(&count);
+		exp->joined.len = 0;
+		for (idx = 0; idx < count; ++idx) {
+			if (idx > 0)
+				str_buf_append(&exp->joined, " ", 1);
+			str_buf_append(&exp->joined, params[idx], strlen(params[idx]));
+		}
+		str_buf_append(&exp->joined, "", 1);
+		return exp->joined.data;
+	} else if (is_digits(name, name_len)) {
+		params = vars_params(&count);
+		idx = strtoul(name, NULL, 10);
+		return idx >= 1 && idx <= count ? params[idx - 1] : "";
+	} else if (!is_var_name(name, name_len)) {
+		fprintf(stderr, "nspt_sh: bad substitution\n");
+		return NULL;
+	}
+	value = ref != NULL ? vars_get_ref(ref, name, name_len) : vars_getn(name, name_len);
+	return value != NULL ? value : "";
+}
+
+/* quoted $@ at *pos, which is moved past it: every parameter ends a field but the last,
+ * which text following it joins
+ */
+static void all_params(struct expansion *exp, const char **pos, int *has_field)
+{
+	size_t count;
+	char **params = vars_params(&count);
+
+	*pos += **pos == '{' ? 3 : 1;
+	if (**pos == CTL_END)
+		(*pos)++;
+	for (size_t i = 0; i < count; ++i) {
+		if (i > 0)
+			end_field(exp);
+		str_buf_append(&exp->field, params[i], strlen(params[i]));
+		*has_field = 1;
+	}
+}
+
+/* output of the command substitution at *pos, which is moved past it */
+static const char *subst_value(struct expansion *exp, const char **pos)
+{
+	const char *end = strchr(*pos, CTL_END);
+	char *cmd_line = arena_strndup(exp->arena, *pos, end - *pos);
+
+	*pos = end + 1;
+	exp->output.len = 0;
+	command_output(cmd_line, &exp->output);
+	return exp->output.len ? exp->output.data : "";
+}
+
+/* expand word into fields, split unquoted results if split is set, otherwise word gives one field
+ * return 0 on success, -1 on bad substitution
+ */
+static int expand_word(struct expansion *exp, const char *word, int split)
+{
+	char num[24], marker;
+	const char *value;
+	struct var_ref *ref;
+	size_t run;
+	int has_field = !split;
+
+	exp->field.len = 0;
+	while (*word != '\0') {
+		if ((run = strcspn(word, MARKERS)) > 0) {
+			str_buf_append(&exp->field, word, run);
+			word += run;
+			has_field = 1;
+			continue;
+		}
+		marker = *word++;
+		if (marker == CTL_SUB || marker == CTL_QSUB) {
+			value = subst_value(exp, &word);
+		} else {
+			ref = exp->ref < exp->ref_end ? exp->ref++ : NULL;
+			if (is_all_params(word) && marker == CTL_QVAR && split) {
+				all_params(exp, &word, &has_field);
+				continue;
+			}
+			if ((value = param_value(exp, &word, num, sizeof(num), ref)) == NULL)
+				return -1;
+		}
+		if (marker == CTL_QVAR || marker == CTL_QSUB || !split) {
+			str_buf_append(&exp->field, value, strlen(value));
+			has_field = 1;
+			continue;
+		}
+		while (*value != '\0') {
+			if (is_ifs(*value)) {
+				if (has_field)
+					end_field(exp);
+				has_field = 0;
+				for (value++; is_ifs(*value); ++value);
+				continue;
+			}
+			for (run = 1; value[run] != '\0' && !is_ifs(value[run]); ++run);
+			str_buf_append(&exp->field, value, run);
+			value += run;
+			has_field = 1;
+		}
+	}
+	if (has_field)
+		end_field(exp);
+	return 0;
+}
+
+static int has_marker(const char *word)
+{
+	return strpbrk(word, MARKERS) != NULL;
+}
+
+/* expand words into a NULL terminated array in arena, *count is set to its length */
+static char **expand_words(struct expansion *exp, char **words, size_t *count, int split)
+{
+	char **result;
+	size_t i;
+
+	exp->count = 0;
+	for (i = 0; words[i] != NULL; ++i) {
+		if (!has_marker(words[i]))
+			add_field(exp, words[i]);
+		else if (expand_word(exp, words[i], split) != 0)
+			return NULL;
+	}
+	result = arena_alloc(exp->arena, (exp->count + 1) * sizeof(char *));
+	memcpy(result, exp->items, exp->count * sizeof(char *));
+	result[exp->count] = NULL;
+	*count = exp->count;
+	return result;
+}
+
+static const struct command *expand_parts(struct expansion *exp, const struct command *cmd)
+{
+	struct command *result = arena_alloc(exp->arena, sizeof(struct command));
+	struct redirect **tail;
+
+	*result = *cmd;
+	exp->ref = cmd->refs;
+	exp->ref_end = cmd->refs + cmd->assign_refs;
+	if ((result->assigns = expand_words(exp, cmd->assigns, &result->assign_count, 0)) == NULL)
+		return NULL;
+	exp->ref_end = cmd->refs + cmd->ref_count;
+	if ((result->argv = expand_words(exp, cmd->argv, &result->argc, 1)) == NULL)
+		return NULL;
+	exp->ref = exp->ref_end = NULL; //redirection targets have no slots
+	tail = &result->redirs;
+	for (struct redirect *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+		*tail = arena_alloc(exp->arena, sizeof(struct redirect));
+		**tail = *redir;
+		if (has_marker(redir->target)) {
+			exp->count = 0;
+			if (expand_word(exp, redir->target, 0) != 0)
+				return NULL;
+			(*tail)->target = exp->items[0];
+		}
+		tail = &(*tail)->next;
+	}
+	*tail = NULL;
+	result->expand = 0;
+	return result;
+}
+
+/* expansion state for the next nesting level, NULL if nesting is too deep, which has been reported */
+static struct expansion *enter_level(struct arena *arena)
+{
+	if (depth == EXPAND_MAX_DEPTH) {
+		fprintf(stderr, "nspt_sh: command substitution nested too deeply\n");
+		return NULL;
+	}
+	levels[depth].arena = arena;
+	levels[depth].ref = levels[depth].ref_end = NULL;
+	return &levels[depth++];
+}
+
+/* command with expansions of cmd done, allocated in arena, cmd itself if it has none
+ * return NULL on bad substitution or too deep nesting, which has been reported
+ */
+const struct command *expand_cmd(struct arena *arena, const struct command *cmd)
+{
+	struct expansion *exp;
+	const struct command *result;
+
+	if (!cmd->expand)
+		return cmd;
+	if ((exp = enter_level(arena)) == NULL)
+		return NULL;
+	result = expand_parts(exp, cmd);
+	depth--;
+	return result;
+}
+
+/* expand words of for into fields in arena, *count is set to their number
+ * return NULL on bad substitution or too deep nesting, which has been reported
+ */
+char **expand_fields(struct arena *arena, char **words, size_t *count)
+{
+	struct expansion *exp;
+	char **result;
+
+	if ((exp = enter_level(arena)) == NULL)
+		return NULL;
+	result = expand_words(exp, words, count, 1);
+	depth--;
+	return result;
+}
+
+/* expand word of case into one field in arena, NULL as for expand_fields() */
+char *expand_field(struct arena *arena, char *word)
+{
+	struct expansion *exp;
+	char *result = NULL;
+
+	if (!has_marker(word))
+		return word;
+	if ((exp = enter_level(arena)) == NULL)
+		return NULL;
+	exp->count = 0;
+	if (expand_word(exp, word, 0) == 0)
+		result = exp->items[0];
+	depth--;
+	return result;
+}
@@ -0,0 +1,13 @@
+#ifndef NSPT_EXPAND
+#define NSPT_EXPAND
+
+#include "arena.h"
+#include "parse.h"
+
+#define EXPAND_MAX_DEPTH 32  //nesting of command substitutions
+
+const struct command *expand_cmd(struct arena *arena, const struct command *cmd);
+char **expand_fields(struct arena *arena, char **words, size_t *count);
+char *expand_field(struct arena *arena, char *word);
+
+#endif
@@ -0,0 +1,122 @@
+#include "gap_buf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <syslog.h>
+
+void gap_buf_init(struct gap_buf *buf, size_t cap)
+{
+	assert(buf != NULL && cap > 0);
+
+	if ((buf->data = malloc(cap)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate line buffer: %m");
+		exit(EXIT_FAILURE);
+	}
+	buf->cap = buf->orig_cap = cap;
+	buf->gap_start = 0;
+	buf->gap_end = cap;
+}
+
+size_t gap_buf_len(const struct gap_buf *buf)
+{
+	return buf->cap - (buf->gap_end - buf->gap_start);
+}
+
+size_t gap_buf_cursor(const struct gap_buf *buf)
+{
+	return buf->gap_start;
+}
+
+char gap_buf_at(const struct gap_buf *buf, size_t idx)
+{
+	return idx < buf->gap_start ? buf->data[idx] : buf->data[idx + buf->gap_end - buf->gap_start];
+}
+
+/* copy length bytes of text starting at index from to dst, the range may span the gap */
+void gap_buf_copy(const struct gap_buf *buf, size_t from, size_t length, char *dst)
+{
+	size_t head = 0;
+
+	assert(from + length <= gap_buf_len(buf));
+
+	if (from < buf->gap_start) {
+		head = buf->gap_start - from < length ? buf->gap_start - from : length;
+		memcpy(dst, buf->data + from, head);
+	}
+	memcpy(dst + head, buf->data + from + head + buf->gap_end - buf->gap_start, length - head);
+}
+
+/* move cursor (the gap) to index pos, costs the distance moved */
+void gap_buf_move(struct gap_buf *buf, size_t pos)
+{
+	size_t distance;
+
+	assert(pos <= gap_buf_len(buf));
+
+	if (pos < buf->gap_start) {
+		distance = buf->gap_start - pos;
+		memmove(buf->data + buf->gap_end - distance, buf->data + pos, distance);
+		buf->gap_start -= distance;
+		buf->gap_end -= distance;
+	} else if (pos > buf->gap_start) {
+		distance = pos - buf->gap_start;
+		memmove(buf->data + buf->gap_start, buf->data + buf->gap_end, distance);
+		buf->gap_start += distance;
+		buf->gap_end += distance;
+	}
+}
+
+/* make gap at least length bytes, capacity is doubled so inserts stay amortised O(1) */
+static void grow_gap(struct gap_buf *buf, size_t length)
+{
+	size_t new_cap = buf->cap, tail = buf->cap - buf->gap_end;
+
+	while (new_cap - gap_buf_len(buf) < length)
+		new_cap *= 2;
+	if ((buf->data = realloc(buf->data, new_cap)) == NULL) {
+		syslog(LOG_ERR, "Can't reallocate line buffer: %m");
+		exit(EXIT_FAILURE);
+	}
+	memmove(buf->data + new_cap - tail, buf->data + buf->gap_end, tail);
+	buf->gap_end = new_cap - tail;
+	buf->cap = new_cap;
+}
+
+/* insert text at cursor, cursor ends up after it */
+void gap_buf_insert(struct gap_buf *buf, const char *text, size_t length)
+{
+	if (buf->gap_end - buf->gap_start < length)
+		grow_gap(buf, length);
+	memcpy(buf->data + buf->gap_start, text, length);
+	buf->gap_start += length;
+}
+
+/* delete up to length bytes before cursor */
+void gap_buf_delete(struct gap_buf *buf, size_t length)
+{
+	buf->gap_start -= length < buf->gap_start ? length : buf->gap_start;
+}
+
+/* close the gap and return text as a string, it stays valid until the buffer is changed,
+ * one byte of the gap is always kept for '\0'
+ */
+char *gap_buf_text(struct gap_buf *buf)
+{
+	if (buf->gap_end == buf->gap_start)
+		grow_gap(buf, 1);
+	gap_buf_move(buf, gap_buf_len(buf));
+	buf->data[buf->gap_start] = '\0';
+	return buf->data;
+}
+
+/* empty buffer, memory grown for a long line is given back */
+void gap_buf_clear(struct gap_buf *buf)
+{
+	if (buf->cap > buf->orig_cap) {
+		free(buf->data);
+		gap_buf_init(buf, buf->orig_cap);
+		return;
+	}
+	buf->gap_start = 0;
+	buf->gap_end = buf->cap;
+}
@@ -0,0 +1,26 @@
+#ifndef NSPT_GAP_BUF
+#define NSPT_GAP_BUF
+
+#include <stddef.h>
+
+/* gap buffer for the line being edited, text is data[0, gap_start) followed by data[gap_end, cap),
+ * the gap sits at the cursor, so inserting and deleting there only moves gap bounds
+ */
+struct gap_buf {
+	char *data;
+	size_t cap, orig_cap;
+	size_t gap_start, gap_end;
+};
+
+void gap_buf_init(struct gap_buf *buf, size_t cap);
+size_t gap_buf_len(const struct gap_buf *buf);
+size_t gap_buf_cursor(const struct gap_buf *buf);
+char gap_buf_at(const struct gap_buf *buf, size_t idx);
+void gap_buf_copy(const struct gap_buf *buf, size_t from, size_t length, char *dst);
+void gap_buf_move(struct gap_buf *buf, size_t pos);
+void gap_buf_insert(struct gap_buf *buf, const char *text, size_t length);
+void gap_buf_delete(struct gap_buf *buf, size_t length);
+char *gap_buf_text(struct gap_buf *buf);
+void gap_buf_clear(struct gap_buf *buf);
+
+#endif
@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "tools.h"
+
+#define SEARCH_CHUNK_LEN 65536
+
+/* history file is one entry per line and is only ever appended to,
+ * shells sharing it append whole entries with a single write() under flock(),
+ * the file is mapped instead of read, so startup cost does not depend on its size,
+ * entries written by other shells show up when the mapping is refreshed,
+ * which every lookup does first, so a file truncated by hand is never read past its end
+ */
+static struct {
+	int fd;
+	const char *map;
+	size_t map_len;  //bytes mapped
+	size_t end;      //offset after last complete entry, a concurrent append may be in flight past it
+} hist = {-1, NULL, 0, 0};
+
+void history_init(const char *path)
+{
+	assert(path != NULL);
+
+	if ((hist.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		syslog(LOG_WARNING, "Can't open history file %s: %m", path);
+}
+
+/* map file again if it has grown or shrunk, reading a mapped page past the end of the file raises SIGBUS */
+static void refresh_map()
+{
+	struct stat file_stat;
+	const char *nl;
+
+	if (hist.fd == -1 || fstat(hist.fd, &file_stat) != 0 || (size_t)file_stat.st_size == hist.map_len)
+		return;
+
+	if (hist.map != NULL)
+		munmap((void *)hist.map, hist.map_len);
+	hist.map = NULL;
+	hist.map_len = hist.end = 0;
+	if (file_stat.st_size == 0)
+		return;
+	if ((hist.map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, hist.fd, 0)) == MAP_FAILED) {
+		syslog(LOG_WARNING, "Can't map history file: %m");
+		hist.map = NULL;
+		return;
+	}
+	hist.map_len = file_stat.st_size;
+	if ((nl = memrchr(hist.map, '\n', hist.map_len)) != NULL)
+		hist.end = nl - hist.map + 1;
+}
+
+size_t history_end()
+{
+	refresh_map();
+	return hist.end;
+}
+
+/* entry starting at pos, pos must be an entry start before hist.end */
+static void entry_at(size_t pos, const char **entry, size_t *length)
+{
+	const char *nl = memchr(hist.map + pos, '\n', hist.end - pos);
+
+	*entry = hist.map + pos;
+	*length = nl - *entry;
+}
+
+/* start of entry containing offset at */
+static size_t entry_start(size_t at)
+{
+	const char *nl;
+
+	if (at == 0 || (nl = memrchr(hist.map, '\n', at)) == NULL)
+		return 0;
+	return nl - hist.map + 1;
+}
+
+/* append line as newest entry, empty lines and repeats of newest entry are not recorded */
+void history_add(const char *line, size_t length)
+{
+	static struct str_buf rec = {NULL, 0, 0};
+	const char *last;
+	size_t last_len;
+
+	if (hist.fd == -1 || length == 0 || memchr(line, '\n', length) != NULL)
+		return;
+	refresh_map();
+	if (hist.end > 0) {
+		entry_at(entry_start(hist.end - 1), &last, &last_len);
+		if (last_len == length && memcmp(last, line, length) == 0)
+			return;
+	}
+
+	rec.len = 0;
+	str_buf_append(&rec, line, length);
+	str_buf_append(&rec, "\n", 1);
+	flock(hist.fd, LOCK_EX);
+	if (write(hist.fd, rec.data, rec.len) != (ssize_t)rec.len)
+		syslog(LOG_WARNING, "Can't append to history file: %m");
+	flock(hist.fd, LOCK_UN);
+}
+
+/* step *pos to the entry before it
+ * return 0 if there is no older entry
+ */
+int history_prev(size_t *pos, const char **entry, size_t *length)
+{
+	refresh_map();
+	if (*pos > hist.end) //file has shrunk
+		*pos = hist.end;
+	if (*pos == 0)
+		return 0;
+	*pos = entry_start(*pos - 1);
+	entry_at(*pos, entry, length);
+	return 1;
+}
+
+/* step *pos to the entry after it
+ * return 0 if *pos is the newest entry, *pos is then set to history_end()
+ */
+int history_next(size_t *pos, const char **entry, size_t *length)
+{
+	const char *nl;
+
+	refresh_map();
+	if (*pos >= hist.end || (nl = memchr(hist.map + *pos, '\n', hist.end - *pos)) == NULL ||
+			(size_t)(nl - hist.map) + 1 == hist.end) {
+		*pos = hist.end;
+		return 0;
+	}
+	*pos = nl - hist.map + 1;
+	entry_at(*pos, entry, length);
+	return 1;
+}
+
+/* find newest entry that contains pattern and ends before limit,
+ * the mapping is scanned backward in SEARCH_CHUNK_LEN chunks, so recent matches are found
+ * without touching old history and a miss costs one memmem() pass over the file
+ * return 0 if nothing matches
+ */
+int history_search(const char *pattern, size_t pattern_length, size_t limit,
+		size_t *pos, const char **entry, size_t *length)
+{
+	const char *found, *last;
+	size_t lo, hi;
+
+	if (pattern_length == 0)
+		return 0;
+	refresh_map();
+	hi = limit < hist.end ? limit : hist.end;
+	while (hi >= pattern_length) {
+		lo = hi > SEARCH_CHUNK_LEN ? hi - SEARCH_CHUNK_LEN : 0;
+		last = NULL;
+		for (found = hist.map + lo; (found = memmem(found, hist.map + hi - found, pattern, pattern_length)) != NULL; ++found)
+			last = found;
+		if (last != NULL) {
+			*pos = entry_start(last - hist.map);
+			entry_at(*pos, entry, length);
+			return 1;
+		}
+		if (lo == 0)
+			break;
+		hi = lo + pattern_length - 1; //next chunk overlaps so matches across chunk border are seen
+	}
+	return 0;
+}
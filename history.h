@@ -0,0 +1,15 @@
+#ifndef NSPT_HISTORY
+#define NSPT_HISTORY
+
+#include <stddef.h>
+
+/* a history position is the file offset of an entry, history_end() is the position after newest entry */
+void history_init(const char *path);
+void history_add(const char *line, size_t length);
+size_t history_end();
+int history_prev(size_t *pos, const char **entry, size_t *length);
+int history_next(size_t *pos, const char **entry, size_t *length);
+int history_search(const char *pattern, size_t pattern_length, size_t limit,
+		size_t *pos, const char **entry, size_t *length);
+
+#endif
@@ -0,0 +1,318 @@
+#include "interp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fnmatch.h>
+#include "arena.h"
+#include "exec_cmd.h"
+#include "expand.h"
+#include "sh_env.h"
+#include "vars.h"
+
+/* parsed command lists are run by walking them, a pipeline node is handed to run_pipeline()
+ * nothing is parsed again: a loop body runs the nodes it was parsed into, and its commands
+ * keep what their names and $NAME expansions resolved to (see struct lookup, struct var_ref)
+ * break, continue and return set flow, every list being run stops until the loop or
+ * function it is meant for takes it
+ */
+#define FUNC_BUCKETS 64
+
+/* shell function, name and a copy of its body live in its own arena */
+struct func {
+	char *name;
+	struct arena arena;
+	struct node *body;
+	size_t active;   //calls running
+	int defunct;     //replaced or unset while running, freed when its last call returns
+	struct func *next;
+};
+
+static struct func *funcs[FUNC_BUCKETS];
+static unsigned long func_gen;
+
+static int flow = FLOW_NONE;
+static size_t flow_levels;  //loops break or continue leaves
+static size_t loop_depth;   //loops running in current function (or outside of functions)
+static size_t func_depth;
+
+/* words of for and case are expanded into it, released when the command is done */
+static struct arena word_arena = {NULL, 0};
+
+static size_t hash_name(const char *name)
+{
+	size_t hash = 14695981039346656037UL;
+	for (; *name; ++name) {
+		hash ^= (unsigned char)*name;
+		hash *= 1099511628211UL;
+	}
+	return hash & (FUNC_BUCKETS - 1);
+}
+
+static void run_node(const struct node *node);
+
+/* after loop body (or condition) ran, return non-zero if loop must stop
+ * break or continue meant for an outer loop stops it too
+ */
+static int loop_stops()
+{
+	int stop;
+
+	if (flow == FLOW_NONE)
+		return 0;
+	if ((flow == FLOW_BREAK || flow == FLOW_CONTINUE) && --flow_levels == 0) {
+		stop = flow == FLOW_BREAK;
+		flow = FLOW_NONE;
+		return stop;
+	}
+	return 1;
+}
+
+static void run_loop(const struct node *node)
+{
+	int status = 0, until = node->type == NODE_UNTIL;
+
+	loop_depth++;
+	while (1) {
+		run_list(node->cond);
+		if (loop_stops())
+			break;
+		if ((get_last_status() == 0) == until)
+			break;
+		run_list(node->body);
+		status = get_last_status();
+		if (loop_stops())
+			break;
+	}
+	loop_depth--;
+	set_last_status(status);
+}
+
+static void run_for(const struct node *node)
+{
+	struct arena_mark mark = arena_mark(&word_arena);
+	char **words;
+	size_t count;
+	int status = 0;
+
+	if (node->words == NULL) { //"$@"
+		words = vars_params(&count);
+	} else if ((words = expand_fields(&word_arena, node->words, &count)) == NULL) {
+		set_last_status(1);
+		return;
+	}
+	loop_depth++;
+	for (size_t i = 0; i < count; ++i) {
+		vars_set(node->name, words[i], VAR_KEEP);
+		run_list(node->body);
+		status = get_last_status();
+		if (loop_stops())
+			break;
+	}
+	loop_depth--;
+	set_last_status(status);
+	arena_release(&word_arena, mark);
+}
+
+/* patterns are matched with fnmatch(), quoting doesn't make a glob char literal */
+static void run_case(const struct node *node)
+{
+	struct arena_mark mark = arena_mark(&word_arena);
+	const char *word, *pattern;
+
+	if ((word = expand_field(&word_arena, node->name)) == NULL) {
+		set_last_status(1);
+		return;
+	}
+	set_last_status(0);
+	for (const struct case_item *item = node->items; item != NULL; item = item->next) {
+		for (size_t i = 0; item->patterns[i] != NULL; ++i) {
+			if ((pattern = expand_field(&word_arena, item->patterns[i])) == NULL) {
+				set_last_status(1);
+				goto done;
+			}
+			if (fnmatch(pattern, word, 0) == 0) {
+				run_list(item->body);
+				goto done;
+			}
+		}
+	}
+done:
+	arena_release(&word_arena, mark);
+}
+
+static void run_node(const struct node *node)
+{
+	switch (node->type) {
+		case NODE_PIPELINE:
+			run_pipeline(node->pl);
+			if (node->pl->negate)
+				set_last_status(get_last_status() == 0);
+			break;
+		case NODE_AND:
+		case NODE_OR:
+			run_node(node->cond);
+			if (flow == FLOW_NONE && (get_last_status() == 0) == (node->type == NODE_AND))
+				run_node(node->body);
+			break;
+		case NODE_IF:
+			run_list(node->cond);
+			if (flow != FLOW_NONE)
+				break;
+			if (get_last_status() == 0)
+				run_list(node->body);
+			else if (node->orelse != NULL)
+				run_list(node->orelse);
+			else
+				set_last_status(0);
+			break;
+		case NODE_WHILE:
+		case NODE_UNTIL:
+			run_loop(node);
+			break;
+		case NODE_FOR:
+			run_for(node);
+			break;
+		case NODE_CASE:
+			run_case(node);
+			break;
+		case NODE_FUNC:
+			define_function(node->name, node->body);
+			set_last_status(0);
+			break;
+	}
+}
+
+/* run list, up to where break, continue or return (or an interrupt) stops it */
+void run_list(const struct node *list)
+{
+	for (; list != NULL && flow == FLOW_NONE; list = list->next)
+		run_node(list);
+}
+
+/* run list parsed from one complete command, a flow nothing took ends with it */
+void run_program(const struct node *list)
+{
+	run_list(list);
+	flow = FLOW_NONE;
+	loop_depth = 0;
+}
+
+/* for break, continue and return builtins, levels is the number of loops to leave */
+void interp_set_flow(int kind, size_t levels)
+{
+	flow = kind;
+	flow_levels = levels;
+}
+
+size_t interp_loop_depth()
+{
+	return loop_depth;
+}
+
+int interp_in_function()
+{
+	return func_depth > 0;
+}
+
+/* foreground job was killed by SIGINT or stopped, so whatever loop runs it stops */
+void interp_interrupt()
+{
+	flow = FLOW_INTERRUPT;
+}
+
+static struct func **find_slot(const char *name)
+{
+	struct func **slot;
+
+	for (slot = &funcs[hash_name(name)]; *slot != NULL; slot = &(*slot)->next) {
+		if (strcmp((*slot)->name, name) == 0)
+			break;
+	}
+	return slot;
+}
+
+static void release_function(struct func *func)
+{
+	if (func->active > 0) {
+		func->defunct = 1;
+		return;
+	}
+	arena_free(&func->arena);
+	free(func);
+}
+
+/* define function name, body is copied, one with the same name is replaced */
+void define_function(const char *name, const struct node *body)
+{
+	struct func **slot = find_slot(name), *func;
+
+	if ((func = malloc(sizeof(struct func))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate function: %m");
+		exit(EXIT_FAILURE);
+	}
+	func->arena.head = NULL;
+	func->arena.used = 0;
+	func->name = arena_strndup(&func->arena, name, strlen(name));
+	func->body = copy_nodes(&func->arena, body);
+	func->active = 0;
+	func->defunct = 0;
+	if (*slot != NULL) {
+		func->next = (*slot)->next;
+		release_function(*slot);
+	} else {
+		func->next = NULL;
+	}
+	*slot = func;
+	func_gen++;
+}
+
+/* return -1 if there is no function name */
+int undefine_function(const char *name)
+{
+	struct func **slot = find_slot(name), *func;
+
+	if ((func = *slot) == NULL)
+		return -1;
+	*slot = func->next;
+	release_function(func);
+	func_gen++;
+	return 0;
+}
+
+/* function name, NULL if there is none, valid until func_generation() changes */
+struct func *find_function(const char *name)
+{
+	return *find_slot(name);
+}
+
+unsigned long func_generation()
+{
+	return func_gen;
+}
+
+/* run func with argv[1]... as positional parameters, last status is set to its status */
+void call_function(struct func *func, char **argv, size_t argc)
+{
+	char **saved_params;
+	size_t saved_count, saved_loops = loop_depth;
+
+	if (func_depth == FUNC_MAX_DEPTH) {
+		fprintf(stderr, "%s: function nesting too deep\n", func->name);
+		set_last_status(1);
+		return;
+	}
+	saved_params = vars_params(&saved_count);
+	vars_set_params(argv + 1, argc - 1);
+	func->active++;
+	func_depth++;
+	loop_depth = 0; //break in function doesn't reach loops of its caller
+	run_list(func->body);
+	if (flow == FLOW_RETURN)
+		flow = FLOW_NONE;
+	loop_depth = saved_loops;
+	func_depth--;
+	vars_set_params(saved_params, saved_count);
+	if (--func->active == 0 && func->defunct)
+		release_function(func);
+}
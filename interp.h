@@ -0,0 +1,27 @@
+#ifndef NSPT_INTERP
+#define NSPT_INTERP
+
+#include <stddef.h>
+#include "parse.h"
+
+#define FLOW_NONE      0
+#define FLOW_BREAK     1
+#define FLOW_CONTINUE  2
+#define FLOW_RETURN    3
+#define FLOW_INTERRUPT 4  //foreground job was interrupted or stopped, rest of the command is dropped
+
+#define FUNC_MAX_DEPTH 1000  //nesting of function calls
+
+void run_program(const struct node *list);
+void run_list(const struct node *list);
+void interp_set_flow(int flow, size_t levels);
+size_t interp_loop_depth();
+int interp_in_function();
+void interp_interrupt();
+void define_function(const char *name, const struct node *body);
+int undefine_function(const char *name);
+struct func *find_function(const char *name);
+unsigned long func_generation();
+void call_function(struct func *func, char **argv, size_t argc);
+
+#endif
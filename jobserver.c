@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "jobserver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "vars.h"
+
+/* GNU make jobserver owned by shell
+ * a pipe holds one byte per free token, it is inherited by every child and advertised in
+ * MAKEFLAGS as "-j --jobserver-auth=R,W", so makes started from shell share tokens instead of
+ * each running its own -jN, every make also has one implicit token of its own
+ * a make killed while holding tokens loses them, tokens are topped up again whenever shell
+ * has no job left that could be holding one
+ */
+static struct jobserver {
+	int fds[2];             //-1 if jobserver is off
+	size_t tokens;
+	char *old_makeflags;    //MAKEFLAGS before jobserver was started, NULL if it was unset
+} js = {{-1, -1}, 0, NULL};
+
+int jobserver_active()
+{
+	return js.fds[0] != -1;
+}
+
+/* number of tokens in pipe */
+static size_t tokens_free()
+{
+	int avail = 0;
+
+	if (ioctl(js.fds[0], FIONREAD, &avail) != 0)
+		return 0;
+	return avail;
+}
+
+/* write tokens missing from pipe, pipe never holds more than tokens */
+static void top_up(size_t free_count)
+{
+	char buf[256];
+	size_t missing;
+	ssize_t written;
+
+	memset(buf, '+', sizeof(buf));
+	for (missing = js.tokens - free_count; missing > 0; missing -= written) {
+		if ((written = write(js.fds[1], buf, missing < sizeof(buf) ? missing : sizeof(buf))) <= 0) {
+			syslog(LOG_ERR, "Can't write jobserver tokens: %m");
+			return;
+		}
+	}
+}
+
+/* start jobserver with tokens shared tokens, restart it if it is running
+ * return 0 on success, -1 if pipe can't be created, which has been reported
+ */
+int jobserver_start(size_t tokens)
+{
+	const char *makeflags;
+	char *flags;
+
+	jobserver_stop();
+	if (pipe(js.fds) != 0) {
+		fprintf(stderr, "jobserver: can't create token pipe: %s\n", strerror(errno));
+		js.fds[0] = js.fds[1] = -1;
+		return -1;
+	}
+	if (tokens > (size_t)fcntl(js.fds[1], F_GETPIPE_SZ)) //a full pipe would block shell
+		fcntl(js.fds[1], F_SETPIPE_SZ, tokens);
+	js.tokens = tokens;
+	top_up(0);
+
+	makeflags = vars_get("MAKEFLAGS");
+	if (makeflags != NULL && (js.old_makeflags = strdup(makeflags)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate MAKEFLAGS copy: %m");
+		exit(EXIT_FAILURE);
+	}
+	if (asprintf(&flags, "-j --jobserver-auth=%d,%d%s%s", js.fds[0], js.fds[1],
+			makeflags != NULL && *makeflags != '\0' ? " " : "", makeflags != NULL ? makeflags : "") == -1) {
+		syslog(LOG_ERR, "Can't allocate MAKEFLAGS: %m");
+		exit(EXIT_FAILURE);
+	}
+	vars_set("MAKEFLAGS", flags, VAR_EXPORT);
+	free(flags);
+	return 0;
+}
+
+/* stop jobserver, MAKEFLAGS is restored, makes still running keep their own pipe ends */
+void jobserver_stop()
+{
+	if (!jobserver_active())
+		return;
+	close(js.fds[0]);
+	close(js.fds[1]);
+	js.fds[0] = js.fds[1] = -1;
+	if (js.old_makeflags != NULL)
+		vars_set("MAKEFLAGS", js.old_makeflags, VAR_EXPORT);
+	else
+		vars_unset("MAKEFLAGS");
+	free(js.old_makeflags);
+	js.old_makeflags = NULL;
+}
+
+/* called when shell has no running or stopped job, tokens lost by killed makes come back */
+void jobserver_reclaim()
+{
+	size_t free_count;
+
+	if (!jobserver_active())
+		return;
+	if ((free_count = tokens_free()) < js.tokens)
+		top_up(free_count);
+}
+
+/* print "tokens in use/total" */
+void jobserver_output()
+{
+	if (!jobserver_active()) {
+		printf("jobserver: off\n");
+		return;
+	}
+	size_t free_count = tokens_free();
+	printf("jobserver: %zu/%zu tokens in use, fds %d,%d\n", free_count < js.tokens ? js.tokens - free_count : 0,
+		js.tokens, js.fds[0], js.fds[1]);
+}
@@ -0,0 +1,12 @@
+#ifndef NSPT_JOBSERVER
+#define NSPT_JOBSERVER
+
+#include <stddef.h>
+
+int jobserver_start(size_t tokens);
+void jobserver_stop();
+int jobserver_active();
+void jobserver_reclaim();
+void jobserver_output();
+
+#endif
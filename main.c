@@ -1,54 +1,206 @@
+#define _GNU_SOURCE
 #include <syslog.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <limits.h>
 #include "exec_cmd.h"
 #include "sh_env.h"
 #include "tools.h"
 #include "tty_ctl.h"
+#include "gap_buf.h"
+#include "history.h"
+#include "suggest.h"
+#include "prompt.h"
+#include "vars.h"
+#include "script_cache.h"
+#include "parse.h"
 
-#define CMD_MAX_LEN_GUESS     2048
-static char *cmd_buf = NULL;
-static long cmd_buf_len;
+#define CMD_BUF_ORIG_LEN      2048
+#define BATCH_CHUNK_LEN       65536
+#define HISTORY_FILE          ".nspt_history"
+static struct gap_buf cmd_line;
 
-static void cmd_buf_init()
+/* lines of batch input read so far of a command that continues on next line */
+static struct str_buf pending;
+
+/* history file is $HISTFILE, or HISTORY_FILE in home dir */
+static void history_open()
 {
-	assert(cmd_buf == NULL);
+	const char *histfile = vars_get("HISTFILE");
+	char *path;
+
+	if (histfile != NULL) {
+		history_init(histfile);
+		return;
+	}
+	if (asprintf(&path, "%s/%s", get_home_dir(), HISTORY_FILE) == -1) {
+		syslog(LOG_ERR, "Can't allocate history file path: %m");
+		exit(EXIT_FAILURE);
+	}
+	history_init(path);
+	free(path);
+}
 
-	/*Init command buffer*/
-	errno = 0;
-	if ((cmd_buf_len = sysconf(_SC_LINE_MAX)) == -1) {
-		if (errno != 0) {
-			syslog(LOG_ERR, "Can't get limit: _SC_LINE_MAX: %m");
+static void sh_init(int interactive)
+{
+	if (interactive) {
+		/*line buffer starts small, grows with long lines and shrinks back after each command*/
+		gap_buf_init(&cmd_line, CMD_BUF_ORIG_LEN);
+		tty_init();
+	}
+	vars_init();
+	env_init(interactive);
+	if (interactive) {
+		history_open();
+		suggest_init();
+	}
+}
+
+/* execute one line of batch input, a line that ends inside a command (if, while, a quote ...)
+ * is kept, and lines are added to it until they complete the command, which runs then
+ */
+static void do_batch_line(char *line, size_t length)
+{
+	int complete;
+
+	if (pending.len == 0) {
+		if ((line = batch_line_text(line, length)) != NULL && run_input(line, 1) == PARSE_INCOMPLETE)
+			str_buf_append(&pending, line, strlen(line));
+		return;
+	}
+	if (length > 0 && line[length - 1] == '\r')
+		line[--length] = '\0';
+	complete = parse_may_complete(line);
+	str_buf_append(&pending, "\n", 1);
+	str_buf_append(&pending, line, length);
+	if (complete && run_input(pending.data, 1) != PARSE_INCOMPLETE)
+		pending.len = 0;
+}
+
+/* run what is left of batch input at its end, a command it ends inside of is a syntax error */
+static void end_batch()
+{
+	if (pending.len > 0) {
+		run_input(pending.data, 0);
+		pending.len = 0;
+	}
+}
+
+/* run commands read from fd until EOF
+ * input is read in BATCH_CHUNK_LEN chunks, complete lines are executed in place,
+ * an incomplete tail is moved to the head of buffer before next read,
+ * buffer grows when a single line is longer than it
+ */
+static void run_batch(int fd)
+{
+	char *buf, *line, *nl;
+	size_t buf_len = BATCH_CHUNK_LEN, data_len = 0, scan_idx = 0;
+	ssize_t read_ret;
+
+	if ((buf = malloc(buf_len + 1)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate batch input buffer: %m");
+		exit(EXIT_FAILURE);
+	}
+
+	while (1) {
+		if (data_len == buf_len) {
+			buf_len *= 2;
+			if ((buf = realloc(buf, buf_len + 1)) == NULL) {
+				syslog(LOG_ERR, "Can't reallocate batch input buffer: %m");
+				exit(EXIT_FAILURE);
+			}
+		}
+		read_ret = read(fd, buf + data_len, buf_len - data_len);
+		if (read_ret < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "Can't read batch input: %m");
 			exit(EXIT_FAILURE);
 		}
-		cmd_buf_len = CMD_MAX_LEN_GUESS;
+		if (read_ret == 0)
+			break;
+		data_len += read_ret;
+
+		line = buf;
+		while ((nl = memchr(buf + scan_idx, '\n', data_len - scan_idx)) != NULL) {
+			*nl = '\0';
+			do_batch_line(line, nl - line);
+			line = nl + 1;
+			scan_idx = line - buf;
+		}
+		data_len -= line - buf;
+		memmove(buf, line, data_len);
+		scan_idx = data_len;
 	}
-	if ((cmd_buf = malloc(cmd_buf_len)) == NULL) {
-		syslog(LOG_ERR, "Can't allocate command buffer: %m");
-		exit(EXIT_FAILURE);
+
+	if (data_len > 0) { //last line without '\n'
+		buf[data_len] = '\0';
+		do_batch_line(buf, data_len);
 	}
+	end_batch();
+	free(buf);
 }
 
-static void sh_init()
+static void usage()
 {
-	cmd_buf_init();
-	tty_init();
-	env_init();
+	fprintf(stderr, "usage: nspt_sh [--no-script-cache] [-c command [name [arg...]] | script [arg...]]\n");
+	exit(2);
 }
 
 int main(int argc, char *argv[])
 {
-	int read_err;
+	int read_err, script_fd, arg = 1, use_cache = 1;
+
+	if (argc > arg && strcmp(argv[arg], "--no-script-cache") == 0) {
+		use_cache = 0;
+		arg++;
+	}
+	if (argc > arg) {
+		sh_init(0);
+		if (strcmp(argv[arg], "-c") == 0) {
+			if (argc < arg + 2)
+				usage();
+			if (argc > arg + 2)
+				vars_set_arg0(argv[arg + 2]);
+			if (argc > arg + 3)
+				vars_set_params(argv + arg + 3, argc - arg - 3);
+			do_cmd(argv[arg + 1]);
+		} else {
+			vars_set_arg0(argv[arg]);
+			vars_set_params(argv + arg + 1, argc - arg - 1);
+			if ((script_fd = open(argv[arg], O_RDONLY | O_CLOEXEC)) == -1) {
+				fprintf(stderr, "nspt_sh: %s: %s\n", argv[arg], strerror(errno));
+				exit(127);
+			}
+			if (!use_cache || script_cache_run(argv[arg], script_fd) != 0)
+				run_batch(script_fd);
+			close(script_fd);
+		}
+		return get_last_status();
+	}
+
+	if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+		sh_init(0);
+		run_batch(STDIN_FILENO);
+		return get_last_status();
+	}
 
-	sh_init();
+	sh_init(1);
 	while(1) {
-		get_cmd(cmd_buf, cmd_buf_len, &read_err);
+		get_cmd(&cmd_line, &read_err);
 		if (read_err)
 			break;
-		do_cmd(cmd_buf);
+		history_add(gap_buf_text(&cmd_line), gap_buf_len(&cmd_line));
+		suggest_add(gap_buf_text(&cmd_line), gap_buf_len(&cmd_line));
+		prompt_command_start();
+		do_cmd(gap_buf_text(&cmd_line));
+		prompt_command_end();
+		gap_buf_clear(&cmd_line);
 	}
-	return 0;
+	return get_last_status();
 }
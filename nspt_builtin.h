@@ -0,0 +1,17 @@
+#ifndef NSPT_BUILTIN
+#define NSPT_BUILTIN
+
+/* ABI of builtins loaded with "enable -f lib.so name"
+ * lib.so exports "const struct nspt_builtin name_builtin", abi must be NSPT_BUILTIN_ABI,
+ * func runs in shell process, it reads in_fd and writes out_fd (don't close them),
+ * it returns the exit status of command
+ */
+#define NSPT_BUILTIN_ABI 1
+
+struct nspt_builtin {
+	int abi;
+	const char *name;
+	int (*func)(char **argv, int in_fd, int out_fd);
+};
+
+#endif
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "exec_cmd.h"
+#include "sh_env.h"
+#include "signal_handler.h"
+#include "tools.h"
+#include "vars.h"
+
+#define COPY_BUF_LEN 65536
+
+/* a slot runs one item at a time, its output is collected in out_fd and copied to stdout
+ * in one piece when the item has exited, so outputs of items never interleave
+ * memory is per slot, items are read one at a time as slots free up
+ */
+struct slot {
+	int busy;               //holds an item whose output hasn't been flushed
+	int done;               //item has exited, status is valid
+	int status;
+	int out_fd;             //-1 if output is ungrouped
+	struct timespec start;
+	struct str_buf cmd;
+};
+
+struct item_source {
+	char **args;            //items from arguments, NULL if they are read from in
+	FILE *in;
+	char *line;
+	size_t line_cap;
+};
+
+/* state of one parallel_run() call, an item may run parallel again in its forked shell */
+struct parallel {
+	struct slot *slots;
+	struct job_state *states; //interest list for update_job_state(), pgid is 0 if slot has no job running
+	size_t slot_count, running;
+	int flags;
+	unsigned long next_item, flush_item, failed;
+	double job_secs, job_secs_max;
+};
+
+static double secs_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* next command line, blank lines are skipped, NULL when items run out */
+static const char *next_item(struct item_source *src)
+{
+	ssize_t len;
+	const char *p;
+
+	if (src->args != NULL)
+		return *src->args != NULL ? *src->args++ : NULL;
+	while ((len = getline(&src->line, &src->line_cap, src->in)) != -1) {
+		if (len > 0 && src->line[len - 1] == '\n')
+			src->line[--len] = '\0';
+		for (p = src->line; *p == ' ' || *p == '\t'; ++p);
+		if (*p != '\0')
+			return src->line;
+	}
+	return NULL;
+}
+
+/* slot next item goes to, NULL if none is free
+ * with keep order item n always goes to slot n % slot_count, so finished items wait at most
+ * one round for the ones before them and memory stays bounded
+ */
+static struct slot *free_slot(struct parallel *par)
+{
+	if (par->flags & PARALLEL_KEEP_ORDER) {
+		struct slot *slot = &par->slots[par->next_item % par->slot_count];
+		return slot->busy ? NULL : slot;
+	}
+	for (size_t i = 0; i < par->slot_count; ++i) {
+		if (!par->slots[i].busy)
+			return &par->slots[i];
+	}
+	return NULL;
+}
+
+static void finish_item(struct parallel *par, struct slot *slot, int status)
+{
+	double secs = secs_since(&slot->start);
+
+	slot->done = 1;
+	slot->status = status;
+	par->job_secs += secs;
+	if (secs > par->job_secs_max)
+		par->job_secs_max = secs;
+}
+
+static void start_item(struct parallel *par, struct slot *slot, const char *cmd, int save_stdout)
+{
+	size_t idx = slot - par->slots;
+	pid_t pgid;
+
+	slot->busy = 1;
+	slot->done = 0;
+	par->next_item++;
+	slot->cmd.len = 0;
+	str_buf_append(&slot->cmd, cmd, strlen(cmd));
+	clock_gettime(CLOCK_MONOTONIC, &slot->start);
+
+	if (slot->out_fd != -1)
+		dup2(slot->out_fd, STDOUT_FILENO);
+	pgid = launch_quiet_job(cmd);
+	if (slot->out_fd != -1)
+		dup2(save_stdout, STDOUT_FILENO);
+
+	if (pgid == 0) { //nothing to launch, or couldn't be launched
+		finish_item(par, slot, get_last_status());
+		return;
+	}
+	par->states[idx].pgid = pgid;
+	par->running++;
+}
+
+/* copy output of slot to stdout and free slot */
+static void flush_slot(struct parallel *par, struct slot *slot)
+{
+	static char buf[COPY_BUF_LEN];
+	ssize_t len, written;
+	off_t off = 0;
+
+	if (slot->out_fd != -1) {
+		while ((len = pread(slot->out_fd, buf, sizeof(buf), off)) > 0) {
+			off += len;
+			for (char *p = buf; len > 0; p += written, len -= written) {
+				if ((written = write(STDOUT_FILENO, p, len)) < 0) {
+					if (errno == EINTR) {
+						written = 0;
+						continue;
+					}
+					len = 0; //reader is gone, output of item is dropped
+				}
+			}
+		}
+		if (ftruncate(slot->out_fd, 0) != 0)
+			syslog(LOG_ERR, "Can't truncate parallel output file: %m");
+	}
+	if (slot->status != 0) {
+		par->failed++;
+		fprintf(stderr, "parallel: exit %d: %s\n", slot->status, slot->cmd.data);
+	}
+	slot->busy = 0;
+	slot->done = 0;
+}
+
+/* flush finished items, in item order with keep order */
+static void flush_done(struct parallel *par)
+{
+	struct slot *slot;
+
+	if (!(par->flags & PARALLEL_KEEP_ORDER)) {
+		for (size_t i = 0; i < par->slot_count; ++i) {
+			if (par->slots[i].done)
+				flush_slot(par, &par->slots[i]);
+		}
+		return;
+	}
+	while (par->flush_item < par->next_item && (slot = &par->slots[par->flush_item % par->slot_count])->done) {
+		flush_slot(par, slot);
+		par->flush_item++;
+	}
+}
+
+/* reap exited items, wait for SIGCHLD if none has exited */
+static void reap_items(struct parallel *par)
+{
+	struct pollfd chld_poll = {sigchld_fd, POLLIN, 0};
+	int reaped = 0;
+
+	while (1) {
+		update_job_state(0, par->states, par->slot_count);
+		for (size_t i = 0; i < par->slot_count; ++i) {
+			if (par->states[i].pgid == 0 || par->states[i].state != 'e')
+				continue;
+			finish_item(par, &par->slots[i], get_pipefail() ? par->states[i].pipefail_status : par->states[i].status);
+			set_bg_job(par->states[i].pgid, NULL, BG_RM);
+			par->states[i].pgid = 0;
+			par->running--;
+			reaped = 1;
+		}
+		if (reaped)
+			return;
+		if (poll(&chld_poll, 1, -1) == -1 && errno != EINTR) {
+			syslog(LOG_ERR, "Can't poll sigchld_fd: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* temporary file collecting output of one slot, it has no name and goes away when closed */
+static int open_output_file()
+{
+	const char *dir = vars_get("TMPDIR") != NULL ? vars_get("TMPDIR") : "/tmp";
+	char path[PATH_MAX];
+	int fd;
+
+	if ((fd = open(dir, O_TMPFILE | O_RDWR | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR)) != -1)
+		return fd;
+	snprintf(path, sizeof(path), "%s/nspt_parallel.XXXXXX", dir); //fs without O_TMPFILE
+	if ((fd = mkostemp(path, O_APPEND | O_CLOEXEC)) != -1)
+		unlink(path);
+	return fd;
+}
+
+/* run command lines cmds (or lines of stdin if cmds is NULL) as background jobs,
+ * at most jobs of them at a time, the next one starts as soon as one exits
+ * items get /dev/null as stdin, a summary of failures and timings goes to stderr
+ * return 0 if all items succeeded, 1 if some failed, -1 on error
+ */
+int parallel_run(char **cmds, size_t jobs, int flags)
+{
+	struct item_source src = {cmds, NULL, NULL, 0};
+	struct parallel par;
+	struct timespec start;
+	sigset_t chld_mask, old_mask;
+	int save_stdin, save_stdout = -1, null_fd, result = -1;
+	const char *cmd;
+
+	memset(&par, 0, sizeof(par));
+	par.flags = flags;
+	par.slot_count = jobs;
+	if ((par.slots = calloc(jobs, sizeof(struct slot))) == NULL || (par.states = calloc(jobs, sizeof(struct job_state))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate parallel slots: %m");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < jobs; ++i)
+		par.slots[i].out_fd = -1;
+	for (size_t i = 0; i < jobs; ++i) {
+		if (!(flags & PARALLEL_UNGROUPED) && (par.slots[i].out_fd = open_output_file()) == -1) {
+			fprintf(stderr, "parallel: can't create output file: %s\n", strerror(errno));
+			goto free_and_return;
+		}
+	}
+
+	if ((null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1) {
+		fprintf(stderr, "parallel: /dev/null: %s\n", strerror(errno));
+		goto free_and_return;
+	}
+	save_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	if (cmds == NULL && (src.in = fdopen(fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0), "r")) == NULL) {
+		fprintf(stderr, "parallel: can't read stdin: %s\n", strerror(errno));
+		close(null_fd);
+		close(save_stdin);
+		goto free_and_return;
+	}
+	dup2(null_fd, STDIN_FILENO);
+	close(null_fd);
+	fflush(stdout);
+	if (!(flags & PARALLEL_UNGROUPED))
+		save_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	//SIGCHLD is blocked in shell already, but not in a forked pipe stage
+	sigemptyset(&chld_mask);
+	sigaddset(&chld_mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld_mask, &old_mask);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (1) {
+		struct slot *slot;
+		int more = 1;
+
+		while ((slot = free_slot(&par)) != NULL) {
+			if ((cmd = next_item(&src)) == NULL) {
+				more = 0;
+				break;
+			}
+			start_item(&par, slot, cmd, save_stdout);
+		}
+		if (par.running > 0)
+			reap_items(&par);
+		flush_done(&par);
+		if (!more && par.running == 0) //everything has exited and been flushed
+			break;
+	}
+
+	fprintf(stderr, "parallel: %lu jobs, %lu failed, wall %.2fs, job avg %.3fs max %.3fs\n", par.next_item, par.failed,
+		secs_since(&start), par.next_item > 0 ? par.job_secs / par.next_item : 0.0, par.job_secs_max);
+	result = par.failed != 0;
+
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	if (save_stdout != -1)
+		close(save_stdout);
+	dup2(save_stdin, STDIN_FILENO);
+	close(save_stdin);
+	if (src.in != NULL)
+		fclose(src.in);
+	free(src.line);
+
+free_and_return:
+	for (size_t i = 0; i < jobs; ++i) {
+		if (par.slots[i].out_fd != -1)
+			close(par.slots[i].out_fd);
+		free(par.slots[i].cmd.data);
+	}
+	free(par.slots);
+	free(par.states);
+	return result;
+}
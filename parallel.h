@@ -0,0 +1,11 @@
+#ifndef NSPT_PARALLEL
+#define NSPT_PARALLEL
+
+#include <stddef.h>
+
+#define PARALLEL_KEEP_ORDER 1   //output of items in the order they were given
+#define PARALLEL_UNGROUPED  2   //items write to stdout directly
+
+int parallel_run(char **cmds, size_t jobs, int flags);
+
+#endif
@@ -0,0 +1,1116 @@
+#include "parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <assert.h>
+#include <ctype.h>
+#include "scan.h"
+#include "vars.h"
+
+/* command line is lexed and parsed in one pass over a single copy of it in the arena,
+ * quotes and escapes are removed in place, unquoted text never grows, so every word
+ * is a pointer into that copy and nothing else is copied
+ */
+enum token_type {
+	TOK_WORD,
+	TOK_PIPE,
+	TOK_AMP,
+	TOK_LESS,
+	TOK_GREAT,
+	TOK_DGREAT,
+	TOK_OR,
+	TOK_AND,
+	TOK_SEMI,
+	TOK_DSEMI,
+	TOK_LPAREN,
+	TOK_RPAREN,
+	TOK_NEWLINE,
+	TOK_END,
+	TOK_ERROR
+};
+
+struct token {
+	enum token_type type;
+	char *text;  //word with quotes removed, '\0' terminated
+	int quoted;  //word had quotes, escapes or expansions, so it is never a keyword
+	int expand;  //word holds expansion markers
+	size_t plain_len; //length of text before first quote, escape or expansion
+	size_t refs;      //number of $NAME (and other parameter) expansions in it
+	size_t start;     //offset of token in input
+};
+
+static int quiet;  //syntax errors aren't reported, see parse_set_quiet()
+
+struct lexer {
+	char *pos;
+	char held;       //operator char (or newline) overwritten by '\0' that ended the word before it
+	int more;        //more input may follow, running out of it inside a quote isn't an error then
+	int incomplete;  //ran out of input inside a quote
+	char quote;      //quote it ran out inside, '(' for a $( ) substitution, 0 after a backslash
+};
+
+/* what more input must hold for the last input found incomplete to be complete,
+ * so batch input doesn't parse a long compound command again for each of its lines:
+ * a closing keyword of the innermost compound command open at its end, or the quote char,
+ * NULL if any input may complete it, see parse_may_complete()
+ */
+static const char *need;
+static char need_quote[2];
+
+static int is_operator(char ch)
+{
+	return ch == '|' || ch == '&' || ch == '<' || ch == '>' || ch == ';' || ch == '(' || ch == ')';
+}
+
+static int is_blank(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+static char peek(const struct lexer *lx)
+{
+	return lx->held ? lx->held : *lx->pos;
+}
+
+static void advance(struct lexer *lx)
+{
+	lx->held = 0;
+	lx->pos++;
+}
+
+/* move length bytes at lx->pos down to out, nothing moves until quotes or escapes have been removed */
+static char *take(struct lexer *lx, char *out, size_t length)
+{
+	if (out != lx->pos)
+		memmove(out, lx->pos, length);
+	lx->pos += length;
+	return out + length;
+}
+
+static int is_marker(char ch)
+{
+	return ch >= CTL_VAR && ch <= CTL_QSUB;
+}
+
+/* '$' followed by ch starts an expansion, otherwise it is literal */
+static int starts_expansion(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_'
+		|| ch == '{' || ch == '?' || ch == '$' || ch == '(' || ch == '#' || ch == '@' || ch == '*';
+}
+
+/* copy text of command substitution at lx->pos (just past "$(" or '`') down to out as it is,
+ * it is parsed when the word is expanded, closing ')' or '`' becomes CTL_END
+ * nested parens and quotes are skipped, inside backquotes \`, \\ and \$ lose the backslash
+ * return new out, NULL if substitution isn't terminated, which has been reported
+ */
+static char *take_subst(struct lexer *lx, struct token *tok, char *out, char marker, int backquoted)
+{
+	char quote = 0, ch;
+	int depth = 0;
+
+	tok->quoted = 1;
+	tok->expand = 1;
+	*out++ = marker;
+	while ((ch = *lx->pos) != '\0') {
+		lx->pos++;
+		if (is_marker(ch))
+			continue;
+		if (backquoted) {
+			if (ch == '`') {
+				*out++ = CTL_END;
+				return out;
+			}
+			if (ch == '\\' && *lx->pos != '\0' && strchr("`\\$", *lx->pos) != NULL)
+				ch = *lx->pos++;
+		} else if (quote == '\'') {
+			if (ch == '\'')
+				quote = 0;
+		} else if (ch == '\\' && *lx->pos != '\0') {
+			*out++ = ch;
+			ch = *lx->pos++;
+		} else if (quote == '"') {
+			if (ch == '"')
+				quote = 0;
+		} else if (ch == '\'' || ch == '"') {
+			quote = ch;
+		} else if (ch == '(') {
+			depth++;
+		} else if (ch == ')' && depth-- == 0) {
+			*out++ = CTL_END;
+			return out;
+		}
+		*out++ = ch;
+	}
+	if (lx->more) {
+		lx->incomplete = 1;
+		lx->quote = backquoted ? '`' : '(';
+	} else if (!quiet) {
+		fprintf(stderr, "nspt_sh: syntax error: unterminated command substitution\n");
+	}
+	return NULL;
+}
+
+/* store marker (or '$' itself) for the '$' lexer has just passed,
+ * *name is set to where a $NAME starts in out, see end_name()
+ * return new out, NULL on unterminated substitution
+ */
+static char *take_dollar(struct lexer *lx, struct token *tok, char *out, char marker, char **name)
+{
+	if (!starts_expansion(*lx->pos)) {
+		*out++ = '$';
+		return out;
+	}
+	if (*lx->pos == '(') {
+		lx->pos++;
+		return take_subst(lx, tok, out, marker == CTL_VAR ? CTL_SUB : CTL_QSUB, 0);
+	}
+	tok->quoted = 1;
+	tok->expand = 1;
+	tok->refs++;
+	*out++ = marker;
+	if (*lx->pos == '_' || isalpha((unsigned char)*lx->pos))
+		*name = out;
+	else if (*lx->pos == '$') //$$, scan would stop at the second '$'
+		*out++ = *lx->pos++;
+	return out;
+}
+
+/* called after a quote or backslash has been dropped, so out has room for one more byte:
+ * if a $NAME runs up to out, close it, or text coming from the quotes would join the name
+ */
+static char *end_name(char *out, char **name)
+{
+	char *p = *name;
+
+	if (p == NULL)
+		return out;
+	*name = NULL;
+	while (p < out && (*p == '_' || isalnum((unsigned char)*p)))
+		p++;
+	if (p == out)
+		*out++ = CTL_END;
+	return out;
+}
+
+/* word starting at lx->pos, quotes and escapes are removed while copying down in place,
+ * plain runs are found by scan_word_end() and quoted runs by strcspn(), then moved in one go
+ * a '$' starting an expansion is replaced by a marker, which is expanded before the command runs
+ */
+static void lex_word(struct lexer *lx, struct token *tok)
+{
+	char *out = lx->pos, *plain_end = NULL, *name = NULL, ch;
+
+	tok->type = TOK_WORD;
+	tok->text = out;
+	tok->quoted = 0;
+	tok->expand = 0;
+	tok->refs = 0;
+	while (1) {
+		out = take(lx, out, scan_word_end(lx->pos));
+		if ((ch = *lx->pos) == '\0' || ch == '\n' || is_blank(ch) || is_operator(ch))
+			break;
+		lx->pos++;
+		if (plain_end == NULL && ch != '$')
+			plain_end = out;
+		if (ch == '\'' || ch == '"' || ch == '\\')
+			out = end_name(out, &name);
+		if (ch == '\'') {
+			tok->quoted = 1;
+			out = take(lx, out, strcspn(lx->pos, "'"));
+			if (*lx->pos == '\0') {
+				lx->quote = '\'';
+				goto unterminated;
+			}
+			lx->pos++;
+		} else if (ch == '"') {
+			tok->quoted = 1;
+			while (1) {
+				out = take(lx, out, strcspn(lx->pos, "\"\\$`"));
+				if (*lx->pos == '"') {
+					out = end_name(out, &name);
+					break;
+				}
+				if (*lx->pos == '\0') {
+					lx->quote = '"';
+					goto unterminated;
+				}
+				if (*lx->pos == '$' || *lx->pos == '`') {
+					ch = *lx->pos++;
+					out = ch == '$' ? take_dollar(lx, tok, out, CTL_QVAR, &name) : take_subst(lx, tok, out, CTL_QSUB, 1);
+					if (out == NULL)
+						goto error;
+					continue;
+				}
+				if (strchr("\"\\$`", lx->pos[1]) != NULL && lx->pos[1] != '\0') { //escape inside double quotes
+					lx->pos++;
+					out = end_name(out, &name);
+				}
+				*out++ = *lx->pos++;
+			}
+			lx->pos++;
+		} else if (ch == '\\') {
+			if (*lx->pos == '\n') { //line continues
+				lx->pos++;
+				continue;
+			}
+			if (*lx->pos == '\0' && lx->more) {
+				lx->incomplete = 1;
+				lx->quote = 0;
+				goto error;
+			}
+			tok->quoted = 1;
+			if (*lx->pos != '\0')
+				*out++ = *lx->pos++;
+		} else if (ch == '$') {
+			if (plain_end == NULL && starts_expansion(*lx->pos))
+				plain_end = out;
+			if ((out = take_dollar(lx, tok, out, CTL_VAR, &name)) == NULL)
+				goto error;
+		} else if (ch == '`') {
+			if ((out = take_subst(lx, tok, out, CTL_SUB, 1)) == NULL)
+				goto error;
+		} else if (!is_marker(ch)) {
+			*out++ = ch; //control byte, marker bytes are dropped so they can't be taken for an expansion
+		}
+	}
+	tok->plain_len = (plain_end != NULL ? plain_end : out) - tok->text;
+
+	if (out == lx->pos && *lx->pos != '\0') { //terminating '\0' goes over the char that ended word
+		if (is_operator(*lx->pos) || *lx->pos == '\n')
+			lx->held = *lx->pos;
+		else
+			lx->pos++;
+		*out = '\0';
+		return;
+	}
+	*out = '\0';
+	return;
+
+unterminated:
+	if (lx->more)
+		lx->incomplete = 1;
+	else if (!quiet)
+		fprintf(stderr, "nspt_sh: syntax error: unterminated quote\n");
+error:
+	tok->type = TOK_ERROR;
+}
+
+static void next_token(struct lexer *lx, struct token *tok)
+{
+	char ch;
+
+	if (peek(lx) == '#') { //comment runs to end of line
+		while (peek(lx) != '\0' && peek(lx) != '\n')
+			advance(lx);
+	}
+	tok->text = NULL;
+	tok->quoted = 0;
+	switch (ch = peek(lx)) {
+		case '\0':
+			tok->type = TOK_END;
+			return;
+		case '\n':
+			tok->type = TOK_NEWLINE;
+			break;
+		case '|':
+		case '&':
+		case ';':
+			advance(lx);
+			if (*lx->pos == ch) {
+				tok->type = ch == '|' ? TOK_OR : ch == '&' ? TOK_AND : TOK_DSEMI;
+				break;
+			}
+			tok->type = ch == '|' ? TOK_PIPE : ch == '&' ? TOK_AMP : TOK_SEMI;
+			return;
+		case '(':
+			tok->type = TOK_LPAREN;
+			break;
+		case ')':
+			tok->type = TOK_RPAREN;
+			break;
+		case '<':
+			tok->type = TOK_LESS;
+			break;
+		case '>':
+			advance(lx);
+			if (*lx->pos == '>') {
+				tok->type = TOK_DGREAT;
+				break;
+			}
+			tok->type = TOK_GREAT;
+			return;
+		default:
+			lex_word(lx, tok);
+			return;
+	}
+	advance(lx);
+}
+
+/* commands are parsed by recursive descent with one token of lookahead in tok,
+ * a failed parse sets status and every caller returns as soon as it sees it
+ */
+struct parser {
+	struct arena *arena;
+	struct lexer lx;
+	struct token tok;
+	const char *input;  //input as it came, lexer works on a copy at base, offsets in both agree
+	char *base;
+	int status;         //0, -1 on syntax error, PARSE_INCOMPLETE if more input may complete it
+	const char *closer; //keyword closing the innermost compound command being parsed, NULL outside
+};
+
+/* input ran out, record what more of it must hold */
+static void set_incomplete(struct parser *p)
+{
+	p->status = PARSE_INCOMPLETE;
+	need = p->closer;
+	if (p->lx.incomplete && p->lx.quote == '(') {
+		need = NULL;
+	} else if (p->lx.incomplete && p->lx.quote != 0) {
+		need_quote[0] = p->lx.quote;
+		need = need_quote;
+	}
+}
+
+static void next(struct parser *p)
+{
+	while (1) {
+		if (is_blank(peek(&p->lx)))
+			advance(&p->lx);
+		else if (p->lx.held == 0 && p->lx.pos[0] == '\\' && p->lx.pos[1] == '\n') //line continues
+			p->lx.pos += 2;
+		else
+			break;
+	}
+	p->tok.start = p->lx.pos - p->base;
+	next_token(&p->lx, &p->tok);
+	if (p->tok.type == TOK_ERROR && p->status == 0) {
+		if (p->lx.incomplete)
+			set_incomplete(p);
+		else
+			p->status = -1;
+	}
+}
+
+static const char *token_name(const struct token *tok)
+{
+	static const char *names[] = {"word", "|", "&", "<", ">", ">>", "||", "&&", ";", ";;", "(", ")", "newline", "end of file", "error"};
+	return tok->type == TOK_WORD ? tok->text : names[tok->type];
+}
+
+/* syntax error at current token, running out of input is only one if no more may follow */
+static void fail(struct parser *p)
+{
+	if (p->status != 0)
+		return;
+	if (p->tok.type == TOK_END && p->lx.more) {
+		set_incomplete(p);
+		return;
+	}
+	p->status = -1;
+	if (quiet)
+		return;
+	if (p->tok.type == TOK_END)
+		fprintf(stderr, "nspt_sh: syntax error: unexpected end of file\n");
+	else
+		fprintf(stderr, "nspt_sh: syntax error near unexpected token `%s'\n", token_name(&p->tok));
+}
+
+static int is_keyword(const struct token *tok, const char *word)
+{
+	return tok->type == TOK_WORD && !tok->quoted && strcmp(tok->text, word) == 0;
+}
+
+/* a list ends at a token no command starts with: end of input, ')', ";;" or a keyword
+ * that closes a compound command
+ */
+static int ends_list(const struct token *tok)
+{
+	static const char *closers[] = {"then", "else", "elif", "fi", "do", "done", "esac", "}", NULL};
+
+	if (tok->type == TOK_END || tok->type == TOK_RPAREN || tok->type == TOK_DSEMI || tok->type == TOK_ERROR)
+		return 1;
+	for (size_t i = 0; closers[i] != NULL; ++i) {
+		if (is_keyword(tok, closers[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static void skip_newlines(struct parser *p)
+{
+	while (p->tok.type == TOK_NEWLINE)
+		next(p);
+}
+
+/* source text from offset start up to current token, trailing blanks dropped */
+static const char *source_text(struct parser *p, size_t start)
+{
+	size_t end = p->tok.start;
+
+	while (end > start && (is_blank(p->input[end - 1]) || p->input[end - 1] == '\n'))
+		end--;
+	return arena_strndup(p->arena, p->input + start, end - start);
+}
+
+static struct node *new_node(struct parser *p, enum node_type type)
+{
+	struct node *node = arena_alloc(p->arena, sizeof(struct node));
+
+	memset(node, 0, sizeof(struct node));
+	node->type = type;
+	return node;
+}
+
+/* words and stages are collected in lists first, they become arrays once their count is known */
+struct word_node {
+	char *word;
+	struct word_node *next;
+};
+
+struct stage_node {
+	struct command cmd;
+	struct stage_node *next;
+};
+
+static char *no_words[] = {NULL};
+
+static char **word_array(struct arena *arena, struct word_node *words, size_t count)
+{
+	char **array;
+
+	if (count == 0)
+		return no_words;
+	array = arena_alloc(arena, (count + 1) * sizeof(char *));
+	for (size_t i = 0; i < count; ++i, words = words->next)
+		array[i] = words->word;
+	array[count] = NULL;
+	return array;
+}
+
+static void add_word(struct arena *arena, struct word_node ***tail, char *word)
+{
+	**tail = arena_alloc(arena, sizeof(struct word_node));
+	(**tail)->word = word;
+	(**tail)->next = NULL;
+	*tail = &(**tail)->next;
+}
+
+/* NAME=value, with NAME and '=' unquoted */
+static int is_assignment(const struct token *tok)
+{
+	size_t name_len = assign_name_len(tok->text);
+	return name_len > 0 && name_len < tok->plain_len;
+}
+
+static struct node *parse_list(struct parser *p);
+static int parse_command(struct parser *p, struct command *cmd, struct node **func);
+
+/* redirection at current token, added at *tail */
+static void parse_redirect(struct parser *p, struct command *cmd, struct redirect ***tail)
+{
+	int type = p->tok.type == TOK_LESS ? REDIR_IN : p->tok.type == TOK_GREAT ? REDIR_OUT : REDIR_APPEND;
+
+	next(p);
+	if (p->tok.type != TOK_WORD) {
+		fail(p);
+		return;
+	}
+	cmd->expand |= p->tok.expand;
+	**tail = arena_alloc(p->arena, sizeof(struct redirect));
+	(**tail)->type = type;
+	(**tail)->target = p->tok.text;
+	(**tail)->next = NULL;
+	*tail = &(**tail)->next;
+	next(p);
+}
+
+/* non-empty list closed by keyword closer, which is consumed */
+static struct node *parse_body(struct parser *p, const char *closer)
+{
+	struct node *list = parse_list(p);
+
+	if (p->status != 0)
+		return NULL;
+	if (list == NULL || !is_keyword(&p->tok, closer)) {
+		fail(p);
+		return NULL;
+	}
+	next(p);
+	return list;
+}
+
+/* if (or elif) at current token, up to and including "fi" */
+static struct node *parse_if(struct parser *p)
+{
+	struct node *node = new_node(p, NODE_IF);
+
+	p->closer = "fi";
+	next(p);
+	if ((node->cond = parse_body(p, "then")) == NULL)
+		return NULL;
+	node->body = parse_list(p);
+	if (p->status != 0)
+		return NULL;
+	if (node->body == NULL) {
+		fail(p);
+		return NULL;
+	}
+	if (is_keyword(&p->tok, "elif")) {
+		node->orelse = parse_if(p);
+		return node->orelse != NULL ? node : NULL;
+	}
+	if (is_keyword(&p->tok, "else")) {
+		next(p);
+		if ((node->orelse = parse_body(p, "fi")) == NULL)
+			return NULL;
+		return node;
+	}
+	if (!is_keyword(&p->tok, "fi")) {
+		fail(p);
+		return NULL;
+	}
+	next(p);
+	return node;
+}
+
+/* while or until at current token */
+static struct node *parse_loop(struct parser *p)
+{
+	struct node *node = new_node(p, is_keyword(&p->tok, "while") ? NODE_WHILE : NODE_UNTIL);
+
+	p->closer = "done";
+	next(p);
+	if ((node->cond = parse_body(p, "do")) == NULL || (node->body = parse_body(p, "done")) == NULL)
+		return NULL;
+	return node;
+}
+
+/* for NAME [in word...] do list done */
+static struct node *parse_for(struct parser *p)
+{
+	struct node *node = new_node(p, NODE_FOR);
+	struct word_node *words = NULL, **tail = &words;
+	size_t count = 0;
+
+	p->closer = "done";
+	next(p);
+	if (p->tok.type != TOK_WORD || p->tok.quoted || !is_var_name(p->tok.text, strlen(p->tok.text))) {
+		fail(p);
+		return NULL;
+	}
+	node->name = p->tok.text;
+	next(p);
+	skip_newlines(p);
+	if (is_keyword(&p->tok, "in")) {
+		for (next(p); p->tok.type == TOK_WORD; next(p), count++)
+			add_word(p->arena, &tail, p->tok.text);
+		node->words = word_array(p->arena, words, count);
+		if (p->tok.type != TOK_SEMI && p->tok.type != TOK_NEWLINE) {
+			fail(p);
+			return NULL;
+		}
+		next(p);
+	} else if (p->tok.type == TOK_SEMI) {
+		next(p);
+	}
+	skip_newlines(p);
+	if (!is_keyword(&p->tok, "do")) {
+		fail(p);
+		return NULL;
+	}
+	next(p);
+	return (node->body = parse_body(p, "done")) != NULL ? node : NULL;
+}
+
+/* case word in [(]pattern[|pattern]...) list;; ... esac */
+static struct node *parse_case(struct parser *p)
+{
+	struct node *node = new_node(p, NODE_CASE);
+	struct case_item **item_tail = &node->items, *item;
+	struct word_node *patterns, **tail;
+	size_t count;
+
+	p->closer = "esac";
+	next(p);
+	if (p->tok.type != TOK_WORD) {
+		fail(p);
+		return NULL;
+	}
+	node->name = p->tok.text;
+	next(p);
+	skip_newlines(p);
+	if (!is_keyword(&p->tok, "in")) {
+		fail(p);
+		return NULL;
+	}
+	next(p);
+	while (1) {
+		skip_newlines(p);
+		if (is_keyword(&p->tok, "esac"))
+			break;
+		if (p->tok.type == TOK_LPAREN)
+			next(p);
+		patterns = NULL;
+		tail = &patterns;
+		for (count = 0; p->tok.type == TOK_WORD;) {
+			add_word(p->arena, &tail, p->tok.text);
+			count++;
+			next(p);
+			if (p->tok.type != TOK_PIPE)
+				break;
+			next(p);
+		}
+		if (count == 0 || p->tok.type != TOK_RPAREN) {
+			fail(p);
+			return NULL;
+		}
+		next(p);
+		item = arena_alloc(p->arena, sizeof(struct case_item));
+		item->patterns = word_array(p->arena, patterns, count);
+		item->next = NULL;
+		item->body = parse_list(p);
+		if (p->status != 0)
+			return NULL;
+		*item_tail = item;
+		item_tail = &item->next;
+		if (p->tok.type == TOK_DSEMI) {
+			next(p);
+			continue;
+		}
+		if (!is_keyword(&p->tok, "esac")) {
+			fail(p);
+			return NULL;
+		}
+		break;
+	}
+	next(p);
+	return node;
+}
+
+/* compound command at current token, NULL if it doesn't start one (or on error) */
+static struct node *parse_compound(struct parser *p)
+{
+	const char *closer = p->closer;
+	struct node *node = NULL;
+
+	if (is_keyword(&p->tok, "{")) {
+		p->closer = "}";
+		next(p);
+		node = parse_body(p, "}");
+	} else if (is_keyword(&p->tok, "if")) {
+		node = parse_if(p);
+	} else if (is_keyword(&p->tok, "while") || is_keyword(&p->tok, "until")) {
+		node = parse_loop(p);
+	} else if (is_keyword(&p->tok, "for")) {
+		node = parse_for(p);
+	} else if (is_keyword(&p->tok, "case")) {
+		node = parse_case(p);
+	}
+	p->closer = closer;
+	return node;
+}
+
+static int starts_compound(const struct token *tok)
+{
+	return is_keyword(tok, "{") || is_keyword(tok, "if") || is_keyword(tok, "while") || is_keyword(tok, "until")
+		|| is_keyword(tok, "for") || is_keyword(tok, "case");
+}
+
+/* NAME ( ) compound-command, current token is '(' after NAME */
+static struct node *parse_function(struct parser *p, char *name)
+{
+	struct node *node = new_node(p, NODE_FUNC);
+	struct command body;
+
+	next(p);
+	if (p->tok.type != TOK_RPAREN) {
+		fail(p);
+		return NULL;
+	}
+	next(p);
+	skip_newlines(p);
+	if (!starts_compound(&p->tok)) {
+		fail(p);
+		return NULL;
+	}
+	if (parse_command(p, &body, NULL) != 0)
+		return NULL;
+	node->name = name;
+	if (body.redirs == NULL) {
+		node->body = body.body;
+		return node;
+	}
+	node->body = new_node(p, NODE_PIPELINE); //redirections apply to every call
+	node->body->pl = arena_alloc(p->arena, sizeof(struct pipeline));
+	memset(node->body->pl, 0, sizeof(struct pipeline));
+	node->body->pl->stages = arena_alloc(p->arena, sizeof(struct command));
+	node->body->pl->stages[0] = body;
+	node->body->pl->count = 1;
+	node->body->pl->text = name;
+	return node;
+}
+
+/* command at current token into cmd: a simple command, or a compound command with its redirections
+ * if func isn't NULL, NAME() starts a function definition, which is returned in *func
+ * return 0 on success, -1 on error
+ */
+static int parse_command(struct parser *p, struct command *cmd, struct node **func)
+{
+	struct word_node *words = NULL, **word_tail = &words, *assigns = NULL, **assign_tail = &assigns;
+	struct redirect **redir_tail = &cmd->redirs;
+	size_t word_refs = 0;
+	int plain_name = 0;
+
+	memset(cmd, 0, sizeof(struct command));
+	if (func != NULL)
+		*func = NULL;
+	if (ends_list(&p->tok)) {
+		fail(p);
+		return -1;
+	}
+	if (starts_compound(&p->tok)) {
+		if ((cmd->body = parse_compound(p)) == NULL)
+			return -1;
+		cmd->argv = cmd->assigns = no_words;
+		while (p->status == 0 && (p->tok.type == TOK_LESS || p->tok.type == TOK_GREAT || p->tok.type == TOK_DGREAT))
+			parse_redirect(p, cmd, &redir_tail);
+		return p->status == 0 ? 0 : -1;
+	}
+
+	while (p->status == 0) {
+		if (p->tok.type == TOK_WORD) {
+			cmd->expand |= p->tok.expand;
+			if (cmd->argc == 0 && is_assignment(&p->tok)) {
+				add_word(p->arena, &assign_tail, p->tok.text);
+				cmd->assign_count++;
+				cmd->assign_refs += p->tok.refs;
+			} else {
+				if (cmd->argc == 0)
+					plain_name = !p->tok.expand;
+				add_word(p->arena, &word_tail, p->tok.text);
+				cmd->argc++;
+				word_refs += p->tok.refs;
+			}
+			next(p);
+		} else if (p->tok.type == TOK_LESS || p->tok.type == TOK_GREAT || p->tok.type == TOK_DGREAT) {
+			parse_redirect(p, cmd, &redir_tail);
+		} else if (p->tok.type == TOK_LPAREN && func != NULL && cmd->argc == 1 && cmd->assign_count == 0
+				&& cmd->redirs == NULL && plain_name && is_var_name(words->word, strlen(words->word))) {
+			*func = parse_function(p, words->word);
+			return *func != NULL ? 0 : -1;
+		} else {
+			break;
+		}
+	}
+	if (p->status != 0)
+		return -1;
+	if (cmd->argc == 0 && cmd->assign_count == 0 && cmd->redirs == NULL) {
+		fail(p);
+		return -1;
+	}
+	cmd->argv = word_array(p->arena, words, cmd->argc);
+	cmd->assigns = word_array(p->arena, assigns, cmd->assign_count);
+	if (plain_name) {
+		cmd->lookup = arena_alloc(p->arena, sizeof(struct lookup));
+		memset(cmd->lookup, 0, sizeof(struct lookup));
+	}
+	if ((cmd->ref_count = cmd->assign_refs + word_refs) > 0) {
+		cmd->refs = arena_alloc(p->arena, cmd->ref_count * sizeof(struct var_ref));
+		memset(cmd->refs, 0, cmd->ref_count * sizeof(struct var_ref));
+	}
+	return 0;
+}
+
+/* [!] [time] command [| command]..., or a function definition */
+static struct node *parse_pipeline(struct parser *p)
+{
+	struct node *node = new_node(p, NODE_PIPELINE), *func;
+	struct pipeline *pl = arena_alloc(p->arena, sizeof(struct pipeline));
+	struct stage_node *stages = NULL, **stage_tail = &stages, *stage;
+	size_t start = p->tok.start;
+
+	memset(pl, 0, sizeof(struct pipeline));
+	while (1) {
+		if (is_keyword(&p->tok, "!") && !pl->negate)
+			pl->negate = 1;
+		else if (is_keyword(&p->tok, "time") && !pl->timed)
+			pl->timed = 1;
+		else
+			break;
+		next(p);
+	}
+	while (1) {
+		stage = arena_alloc(p->arena, sizeof(struct stage_node));
+		stage->next = NULL;
+		if (parse_command(p, &stage->cmd, pl->count == 0 && !pl->negate && !pl->timed ? &func : NULL) != 0)
+			return NULL;
+		if (pl->count == 0 && !pl->negate && !pl->timed && func != NULL)
+			return func;
+		*stage_tail = stage;
+		stage_tail = &stage->next;
+		pl->count++;
+		if (p->tok.type != TOK_PIPE)
+			break;
+		next(p);
+		skip_newlines(p);
+	}
+
+	pl->stages = arena_alloc(p->arena, pl->count * sizeof(struct command));
+	for (size_t i = 0; i < pl->count; ++i, stages = stages->next)
+		pl->stages[i] = stages->cmd;
+	pl->text = source_text(p, start);
+	node->pl = pl;
+	return node;
+}
+
+static struct node *parse_and_or(struct parser *p)
+{
+	struct node *left, *node;
+
+	if ((left = parse_pipeline(p)) == NULL)
+		return NULL;
+	while (p->tok.type == TOK_AND || p->tok.type == TOK_OR) {
+		node = new_node(p, p->tok.type == TOK_AND ? NODE_AND : NODE_OR);
+		next(p);
+		skip_newlines(p);
+		node->cond = left;
+		if ((node->body = parse_pipeline(p)) == NULL)
+			return NULL;
+		left = node;
+	}
+	return left;
+}
+
+/* node wrapped in a pipeline of one compound stage, so it can run as a job of its own */
+static struct node *as_job(struct parser *p, struct node *node, const char *text)
+{
+	struct node *job = new_node(p, NODE_PIPELINE);
+
+	job->pl = arena_alloc(p->arena, sizeof(struct pipeline));
+	memset(job->pl, 0, sizeof(struct pipeline));
+	job->pl->stages = arena_alloc(p->arena, sizeof(struct command));
+	memset(job->pl->stages, 0, sizeof(struct command));
+	job->pl->stages[0].argv = job->pl->stages[0].assigns = no_words;
+	job->pl->stages[0].body = node;
+	job->pl->count = 1;
+	job->pl->text = text;
+	return job;
+}
+
+/* and-or lists separated by ';', '&' or newlines, up to a token that ends the list */
+static struct node *parse_list(struct parser *p)
+{
+	struct node *head = NULL, **tail = &head, *node;
+	size_t start;
+
+	while (1) {
+		skip_newlines(p);
+		if (p->status != 0 || ends_list(&p->tok))
+			return head;
+		start = p->tok.start;
+		if ((node = parse_and_or(p)) == NULL)
+			return NULL;
+		if (p->tok.type == TOK_AMP) {
+			if (node->type != NODE_PIPELINE || node->pl->negate)
+				node = as_job(p, node, source_text(p, start)); //a list in background runs in a forked shell
+			node->pl->bg = 1;
+			next(p);
+		} else if (p->tok.type == TOK_SEMI) {
+			next(p);
+		} else if (p->tok.type != TOK_NEWLINE && !ends_list(&p->tok)) {
+			fail(p);
+			return NULL;
+		}
+		*tail = node;
+		tail = &node->next;
+	}
+}
+
+/* parse input, which may span lines, into a command list allocated in arena
+ * if more is set, input running out inside a command isn't an error, as more lines may complete it
+ * return:
+ *     0 on success, *result is NULL if input has no command
+ *     -1 on syntax error, which has been reported
+ *     PARSE_INCOMPLETE if input ends inside a command and more is set
+ */
+int parse_program(struct arena *arena, const char *input, int more, struct node **result)
+{
+	assert(arena != NULL && input != NULL && result != NULL);
+
+	struct parser p;
+	struct node *list;
+
+	p.arena = arena;
+	p.input = input;
+	p.base = arena_strndup(arena, input, strlen(input));
+	p.lx.pos = p.base;
+	p.lx.held = 0;
+	p.lx.more = more;
+	p.lx.incomplete = 0;
+	p.lx.quote = 0;
+	p.status = 0;
+	p.closer = NULL;
+	*result = NULL;
+	next(&p);
+	list = parse_list(&p);
+	if (p.status == 0 && p.tok.type != TOK_END)
+		fail(&p);
+	if (p.status != 0)
+		return p.status;
+	*result = list;
+	return 0;
+}
+
+/* parse command line input into one pipeline allocated in arena, for callers that launch the
+ * line as a single job: a line that isn't a single plain pipeline becomes a pipeline of one
+ * compound stage, which runs in a forked shell
+ * return:
+ *     0 on success, *result is NULL if line has no command
+ *     -1 on syntax error, which has been reported
+ */
+int parse_cmd(struct arena *arena, const char *input, struct pipeline **result)
+{
+	assert(arena != NULL && input != NULL && result != NULL);
+
+	struct parser p = {arena};
+	struct node *list;
+
+	*result = NULL;
+	if (parse_program(arena, input, 0, &list) != 0)
+		return -1;
+	if (list == NULL)
+		return 0;
+	if (list->next != NULL || list->type != NODE_PIPELINE || list->pl->negate)
+		list = as_job(&p, list, input);
+	*result = list->pl;
+	return 0;
+}
+
+/* whether line added to input that parse_program() found incomplete may complete it,
+ * if not, parsing it again can wait for a line that may: line must hold the quote input
+ * ended inside, or the keyword closing the innermost compound command open at its end
+ */
+int parse_may_complete(const char *line)
+{
+	struct lexer lx = {NULL, 0, 1, 0, 0};
+	struct token tok;
+	size_t len;
+	char *copy;
+	int found = 0;
+
+	if (need == NULL)
+		return 1;
+	if (need == need_quote)
+		return strchr(line, need_quote[0]) != NULL;
+	len = strlen(line);
+	if ((copy = malloc(len + 1)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate line copy: %m");
+		exit(EXIT_FAILURE);
+	}
+	lx.pos = memcpy(copy, line, len + 1);
+	while (1) {
+		while (is_blank(peek(&lx)))
+			advance(&lx);
+		next_token(&lx, &tok);
+		if (tok.type == TOK_END)
+			break;
+		if (tok.type == TOK_ERROR || is_keyword(&tok, need)) { //a line the lexer can't take alone may
+			found = 1;
+			break;
+		}
+	}
+	free(copy);
+	return found;
+}
+
+static char *copy_str(struct arena *arena, const char *str)
+{
+	return str != NULL ? arena_strndup(arena, str, strlen(str)) : NULL;
+}
+
+static char **copy_words(struct arena *arena, char **words)
+{
+	size_t count = 0;
+	char **copy;
+
+	if (words == NULL || words[0] == NULL)
+		return words;
+	while (words[count] != NULL)
+		count++;
+	copy = arena_alloc(arena, (count + 1) * sizeof(char *));
+	for (size_t i = 0; i < count; ++i)
+		copy[i] = copy_str(arena, words[i]);
+	copy[count] = NULL;
+	return copy;
+}
+
+static void copy_command(struct arena *arena, struct command *cmd)
+{
+	struct redirect **tail = &cmd->redirs;
+
+	cmd->argv = copy_words(arena, cmd->argv);
+	cmd->assigns = copy_words(arena, cmd->assigns);
+	for (const struct redirect *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+		*tail = arena_alloc(arena, sizeof(struct redirect));
+		**tail = *redir;
+		(*tail)->target = copy_str(arena, redir->target);
+		tail = &(*tail)->next;
+	}
+	cmd->body = copy_nodes(arena, cmd->body);
+	if (cmd->lookup != NULL) {
+		cmd->lookup = arena_alloc(arena, sizeof(struct lookup));
+		memset(cmd->lookup, 0, sizeof(struct lookup));
+	}
+	if (cmd->refs != NULL) {
+		cmd->refs = arena_alloc(arena, cmd->ref_count * sizeof(struct var_ref));
+		memset(cmd->refs, 0, cmd->ref_count * sizeof(struct var_ref));
+	}
+}
+
+/* deep copy of list in arena, with lookups and refs unresolved, for lists that outlive their line */
+struct node *copy_nodes(struct arena *arena, const struct node *list)
+{
+	struct node *head = NULL, **tail = &head, *node;
+	struct case_item **item_tail;
+
+	for (; list != NULL; list = list->next) {
+		node = arena_alloc(arena, sizeof(struct node));
+		*node = *list;
+		node->next = NULL;
+		if (list->pl != NULL) {
+			node->pl = arena_alloc(arena, sizeof(struct pipeline));
+			*node->pl = *list->pl;
+			node->pl->text = copy_str(arena, list->pl->text);
+			node->pl->stages = arena_alloc(arena, list->pl->count * sizeof(struct command));
+			for (size_t i = 0; i < list->pl->count; ++i) {
+				node->pl->stages[i] = list->pl->stages[i];
+				copy_command(arena, &node->pl->stages[i]);
+			}
+		}
+		node->cond = copy_nodes(arena, list->cond);
+		node->body = copy_nodes(arena, list->body);
+		node->orelse = copy_nodes(arena, list->orelse);
+		node->name = copy_str(arena, list->name);
+		node->words = copy_words(arena, list->words);
+		item_tail = &node->items;
+		for (const struct case_item *item = list->items; item != NULL; item = item->next) {
+			*item_tail = arena_alloc(arena, sizeof(struct case_item));
+			(*item_tail)->patterns = copy_words(arena, item->patterns);
+			(*item_tail)->body = copy_nodes(arena, item->body);
+			(*item_tail)->next = NULL;
+			item_tail = &(*item_tail)->next;
+		}
+		*tail = node;
+		tail = &node->next;
+	}
+	return head;
+}
+
+/* stop (or resume) reporting syntax errors, for parsing ahead of running */
+void parse_set_quiet(int enable)
+{
+	quiet = enable;
+}
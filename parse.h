@@ -0,0 +1,109 @@
+#ifndef NSPT_PARSE
+#define NSPT_PARSE
+
+#include <stddef.h>
+#include "arena.h"
+
+#define REDIR_IN     0  // < file
+#define REDIR_OUT    1  // > file
+#define REDIR_APPEND 2  // >> file
+
+/* markers lexer leaves in place of a '$' that starts an expansion, see expand.c */
+#define CTL_VAR      '\001'  //unquoted, result is split into fields
+#define CTL_QVAR     '\002'  //inside double quotes, result stays one field
+#define CTL_END      '\003'  //ends a $NAME that quoted text follows, as in "$A"b, or a substitution
+#define CTL_SUB      '\004'  //unquoted $(cmd) or `cmd`, text of cmd follows up to CTL_END
+#define CTL_QSUB     '\005'  //$(cmd) or `cmd` inside double quotes
+
+struct redirect {
+	int type;
+	const char *target;
+	struct redirect *next;  //redirections apply in order, a later one overrides an earlier one
+};
+
+struct node;
+struct func;
+struct var_ref;
+
+#define LOOKUP_NONE     0
+#define LOOKUP_FUNC     1
+#define LOOKUP_BUILD_IN 2
+#define LOOKUP_PATH     3
+
+/* what the name of a command has been found to be, commands whose name has no expansion
+ * keep it, so a command run again (loop body, function) isn't looked up again,
+ * it holds while gen is lookup_generation()
+ */
+struct lookup {
+	int kind;
+	unsigned long gen;
+	size_t build_in;
+	struct func *func;
+	const char *path;
+};
+
+/* one stage of a pipeline, argv is NULL terminated
+ * assigns are the NAME=value words in front of the command
+ * a compound command ({ }, if, while, until, for, case) has no words, body is run instead
+ * refs has a slot per $NAME of assigns, then of argv, see expand_cmd()
+ */
+struct command {
+	char **argv;
+	size_t argc;
+	char **assigns;
+	size_t assign_count;
+	struct redirect *redirs;
+	int expand;  //some word holds an expansion marker
+	struct node *body;
+	struct lookup *lookup;
+	struct var_ref *refs;
+	size_t ref_count, assign_refs;
+};
+
+struct pipeline {
+	struct command *stages;
+	size_t count;
+	int bg;     //ends with '&'
+	int timed;  //starts with time keyword
+	int negate; //starts with '!'
+	const char *text;  //source text, jobs are listed with it
+};
+
+enum node_type {
+	NODE_PIPELINE,
+	NODE_AND,    //cond && body
+	NODE_OR,     //cond || body
+	NODE_IF,     //if cond then body else orelse (an elif is an if node alone in orelse)
+	NODE_WHILE,
+	NODE_UNTIL,
+	NODE_FOR,    //for name in words do body, words is NULL without "in", then it is "$@"
+	NODE_CASE,   //case name in items
+	NODE_FUNC    //name() body
+};
+
+struct case_item {
+	char **patterns;
+	struct node *body;
+	struct case_item *next;
+};
+
+/* parsed command list, nodes of a list are chained through next */
+struct node {
+	enum node_type type;
+	struct node *next;
+	struct pipeline *pl;
+	struct node *cond, *body, *orelse;
+	char *name;
+	char **words;
+	struct case_item *items;
+};
+
+#define PARSE_INCOMPLETE 1
+
+int parse_program(struct arena *arena, const char *input, int more, struct node **result);
+int parse_cmd(struct arena *arena, const char *input, struct pipeline **result);
+struct node *copy_nodes(struct arena *arena, const struct node *list);
+int parse_may_complete(const char *line);
+void parse_set_quiet(int enable);
+
+#endif
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include "path_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "vars.h"
+
+#define PATH_CACHE_ORIG_BUCKETS 64
+#define PATH_DEFAULT            "/usr/local/bin:/usr/bin:/bin"
+
+struct path_entry {
+	const char *name;
+	const char *path;  //absolute path of command, name and path share the entry allocation
+	unsigned long hits;
+	struct path_entry *next;
+};
+
+struct path_dir {
+	const char *dir;
+	struct timespec mtime;
+	int relative;      //commands found in relative dir depend on cwd, they are never cached
+};
+
+static struct path_cache {
+	struct path_entry **buckets;
+	size_t bucket_count, entry_count;
+	unsigned long hits, misses;
+	char *path_env;    //copy of $PATH the cache is built for
+	char *dir_buf;     //copy of $PATH split at ':', dirs point into it
+	struct path_dir *dirs;
+	size_t dir_count;
+	unsigned long generation;  //changes whenever cached locations are dropped
+} cache = {NULL, 0, 0, 0, 0, NULL, NULL, NULL, 0, 0};
+
+static size_t hash_name(const char *name)
+{
+	size_t hash = 14695981039346656037UL;
+	for (; *name; ++name) {
+		hash ^= (unsigned char)*name;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+static void init_buckets(size_t count)
+{
+	if ((cache.buckets = calloc(count, sizeof(struct path_entry *))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate path cache buckets: %m");
+		exit(EXIT_FAILURE);
+	}
+	cache.bucket_count = count;
+}
+
+static void grow_buckets()
+{
+	struct path_entry **old = cache.buckets, *entry, *next;
+	size_t old_count = cache.bucket_count, idx;
+
+	init_buckets(old_count * 2);
+	for (size_t i = 0; i < old_count; ++i) {
+		for (entry = old[i]; entry != NULL; entry = next) {
+			next = entry->next;
+			idx = hash_name(entry->name) & (cache.bucket_count - 1);
+			entry->next = cache.buckets[idx];
+			cache.buckets[idx] = entry;
+		}
+	}
+	free(old);
+}
+
+void path_cache_clear()
+{
+	struct path_entry *entry, *next;
+
+	for (size_t i = 0; i < cache.bucket_count; ++i) {
+		for (entry = cache.buckets[i]; entry != NULL; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+		cache.buckets[i] = NULL;
+	}
+	cache.entry_count = 0;
+	cache.generation++;
+}
+
+/* locations found before the generation changes may have been freed since */
+unsigned long path_cache_generation()
+{
+	return cache.generation;
+}
+
+static void get_mtime(const char *dir, struct timespec *mtime)
+{
+	struct stat dir_stat;
+
+	if (stat(dir, &dir_stat) != 0) {
+		mtime->tv_sec = 0;
+		mtime->tv_nsec = 0;
+		return;
+	}
+	*mtime = dir_stat.st_mtim;
+}
+
+/* split $PATH into dirs and record their mtime */
+static void load_path_dirs(const char *path_env)
+{
+	char *dir, *colon;
+	size_t count = 1;
+
+	free(cache.path_env);
+	free(cache.dir_buf);
+	free(cache.dirs);
+	if ((cache.path_env = strdup(path_env)) == NULL || (cache.dir_buf = strdup(path_env)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate path cache PATH copy: %m");
+		exit(EXIT_FAILURE);
+	}
+	for (const char *p = path_env; *p; ++p) {
+		if (*p == ':')
+			count++;
+	}
+	if ((cache.dirs = malloc(count * sizeof(struct path_dir))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate path cache dirs: %m");
+		exit(EXIT_FAILURE);
+	}
+
+	cache.dir_count = 0;
+	for (dir = cache.dir_buf; dir != NULL; dir = colon) {
+		if ((colon = strchr(dir, ':')) != NULL)
+			*colon++ = '\0';
+		struct path_dir *pd = &cache.dirs[cache.dir_count++];
+		pd->dir = *dir == '\0' ? "." : dir; //empty component means cwd
+		pd->relative = pd->dir[0] != '/';
+		get_mtime(pd->dir, &pd->mtime);
+	}
+}
+
+/* drop cached locations if $PATH or mtime of any dir in it has changed since last call,
+ * called once per command line, so lookups while launching are pure hash lookups
+ */
+void path_cache_revalidate()
+{
+	const char *path_env = vars_get("PATH");
+	struct timespec mtime;
+	int changed = 0;
+
+	if (path_env == NULL)
+		path_env = PATH_DEFAULT;
+	if (cache.buckets == NULL)
+		init_buckets(PATH_CACHE_ORIG_BUCKETS);
+
+	if (cache.path_env == NULL || strcmp(cache.path_env, path_env) != 0) {
+		load_path_dirs(path_env);
+		path_cache_clear();
+		return;
+	}
+
+	for (size_t i = 0; i < cache.dir_count; ++i) {
+		get_mtime(cache.dirs[i].dir, &mtime);
+		if (mtime.tv_sec != cache.dirs[i].mtime.tv_sec || mtime.tv_nsec != cache.dirs[i].mtime.tv_nsec) {
+			cache.dirs[i].mtime = mtime;
+			changed = 1;
+		}
+	}
+	if (changed)
+		path_cache_clear();
+}
+
+static int is_executable(const char *path)
+{
+	struct stat file_stat;
+
+	return stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && access(path, X_OK) == 0;
+}
+
+static struct path_entry *add_entry(const char *name, const char *path)
+{
+	struct path_entry *entry;
+	size_t name_len = strlen(name) + 1, path_len = strlen(path) + 1, idx;
+
+	if (cache.entry_count >= cache.bucket_count / 4 * 3)
+		grow_buckets();
+	if ((entry = malloc(sizeof(struct path_entry) + name_len + path_len)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate path cache entry: %m");
+		exit(EXIT_FAILURE);
+	}
+	entry->name = memcpy((char *)(entry + 1), name, name_len);
+	entry->path = memcpy((char *)(entry + 1) + name_len, path, path_len);
+	entry->hits = 0;
+	idx = hash_name(name) & (cache.bucket_count - 1);
+	entry->next = cache.buckets[idx];
+	cache.buckets[idx] = entry;
+	cache.entry_count++;
+	return entry;
+}
+
+/* find the file that will be executed for cmd
+ * return:
+ *     cmd itself if it contains '/',
+ *     absolute path found in $PATH (cached on first lookup),
+ *     NULL if cmd can't be found, returned pointer is valid until next revalidate or clear
+ */
+const char *path_cache_lookup(const char *cmd)
+{
+	int stable;
+
+	return path_cache_resolve(cmd, &stable);
+}
+
+/* path_cache_lookup(), *stable is set if the result stays valid (for as long as cmd does)
+ * until path_cache_generation() changes, a command found in a relative dir only is valid
+ * until next lookup
+ */
+const char *path_cache_resolve(const char *cmd, int *stable)
+{
+	assert(cmd != NULL);
+
+	static char *cand = NULL;
+	static size_t cand_len = 0;
+	struct path_entry *entry;
+	size_t cmd_len, need_len;
+
+	*stable = 1;
+	if (strchr(cmd, '/') != NULL)
+		return cmd;
+	if (cache.buckets == NULL)
+		path_cache_revalidate();
+
+	for (entry = cache.buckets[hash_name(cmd) & (cache.bucket_count - 1)]; entry; entry = entry->next) {
+		if (strcmp(entry->name, cmd) == 0) {
+			entry->hits++;
+			cache.hits++;
+			return entry->path;
+		}
+	}
+
+	cache.misses++;
+	cmd_len = strlen(cmd);
+	for (size_t i = 0; i < cache.dir_count; ++i) {
+		need_len = strlen(cache.dirs[i].dir) + cmd_len + 2; //+2 for '/' and '\0'
+		if (need_len > cand_len) {
+			cand_len = need_len * 2;
+			if ((cand = realloc(cand, cand_len)) == NULL) {
+				syslog(LOG_ERR, "Can't allocate path cache lookup buffer: %m");
+				exit(EXIT_FAILURE);
+			}
+		}
+		sprintf(cand, "%s/%s", cache.dirs[i].dir, cmd);
+		if (!is_executable(cand))
+			continue;
+		if (cache.dirs[i].relative) {
+			*stable = 0;
+			return cand;
+		}
+		entry = add_entry(cmd, cand); //a miss, hits count lookups found in cache
+		return entry->path;
+	}
+	return NULL;
+}
+
+/* dir idx of $PATH as of last revalidate, NULL if idx is past the last one */
+const char *path_cache_dir(size_t idx)
+{
+	return idx < cache.dir_count ? cache.dirs[idx].dir : NULL;
+}
+
+void path_cache_output()
+{
+	struct path_entry *entry;
+
+	if (cache.entry_count != 0)
+		printf("hits\tcommand\n");
+	for (size_t i = 0; i < cache.bucket_count; ++i) {
+		for (entry = cache.buckets[i]; entry != NULL; entry = entry->next)
+			printf("%4lu\t%s\n", entry->hits, entry->path);
+	}
+	printf("cache hits: %lu, misses: %lu\n", cache.hits, cache.misses);
+}
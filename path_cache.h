@@ -0,0 +1,14 @@
+#ifndef NSPT_PATH_CACHE
+#define NSPT_PATH_CACHE
+
+#include <stddef.h>
+
+void path_cache_revalidate();
+const char *path_cache_lookup(const char *cmd);
+const char *path_cache_resolve(const char *cmd, int *stable);
+unsigned long path_cache_generation();
+void path_cache_clear();
+void path_cache_output();
+const char *path_cache_dir(size_t idx);
+
+#endif
@@ -0,0 +1,61 @@
+/* sample loadable builtins, basename and dirname without a fork/exec per call
+ *     make plugins
+ *     enable -f ./plugins/pathname.so basename dirname
+ */
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../nspt_builtin.h"
+
+static int write_line(int out_fd, const char *str, size_t len)
+{
+	char buf[4096];
+
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+	memcpy(buf, str, len);
+	buf[len] = '\n';
+	return write(out_fd, buf, len + 1) == len + 1 ? 0 : 1;
+}
+
+/* basename path [suffix] */
+static int pathname_basename(char **argv, int in_fd, int out_fd)
+{
+	const char *path = argv[1], *start;
+	size_t len, suffix_len;
+
+	if (path == NULL) {
+		fprintf(stderr, "basename: missing operand\n");
+		return 1;
+	}
+	for (len = strlen(path); len > 1 && path[len - 1] == '/'; --len);
+	for (start = path + len; start > path && start[-1] != '/'; --start);
+	if (start == path + len) //"/" or ""
+		return write_line(out_fd, path, len);
+	len -= start - path;
+	if (argv[2] != NULL && (suffix_len = strlen(argv[2])) < len
+	&& memcmp(start + len - suffix_len, argv[2], suffix_len) == 0)
+		len -= suffix_len;
+	return write_line(out_fd, start, len);
+}
+
+/* dirname path */
+static int pathname_dirname(char **argv, int in_fd, int out_fd)
+{
+	const char *path = argv[1];
+	size_t len;
+
+	if (path == NULL) {
+		fprintf(stderr, "dirname: missing operand\n");
+		return 1;
+	}
+	for (len = strlen(path); len > 1 && path[len - 1] == '/'; --len);
+	for (; len > 0 && path[len - 1] != '/'; --len);
+	if (len == 0)
+		return write_line(out_fd, ".", 1);
+	for (; len > 1 && path[len - 1] == '/'; --len);
+	return write_line(out_fd, path, len);
+}
+
+const struct nspt_builtin basename_builtin = {NSPT_BUILTIN_ABI, "basename", pathname_basename};
+const struct nspt_builtin dirname_builtin = {NSPT_BUILTIN_ABI, "dirname", pathname_dirname};
@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include "prompt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "tools.h"
+
+/* PS1-like prompt language:
+ *     \u user       \h host up to first '.'    \H host
+ *     \w cwd, home shown as ~                  \W last component of cwd
+ *     \? exit status of last command           \j number of jobs
+ *     \C duration of last command              \b git branch of cwd
+ *     \$ '#' for root, '$' otherwise           \n newline
+ *     \e escape     \nnn octal char            \\ backslash
+ *     \[ \] enclose non-printing chars, escape sequences are also skipped when counting width
+ * format is compiled into a list of segments once, a segment is rendered again only when
+ * the input it depends on has changed, literal text is rendered at compile time
+ */
+enum seg_type {SEG_TEXT, SEG_USER, SEG_HOST, SEG_HOST_FULL, SEG_CWD, SEG_CWD_BASE, SEG_STATUS, SEG_JOBS,
+	SEG_DURATION, SEG_BRANCH};
+
+struct segment {
+	enum seg_type type;
+	int valid;
+	unsigned long key;    //input the text has been rendered from
+	struct str_buf text;
+	size_t width;         //columns after last newline of text, if it has one
+	int newline;
+};
+
+static struct prompt {
+	char *source;         //format segments are compiled from
+	struct segment *segs;
+	size_t seg_count, seg_cap;
+	int uses_branch;
+	struct str_buf out;
+} prompt = {NULL, NULL, 0, 0, 0, {NULL, 0, 0}};
+
+/* last command is timed by the interactive loop, \C shows it */
+static struct timespec cmd_start;
+static unsigned long cmd_ms = 0;
+
+/* git state of cwd, git dir is searched only when cwd changes, HEAD is read again only when
+ * its stat changes, so a prompt costs one stat() whatever the size of the repository
+ */
+static struct vcs_state {
+	unsigned long cwd_gen;
+	int checked;
+	struct str_buf head_path; //empty if cwd isn't in a work tree
+	struct stat head_stat;
+	struct str_buf branch;
+	unsigned long gen;        //changes whenever branch does
+} vcs = {0, 0, {NULL, 0, 0}, {0}, {NULL, 0, 0}, 0};
+
+void prompt_command_start()
+{
+	clock_gettime(CLOCK_MONOTONIC, &cmd_start);
+}
+
+void prompt_command_end()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	cmd_ms = (now.tv_sec - cmd_start.tv_sec) * 1000 + (now.tv_nsec - cmd_start.tv_nsec) / 1000000;
+}
+
+/* columns taken by str, escape sequences excluded, *in_escape carries an escape sequence
+ * over from one piece of text to the next, *newline is set if str has a newline,
+ * columns are counted from the last one then
+ */
+static size_t text_width(const char *str, size_t length, int *in_escape, int *newline)
+{
+	size_t width = 0;
+
+	for (size_t i = 0; i < length; ++i) {
+		unsigned char ch = str[i];
+		if (*in_escape) {
+			if (isalpha(ch))
+				*in_escape = 0;
+		} else if (ch == '\033') {
+			*in_escape = 1;
+		} else if (ch == '\n') {
+			width = 0;
+			*newline = 1;
+		} else if ((ch & 0xc0) != 0x80) { //count UTF-8 lead bytes only
+			width++;
+		}
+	}
+	return width;
+}
+
+static struct segment *add_segment(enum seg_type type)
+{
+	struct segment *seg;
+
+	if (prompt.seg_count == prompt.seg_cap) {
+		prompt.seg_cap = prompt.seg_cap == 0 ? 16 : prompt.seg_cap * 2;
+		if ((prompt.segs = realloc(prompt.segs, prompt.seg_cap * sizeof(struct segment))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate prompt segments: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	seg = &prompt.segs[prompt.seg_count++];
+	memset(seg, 0, sizeof(struct segment));
+	seg->type = type;
+	if (type == SEG_BRANCH)
+		prompt.uses_branch = 1;
+	return seg;
+}
+
+/* append literal text to the text segment at the end, width is added unless it is within \[ \] */
+static void add_text(const char *text, size_t length, int printing, int *in_escape)
+{
+	struct segment *seg = prompt.seg_count > 0 ? &prompt.segs[prompt.seg_count - 1] : NULL;
+	size_t width;
+	int newline = 0;
+
+	if (seg == NULL || seg->type != SEG_TEXT)
+		seg = add_segment(SEG_TEXT);
+	str_buf_append(&seg->text, text, length);
+	if (printing) {
+		width = text_width(text, length, in_escape, &newline);
+		seg->width = newline ? width : seg->width + width;
+		seg->newline |= newline;
+	}
+	seg->valid = 1;
+}
+
+static void prompt_compile(const char *format)
+{
+	const char *p, *lit;
+	int printing = 1, in_escape = 0;
+	char ch;
+
+	for (size_t i = 0; i < prompt.seg_count; ++i)
+		free(prompt.segs[i].text.data);
+	prompt.seg_count = 0;
+	prompt.uses_branch = 0;
+	free(prompt.source);
+	if ((prompt.source = strdup(format)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate prompt format: %m");
+		exit(EXIT_FAILURE);
+	}
+
+	for (p = format; *p; ) {
+		for (lit = p; *p && *p != '\\'; ++p);
+		if (p > lit)
+			add_text(lit, p - lit, printing, &in_escape);
+		if (*p == '\0')
+			break;
+		switch (*++p) {
+			case 'u': add_segment(SEG_USER); break;
+			case 'h': add_segment(SEG_HOST); break;
+			case 'H': add_segment(SEG_HOST_FULL); break;
+			case 'w': add_segment(SEG_CWD); break;
+			case 'W': add_segment(SEG_CWD_BASE); break;
+			case '?': add_segment(SEG_STATUS); break;
+			case 'j': add_segment(SEG_JOBS); break;
+			case 'C': add_segment(SEG_DURATION); break;
+			case 'b': add_segment(SEG_BRANCH); break;
+			case '$': add_text(geteuid() == 0 ? "#" : "$", 1, printing, &in_escape); break;
+			case 'n': add_text("\n", 1, printing, &in_escape); break;
+			case 'e': add_text("\033", 1, printing, &in_escape); break;
+			case '[': printing = 0; break;
+			case ']': printing = 1; break;
+			case '\0': add_text("\\", 1, printing, &in_escape); continue;
+			default:
+				if (p[0] >= '0' && p[0] <= '7' && p[1] >= '0' && p[1] <= '7' && p[2] >= '0' && p[2] <= '7') {
+					ch = (p[0] - '0') * 64 + (p[1] - '0') * 8 + (p[2] - '0');
+					add_text(&ch, 1, printing, &in_escape);
+					p += 2;
+				} else if (*p == '\\') {
+					add_text("\\", 1, printing, &in_escape);
+				} else { //unknown escapes are shown as they are
+					add_text(p - 1, 2, printing, &in_escape);
+				}
+		}
+		++p;
+	}
+}
+
+/* find HEAD of the git dir cwd belongs to, walking up from cwd */
+static void vcs_find_head(const char *cwd)
+{
+	struct str_buf *path = &vcs.head_path;
+	struct stat st;
+	char gitdir[4096];
+	ssize_t len;
+	size_t dir_len;
+	int fd;
+
+	path->len = 0;
+	str_buf_append(path, cwd, strlen(cwd));
+	while (1) {
+		dir_len = path->len;
+		str_buf_append(path, "/.git", 5);
+		if (stat(path->data, &st) == 0) {
+			if (S_ISDIR(st.st_mode)) {
+				str_buf_append(path, "/HEAD", 5);
+				return;
+			}
+			if (S_ISREG(st.st_mode) && (fd = open(path->data, O_RDONLY | O_CLOEXEC)) != -1) { //"gitdir: <dir>" of a worktree
+				len = read(fd, gitdir, sizeof(gitdir) - 1);
+				close(fd);
+				if (len > 8 && memcmp(gitdir, "gitdir: ", 8) == 0) {
+					while (len > 8 && isspace((unsigned char)gitdir[len - 1]))
+						--len;
+					path->len = gitdir[8] == '/' ? 0 : dir_len + 1;
+					str_buf_append(path, gitdir + 8, len - 8);
+					str_buf_append(path, "/HEAD", 5);
+					return;
+				}
+			}
+		}
+		while (dir_len > 0 && path->data[dir_len - 1] != '/')
+			--dir_len;
+		if (dir_len <= 1)
+			break;
+		path->len = dir_len - 1;
+		path->data[path->len] = '\0';
+	}
+	path->len = 0;
+}
+
+/* refresh branch, HEAD is "ref: refs/heads/<branch>" or the commit id when detached */
+static void vcs_update(const struct prompt_input *in)
+{
+	struct stat st;
+	char head[512];
+	ssize_t len = -1;
+	int fd;
+
+	if (!vcs.checked || vcs.cwd_gen != in->cwd_gen) {
+		vcs_find_head(in->cwd);
+		vcs.cwd_gen = in->cwd_gen;
+		vcs.checked = 1;
+		memset(&vcs.head_stat, 0, sizeof(struct stat));
+		vcs.branch.len = 0;
+		vcs.gen++;
+	}
+	if (vcs.head_path.len == 0 || stat(vcs.head_path.data, &st) != 0)
+		return;
+	if (st.st_ino == vcs.head_stat.st_ino && st.st_size == vcs.head_stat.st_size
+	&& st.st_mtim.tv_sec == vcs.head_stat.st_mtim.tv_sec && st.st_mtim.tv_nsec == vcs.head_stat.st_mtim.tv_nsec)
+		return;
+	vcs.head_stat = st;
+	vcs.branch.len = 0;
+	vcs.gen++;
+	if ((fd = open(vcs.head_path.data, O_RDONLY | O_CLOEXEC)) != -1) {
+		len = read(fd, head, sizeof(head));
+		close(fd);
+	}
+	while (len > 0 && isspace((unsigned char)head[len - 1]))
+		--len;
+	if (len > 16 && memcmp(head, "ref: refs/heads/", 16) == 0)
+		str_buf_append(&vcs.branch, head + 16, len - 16);
+	else if (len > 0)
+		str_buf_append(&vcs.branch, head, len < 7 ? len : 7);
+}
+
+/* render seg if the input it shows has changed since it was last rendered */
+static void render_segment(struct segment *seg, const struct prompt_input *in)
+{
+	unsigned long key;
+	const char *str;
+	size_t home_len;
+
+	switch (seg->type) {
+		case SEG_CWD:
+		case SEG_CWD_BASE: key = in->cwd_gen; break;
+		case SEG_STATUS:   key = in->last_status; break;
+		case SEG_JOBS:     key = in->job_count; break;
+		case SEG_DURATION: key = cmd_ms < 1000 ? cmd_ms : cmd_ms / 100 * 100; break;
+		case SEG_BRANCH:   key = vcs.gen; break;
+		default:           key = 0; //text, user and host don't change
+	}
+	if (seg->valid && seg->key == key)
+		return;
+	seg->valid = 1;
+	seg->key = key;
+	seg->text.len = 0;
+
+	switch (seg->type) {
+		case SEG_TEXT:
+			break;
+		case SEG_USER:
+			str_buf_append(&seg->text, in->user, strlen(in->user));
+			break;
+		case SEG_HOST:
+			str_buf_append(&seg->text, in->host, strcspn(in->host, "."));
+			break;
+		case SEG_HOST_FULL:
+			str_buf_append(&seg->text, in->host, strlen(in->host));
+			break;
+		case SEG_CWD:
+			home_len = strlen(in->home);
+			if (home_len > 1 && strncmp(in->cwd, in->home, home_len) == 0
+			&& (in->cwd[home_len] == '/' || in->cwd[home_len] == '\0')) {
+				str_buf_append(&seg->text, "~", 1);
+				str_buf_append(&seg->text, in->cwd + home_len, strlen(in->cwd + home_len));
+			} else {
+				str_buf_append(&seg->text, in->cwd, strlen(in->cwd));
+			}
+			break;
+		case SEG_CWD_BASE:
+			str = strrchr(in->cwd, '/');
+			str = str == NULL || str[1] == '\0' ? in->cwd : str + 1;
+			str_buf_append(&seg->text, str, strlen(str));
+			break;
+		case SEG_STATUS:
+			str_buf_printf(&seg->text, "%d", in->last_status);
+			break;
+		case SEG_JOBS:
+			str_buf_printf(&seg->text, "%zu", in->job_count);
+			break;
+		case SEG_DURATION:
+			if (cmd_ms < 1000)
+				str_buf_printf(&seg->text, "%lums", cmd_ms);
+			else if (cmd_ms < 60000)
+				str_buf_printf(&seg->text, "%lu.%lus", cmd_ms / 1000, cmd_ms % 1000 / 100);
+			else
+				str_buf_printf(&seg->text, "%lum%lus", cmd_ms / 60000, cmd_ms % 60000 / 1000);
+			break;
+		case SEG_BRANCH:
+			if (vcs.branch.len > 0)
+				str_buf_append(&seg->text, vcs.branch.data, vcs.branch.len);
+			break;
+	}
+	int in_escape = 0;
+	seg->newline = 0;
+	seg->width = text_width(seg->text.data, seg->text.len, &in_escape, &seg->newline);
+}
+
+/* render prompt from format, format is compiled again only when it changes
+ * return prompt text, valid until next call, length and width (terminal columns) are set
+ */
+const char *prompt_render(const char *format, const struct prompt_input *in, size_t *length, size_t *width)
+{
+	struct segment *seg;
+
+	if (prompt.source == NULL || strcmp(prompt.source, format) != 0)
+		prompt_compile(format);
+	if (prompt.uses_branch)
+		vcs_update(in);
+
+	prompt.out.len = 0;
+	*width = 0;
+	for (size_t i = 0; i < prompt.seg_count; ++i) {
+		seg = &prompt.segs[i];
+		render_segment(seg, in);
+		if (seg->text.len > 0)
+			str_buf_append(&prompt.out, seg->text.data, seg->text.len);
+		*width = seg->newline ? seg->width : *width + seg->width; //cursor is on last line of prompt
+	}
+	*length = prompt.out.len;
+	return prompt.out.len > 0 ? prompt.out.data : "";
+}
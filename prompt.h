@@ -0,0 +1,18 @@
+#ifndef NSPT_PROMPT
+#define NSPT_PROMPT
+
+#include <stddef.h>
+
+/* what prompt segments are rendered from, cwd_gen changes whenever cwd does */
+struct prompt_input {
+	const char *user, *host, *home, *cwd;
+	unsigned long cwd_gen;
+	int last_status;
+	size_t job_count;
+};
+
+void prompt_command_start();
+void prompt_command_end();
+const char *prompt_render(const char *format, const struct prompt_input *in, size_t *length, size_t *width);
+
+#endif
@@ -0,0 +1,114 @@
+#include "scan.h"
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/* find where a run of plain word bytes ends: at blank, control byte, '\0', operator, quote, backslash, '$' or '`'
+ * control bytes are reported too, caller tells them apart, so the vector versions only need
+ * one unsigned compare for all of them
+ * loads are aligned and never cross into next page, so reading past '\0' is safe
+ */
+static int is_word_end(unsigned char ch)
+{
+	return ch <= ' ' || ch == '|' || ch == '&' || ch == '<' || ch == '>' || ch == ';' || ch == '(' || ch == ')' || ch == '\'' || ch == '"' || ch == '\\' || ch == '$' || ch == '`';
+}
+
+static size_t scan_scalar(const char *str)
+{
+	const char *p = str;
+
+	while (!is_word_end(*p))
+		++p;
+	return p - str;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static unsigned match_sse2(const char *p)
+{
+	__m128i v = _mm_load_si128((const __m128i *)p);
+	__m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(' ')), v); //v <= ' '
+
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+	return _mm_movemask_epi8(hit);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *str)
+{
+	const char *p = (const char *)((uintptr_t)str & ~(uintptr_t)15);
+	unsigned mask = match_sse2(p) & (~0u << (str - p));
+
+	while (mask == 0) {
+		p += 16;
+		mask = match_sse2(p);
+	}
+	return p + __builtin_ctz(mask) - str;
+}
+
+__attribute__((target("avx2")))
+static unsigned match_avx2(const char *p)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)p);
+	__m256i hit = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(' ')), v);
+
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('`')));
+	return _mm256_movemask_epi8(hit);
+}
+
+/* not picked by scan_word_end(), most words end in the first 32 byte block where the wider
+ * load buys nothing and costs more, bench/scan.c still measures it
+ */
+__attribute__((target("avx2"), unused))
+static size_t scan_avx2(const char *str)
+{
+	const char *p = (const char *)((uintptr_t)str & ~(uintptr_t)31);
+	unsigned mask = match_avx2(p) & (~0u << (str - p));
+
+	while (mask == 0) {
+		p += 32;
+		mask = match_avx2(p);
+	}
+	return p + __builtin_ctz(mask) - str;
+}
+#endif
+
+static size_t (*scan_impl)(const char *str) = NULL;
+
+/* number of plain word bytes at str, sse2 is used where the cpu has it, scalar otherwise */
+size_t scan_word_end(const char *str)
+{
+	if (scan_impl == NULL) {
+		scan_impl = scan_scalar;
+#ifdef SCAN_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			scan_impl = scan_sse2;
+#endif
+	}
+	return scan_impl(str);
+}
@@ -0,0 +1,8 @@
+#ifndef NSPT_SCAN
+#define NSPT_SCAN
+
+#include <stddef.h>
+
+size_t scan_word_end(const char *str);
+
+#endif
@@ -0,0 +1,670 @@
+#define _GNU_SOURCE
+#include "script_cache.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "exec_cmd.h"
+#include "parse.h"
+#include "sh_env.h"
+#include "tools.h"
+#include "vars.h"
+
+/* compiled scripts
+ * a script file is parsed once, the parsed commands are stored in the cache dir
+ * ($XDG_CACHE_HOME/nspt_sh or ~/.cache/nspt_sh) and mmap()ed by later runs, which skip
+ * reading and parsing the script
+ * cache file is named after a hash of the script's real path and holds:
+ *     header, the script is compiled from its path, size, inode and mtime, so any edit
+ *         (or a different shell build, or format) makes it stale, it is then rebuilt and
+ *         replaced with rename()
+ *     command table, {text, list} per complete command (which may span lines) of the script
+ *     records, uint32_t words a command list is encoded in, see put_list()
+ *     strings, '\0' terminated
+ * everything is referred to by offset, so the mapping is used in place wherever it lands
+ */
+#define CACHE_MAGIC   "nspt_sc"
+#define CACHE_FORMAT  2
+#define CACHE_BUILD   __DATE__ " " __TIME__
+#define CACHE_DIR     "nspt_sh"
+#define NO_LIST       UINT32_MAX  //command has a syntax error, its text is parsed again to report it
+#define NO_STR        UINT32_MAX  //string that is NULL
+#define MAX_NESTING   1000        //compound commands in compound commands, a deeper image is malformed
+
+struct cache_header {
+	char magic[8];
+	char build[24];
+	uint64_t src_size, src_ino;
+	int64_t src_mtime_sec, src_mtime_nsec;
+	uint32_t format;
+	uint32_t path;        //string offset of script path
+	uint32_t cmd_count;
+	uint32_t recs_len;    //in words
+	uint32_t strs_len;    //in bytes
+	uint32_t unused;
+};
+
+struct cache_cmd {
+	uint32_t text;        //string offset of command text, only kept for NO_LIST
+	uint32_t list;        //record offset, or NO_LIST
+};
+
+/* compiled script being built */
+struct image {
+	struct str_buf cmds, recs, strs;
+};
+
+/* records being decoded, a malformed one sets bad and decoding goes on with harmless values */
+struct decoder {
+	struct arena *arena;
+	const uint32_t *recs;
+	size_t recs_len, pos, depth;
+	char *strs;
+	uint32_t strs_len;
+	int bad;
+};
+
+/* commands of compiled script are decoded into it up front, kept until the script ends */
+static struct arena image_arena = {NULL, 0};
+
+static uint64_t hash_path(const char *path)
+{
+	uint64_t hash = 14695981039346656037UL;
+	for (; *path; ++path) {
+		hash ^= (unsigned char)*path;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+static void put_word(struct str_buf *buf, uint32_t word)
+{
+	str_buf_append(buf, (const char *)&word, sizeof(word));
+}
+
+static uint32_t put_str(struct image *img, const char *str)
+{
+	uint32_t offset = img->strs.len;
+
+	if (str == NULL)
+		return NO_STR;
+	str_buf_append(&img->strs, str, strlen(str) + 1);
+	return offset;
+}
+
+/* {count, offset...}, NULL words are {NO_STR} */
+static void put_words(struct image *img, char **words)
+{
+	size_t count = 0;
+
+	if (words == NULL) {
+		put_word(&img->recs, NO_STR);
+		return;
+	}
+	while (words[count] != NULL)
+		count++;
+	put_word(&img->recs, count);
+	for (size_t i = 0; i < count; ++i)
+		put_word(&img->recs, put_str(img, words[i]));
+}
+
+static void put_list(struct image *img, const struct node *list);
+
+/* pipeline is {stage count, bg | timed << 1 | negate << 2, text}, then per stage
+ * {argc, assign count, redirection count, expand, ref count, assign refs, has lookup, has body},
+ * argv offsets, assign offsets, {type, target offset} per redirection and the body list
+ */
+static void put_pipeline(struct image *img, const struct pipeline *pl)
+{
+	uint32_t redir_count;
+	const struct command *cmd;
+	const struct redirect *redir;
+
+	put_word(&img->recs, pl->count);
+	put_word(&img->recs, (pl->bg ? 1 : 0) | (pl->timed ? 2 : 0) | (pl->negate ? 4 : 0));
+	put_word(&img->recs, put_str(img, pl->text));
+	for (size_t i = 0; i < pl->count; ++i) {
+		cmd = &pl->stages[i];
+		for (redir_count = 0, redir = cmd->redirs; redir != NULL; redir = redir->next)
+			redir_count++;
+		put_word(&img->recs, cmd->argc);
+		put_word(&img->recs, cmd->assign_count);
+		put_word(&img->recs, redir_count);
+		put_word(&img->recs, cmd->expand);
+		put_word(&img->recs, cmd->ref_count);
+		put_word(&img->recs, cmd->assign_refs);
+		put_word(&img->recs, cmd->lookup != NULL);
+		put_word(&img->recs, cmd->body != NULL);
+		for (size_t j = 0; j < cmd->argc; ++j)
+			put_word(&img->recs, put_str(img, cmd->argv[j]));
+		for (size_t j = 0; j < cmd->assign_count; ++j)
+			put_word(&img->recs, put_str(img, cmd->assigns[j]));
+		for (redir = cmd->redirs; redir != NULL; redir = redir->next) {
+			put_word(&img->recs, redir->type);
+			put_word(&img->recs, put_str(img, redir->target));
+		}
+		if (cmd->body != NULL)
+			put_list(img, cmd->body);
+	}
+}
+
+/* list is {node count}, then per node {type, has pipeline, name}, words, the pipeline,
+ * lists cond, body and orelse, and {item count} with patterns and a body list per case item
+ */
+static void put_list(struct image *img, const struct node *list)
+{
+	const struct node *node;
+	const struct case_item *item;
+	uint32_t count = 0;
+
+	for (node = list; node != NULL; node = node->next)
+		count++;
+	put_word(&img->recs, count);
+	for (node = list; node != NULL; node = node->next) {
+		put_word(&img->recs, node->type);
+		put_word(&img->recs, node->pl != NULL);
+		put_word(&img->recs, put_str(img, node->name));
+		put_words(img, node->words);
+		if (node->pl != NULL)
+			put_pipeline(img, node->pl);
+		put_list(img, node->cond);
+		put_list(img, node->body);
+		put_list(img, node->orelse);
+		for (count = 0, item = node->items; item != NULL; item = item->next)
+			count++;
+		put_word(&img->recs, count);
+		for (item = node->items; item != NULL; item = item->next) {
+			put_words(img, item->patterns);
+			put_list(img, item->body);
+		}
+	}
+}
+
+static uint32_t take_word(struct decoder *dc)
+{
+	if (dc->pos >= dc->recs_len) {
+		dc->bad = 1;
+		return 0;
+	}
+	return dc->recs[dc->pos++];
+}
+
+/* count of things that take at least a word each, so a bad one can't make decoder allocate a lot */
+static uint32_t take_count(struct decoder *dc)
+{
+	uint32_t count = take_word(dc);
+
+	if (count > dc->recs_len - dc->pos) {
+		dc->bad = 1;
+		return 0;
+	}
+	return count;
+}
+
+static char *take_str(struct decoder *dc, int nullable)
+{
+	uint32_t offset = take_word(dc);
+
+	if (offset == NO_STR && nullable)
+		return NULL;
+	if (offset >= dc->strs_len) {
+		dc->bad = 1;
+		return "";
+	}
+	return dc->strs + offset;
+}
+
+static char **take_words(struct decoder *dc, uint32_t count)
+{
+	char **words = arena_alloc(dc->arena, (count + 1) * sizeof(char *));
+
+	for (size_t i = 0; i < count; ++i)
+		words[i] = take_str(dc, 0);
+	words[count] = NULL;
+	return words;
+}
+
+static char **take_word_list(struct decoder *dc)
+{
+	if (dc->pos < dc->recs_len && dc->recs[dc->pos] == NO_STR) {
+		dc->pos++;
+		return NULL;
+	}
+	return take_words(dc, take_count(dc));
+}
+
+static void *take_zeroed(struct decoder *dc, size_t size)
+{
+	void *ptr = arena_alloc(dc->arena, size);
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static struct node *take_list(struct decoder *dc);
+
+static struct pipeline *take_pipeline(struct decoder *dc)
+{
+	struct pipeline *pl = take_zeroed(dc, sizeof(struct pipeline));
+	struct redirect **tail;
+	struct command *cmd;
+	uint32_t flags, redir_count;
+
+	if ((pl->count = take_count(dc)) == 0)
+		dc->bad = 1;
+	flags = take_word(dc);
+	pl->bg = flags & 1;
+	pl->timed = (flags & 2) != 0;
+	pl->negate = (flags & 4) != 0;
+	pl->text = take_str(dc, 0);
+	pl->stages = take_zeroed(dc, pl->count * sizeof(struct command));
+	for (size_t i = 0; i < pl->count && !dc->bad; ++i) {
+		cmd = &pl->stages[i];
+		cmd->argc = take_count(dc);
+		cmd->assign_count = take_count(dc);
+		redir_count = take_count(dc);
+		cmd->expand = take_word(dc) != 0;
+		cmd->ref_count = take_word(dc);
+		cmd->assign_refs = take_word(dc);
+		if (cmd->assign_refs > cmd->ref_count || cmd->ref_count > dc->strs_len)
+			dc->bad = 1;
+		else if (cmd->ref_count > 0)
+			cmd->refs = take_zeroed(dc, cmd->ref_count * sizeof(struct var_ref));
+		if (take_word(dc) != 0)
+			cmd->lookup = take_zeroed(dc, sizeof(struct lookup));
+		flags = take_word(dc);
+		cmd->argv = take_words(dc, cmd->argc);
+		cmd->assigns = take_words(dc, cmd->assign_count);
+		tail = &cmd->redirs;
+		for (size_t j = 0; j < redir_count && !dc->bad; ++j) {
+			*tail = arena_alloc(dc->arena, sizeof(struct redirect));
+			if (((*tail)->type = take_word(dc)) > REDIR_APPEND)
+				dc->bad = 1;
+			(*tail)->target = take_str(dc, 0);
+			tail = &(*tail)->next;
+		}
+		*tail = NULL;
+		if (flags != 0 && (cmd->body = take_list(dc)) == NULL)
+			dc->bad = 1;
+		if (cmd->lookup != NULL && cmd->argc == 0)
+			dc->bad = 1;
+	}
+	return pl;
+}
+
+/* list at dc->pos in dc->arena, words point into dc->strs */
+static struct node *take_list(struct decoder *dc)
+{
+	struct node *head = NULL, **tail = &head, *node;
+	struct case_item **item_tail;
+	uint32_t count, has_pl;
+
+	if (++dc->depth > MAX_NESTING)
+		dc->bad = 1;
+	count = take_count(dc);
+	for (size_t i = 0; i < count && !dc->bad; ++i) {
+		node = take_zeroed(dc, sizeof(struct node));
+		if ((node->type = take_word(dc)) > NODE_FUNC)
+			dc->bad = 1;
+		has_pl = take_word(dc);
+		node->name = take_str(dc, 1);
+		node->words = take_word_list(dc);
+		if (has_pl)
+			node->pl = take_pipeline(dc);
+		node->cond = take_list(dc);
+		node->body = take_list(dc);
+		node->orelse = take_list(dc);
+		item_tail = &node->items;
+		for (uint32_t items = take_count(dc); items > 0 && !dc->bad; --items) {
+			*item_tail = take_zeroed(dc, sizeof(struct case_item));
+			if (((*item_tail)->patterns = take_word_list(dc)) == NULL)
+				dc->bad = 1;
+			(*item_tail)->body = take_list(dc);
+			item_tail = &(*item_tail)->next;
+		}
+		//what running a node of its type relies on
+		if ((node->type == NODE_PIPELINE && node->pl == NULL)
+				|| ((node->type == NODE_AND || node->type == NODE_OR) && (node->cond == NULL || node->body == NULL))
+				|| ((node->type == NODE_FOR || node->type == NODE_CASE || node->type == NODE_FUNC) && node->name == NULL))
+			dc->bad = 1;
+		*tail = node;
+		tail = &node->next;
+	}
+	dc->depth--;
+	return head;
+}
+
+/* header a cache file of the script described by st must start with, path is its real path */
+static void init_header(struct cache_header *hdr, const struct stat *st)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	strncpy(hdr->build, CACHE_BUILD, sizeof(hdr->build) - 1);
+	hdr->src_size = st->st_size;
+	hdr->src_ino = st->st_ino;
+	hdr->src_mtime_sec = st->st_mtim.tv_sec;
+	hdr->src_mtime_nsec = st->st_mtim.tv_nsec;
+	hdr->format = CACHE_FORMAT;
+}
+
+/* decode commands of image of len bytes into image_arena, if it is a well-formed compiled script
+ * of path with header like hdr
+ * return command lists (NULL for a command to parse again), NULL if image is malformed
+ */
+static struct node **decode_image(char *image, size_t len, const struct cache_header *hdr, const char *path)
+{
+	const struct cache_header *img_hdr = (const struct cache_header *)image;
+	const struct cache_cmd *cmds;
+	struct decoder dc = {&image_arena};
+	struct node **lists;
+	size_t need;
+
+	if (len < sizeof(struct cache_header)
+			|| memcmp(img_hdr, hdr, offsetof(struct cache_header, path)) != 0)
+		return NULL;
+	need = sizeof(struct cache_header) + (size_t)img_hdr->cmd_count * sizeof(struct cache_cmd)
+			+ (size_t)img_hdr->recs_len * sizeof(uint32_t) + img_hdr->strs_len;
+	if (need != len || img_hdr->strs_len == 0)
+		return NULL;
+	cmds = (const struct cache_cmd *)(img_hdr + 1);
+	dc.recs = (const uint32_t *)(cmds + img_hdr->cmd_count);
+	dc.recs_len = img_hdr->recs_len;
+	dc.strs = (char *)(dc.recs + img_hdr->recs_len);
+	dc.strs_len = img_hdr->strs_len;
+	if (dc.strs[dc.strs_len - 1] != '\0' || img_hdr->path >= dc.strs_len
+			|| strcmp(dc.strs + img_hdr->path, path) != 0)
+		return NULL;
+
+	lists = arena_alloc(&image_arena, img_hdr->cmd_count * sizeof(struct node *));
+	for (size_t i = 0; i < img_hdr->cmd_count && !dc.bad; ++i) {
+		if (cmds[i].list == NO_LIST) {
+			lists[i] = NULL;
+			if (cmds[i].text >= dc.strs_len)
+				dc.bad = 1;
+			continue;
+		}
+		dc.pos = cmds[i].list;
+		if ((lists[i] = take_list(&dc)) == NULL)
+			dc.bad = 1;
+	}
+	if (dc.bad) {
+		arena_reset(&image_arena);
+		return NULL;
+	}
+	return lists;
+}
+
+/* run compiled script whose commands decode_image() has returned */
+static void run_image(char *image, struct node **lists)
+{
+	const struct cache_header *hdr = (const struct cache_header *)image;
+	const struct cache_cmd *cmds = (const struct cache_cmd *)(hdr + 1);
+	char *strs = image + sizeof(*hdr) + hdr->cmd_count * sizeof(struct cache_cmd) + hdr->recs_len * sizeof(uint32_t);
+
+	for (size_t i = 0; i < hdr->cmd_count; ++i) {
+		if (lists[i] == NULL)
+			do_cmd(strs + cmds[i].text);
+		else
+			do_parsed_cmd(lists[i]);
+	}
+	arena_reset(&image_arena);
+}
+
+/* cache dir, created (along with its parent) if it doesn't exist, NULL if it can't be */
+static char *cache_dir()
+{
+	const char *xdg = vars_get("XDG_CACHE_HOME");
+	char *base, *dir;
+
+	if (xdg != NULL && *xdg == '/')
+		base = strdup(xdg);
+	else if (asprintf(&base, "%s/.cache", get_home_dir()) == -1)
+		base = NULL;
+	if (base == NULL)
+		return NULL;
+	mkdir(base, 0700);
+	if (asprintf(&dir, "%s/%s", base, CACHE_DIR) == -1)
+		dir = NULL;
+	free(base);
+	if (dir != NULL && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = write(fd, data, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* replace cache file with image, a failure only costs the next run a compile */
+static void store_image(const char *cache_path, const char *image, size_t len)
+{
+	char *tmp_path;
+	int fd;
+
+	if (asprintf(&tmp_path, "%s.XXXXXX", cache_path) == -1)
+		return;
+	if ((fd = mkstemp(tmp_path)) == -1) {
+		free(tmp_path);
+		return;
+	}
+	if (write_all(fd, image, len) != 0 || close(fd) != 0 || rename(tmp_path, cache_path) != 0)
+		unlink(tmp_path);
+	free(tmp_path);
+}
+
+/* read all of script (st_size bytes) from fd, NULL if it can't be read or has changed size */
+static char *read_script(int fd, size_t size)
+{
+	char *text;
+	size_t got = 0;
+	ssize_t ret;
+
+	if ((text = malloc(size + 1)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate script buffer: %m");
+		exit(EXIT_FAILURE);
+	}
+	while ((ret = read(fd, text + got, size + 1 - got)) != 0) {
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 || (got += ret) > size) {
+			free(text);
+			return NULL;
+		}
+	}
+	if (got != size) {
+		free(text);
+		return NULL;
+	}
+	text[size] = '\0';
+	return text;
+}
+
+/* add command of text, parsed as a whole, to img, or keep text pending if more may complete it */
+static int compile_cmd(struct image *img, struct arena *arena, const char *text, int more)
+{
+	struct node *list;
+	int result = parse_program(arena, text, more, &list);
+
+	if (result == 0 && list != NULL) {
+		put_word(&img->cmds, NO_STR);
+		put_word(&img->cmds, img->recs.len / sizeof(uint32_t));
+		put_list(img, list);
+	} else if (result == -1) {
+		put_word(&img->cmds, put_str(img, text));
+		put_word(&img->cmds, NO_LIST);
+	}
+	arena_reset(arena);
+	return result;
+}
+
+/* compile script text into img, lines are gathered into commands as do_batch_line() does
+ * return number of commands
+ */
+static uint32_t compile_script(struct image *img, char *text, size_t size)
+{
+	struct arena parse_arena = {NULL, 0};
+	struct str_buf pending = {NULL, 0, 0};
+	char *line, *nl, *end = text + size, *cmd_text;
+	size_t length;
+	int complete;
+
+	parse_set_quiet(1);
+	for (line = text; line < end; line = nl + 1) {
+		if ((nl = memchr(line, '\n', end - line)) == NULL)
+			nl = end;
+		*nl = '\0';
+		if (pending.len == 0) {
+			if ((cmd_text = batch_line_text(line, nl - line)) != NULL
+					&& compile_cmd(img, &parse_arena, cmd_text, 1) == PARSE_INCOMPLETE)
+				str_buf_append(&pending, cmd_text, strlen(cmd_text));
+			continue;
+		}
+		if ((length = nl - line) > 0 && line[length - 1] == '\r')
+			line[--length] = '\0';
+		complete = parse_may_complete(line);
+		str_buf_append(&pending, "\n", 1);
+		str_buf_append(&pending, line, length);
+		if (complete && compile_cmd(img, &parse_arena, pending.data, 1) != PARSE_INCOMPLETE)
+			pending.len = 0;
+	}
+	if (pending.len > 0)
+		compile_cmd(img, &parse_arena, pending.data, 0);
+	parse_set_quiet(0);
+	arena_free(&parse_arena);
+	free(pending.data);
+	return img->cmds.len / sizeof(struct cache_cmd);
+}
+
+/* compile script read from fd into a malloc()ed image, *len is set to its size
+ * return NULL if script can't be read in one piece or doesn't fit the format
+ */
+static char *build_image(int fd, const struct stat *st, const char *path, size_t *len)
+{
+	struct image img = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}};
+	struct cache_header hdr;
+	struct stat after;
+	char *text, *image = NULL;
+
+	if ((text = read_script(fd, st->st_size)) == NULL)
+		return NULL;
+	init_header(&hdr, st);
+	hdr.path = put_str(&img, path);
+	hdr.cmd_count = compile_script(&img, text, st->st_size);
+	free(text);
+	//script must not have changed while it was read, and offsets must fit
+	if (fstat(fd, &after) == 0 && after.st_size == st->st_size
+			&& after.st_mtim.tv_sec == st->st_mtim.tv_sec && after.st_mtim.tv_nsec == st->st_mtim.tv_nsec
+			&& img.strs.len < UINT32_MAX && img.recs.len / sizeof(uint32_t) < UINT32_MAX) {
+		hdr.recs_len = img.recs.len / sizeof(uint32_t);
+		hdr.strs_len = img.strs.len;
+		*len = sizeof(hdr) + img.cmds.len + img.recs.len + img.strs.len;
+		if ((image = malloc(*len)) == NULL) {
+			syslog(LOG_ERR, "Can't allocate compiled script: %m");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(image, &hdr, sizeof(hdr));
+		memcpy(image + sizeof(hdr), img.cmds.data, img.cmds.len);
+		memcpy(image + sizeof(hdr) + img.cmds.len, img.recs.data, img.recs.len);
+		memcpy(image + sizeof(hdr) + img.cmds.len + img.recs.len, img.strs.data, img.strs.len);
+	}
+	free(img.cmds.data);
+	free(img.recs.data);
+	free(img.strs.data);
+	return image;
+}
+
+/* map cache file at cache_path if it holds the current compiled script, NULL otherwise
+ * mapping is private and writable, words decoded from it into *lists are used in place
+ */
+static char *map_image(const char *cache_path, const struct cache_header *hdr, const char *path, size_t *len,
+		struct node ***lists)
+{
+	struct stat st;
+	char *image;
+	int fd;
+
+	if ((fd = open(cache_path, O_RDONLY | O_CLOEXEC)) == -1)
+		return NULL;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+			|| (size_t)st.st_size < sizeof(struct cache_header)) {
+		close(fd);
+		return NULL;
+	}
+	*len = st.st_size;
+	image = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return NULL;
+	if ((*lists = decode_image(image, *len, hdr, path)) == NULL) {
+		munmap(image, *len);
+		return NULL;
+	}
+	return image;
+}
+
+/* run script at path, already opened as fd, from its compiled form, compiling and caching it
+ * first if the cache has no current one
+ * return 0 if script has been run, -1 if it can't be compiled (not a regular file, say),
+ * then fd is back at its start for running it line by line
+ */
+int script_cache_run(const char *path, int fd)
+{
+	char real_path[PATH_MAX], *dir, *cache_path = NULL, *image;
+	struct node **lists;
+	struct cache_header hdr;
+	struct stat st;
+	size_t len;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || realpath(path, real_path) == NULL)
+		return -1;
+	init_header(&hdr, &st);
+	if ((dir = cache_dir()) != NULL) {
+		if (asprintf(&cache_path, "%s/%016llx.nsc", dir, (unsigned long long)hash_path(real_path)) == -1)
+			cache_path = NULL;
+		free(dir);
+	}
+
+	if (cache_path != NULL && (image = map_image(cache_path, &hdr, real_path, &len, &lists)) != NULL) {
+		free(cache_path);
+		run_image(image, lists);
+		munmap(image, len);
+		return 0;
+	}
+
+	if ((image = build_image(fd, &st, real_path, &len)) == NULL
+			|| (lists = decode_image(image, len, &hdr, real_path)) == NULL) {
+		free(image);
+		free(cache_path);
+		lseek(fd, 0, SEEK_SET);
+		return -1;
+	}
+	if (cache_path != NULL)
+		store_image(cache_path, image, len);
+	free(cache_path);
+	run_image(image, lists);
+	free(image);
+	return 0;
+}
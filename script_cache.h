@@ -0,0 +1,6 @@
+#ifndef NSPT_SCRIPT_CACHE
+#define NSPT_SCRIPT_CACHE
+
+int script_cache_run(const char *path, int fd);
+
+#endif
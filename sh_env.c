@@ -13,49 +13,409 @@
 #include <sys/utsname.h>
 #include <pwd.h>
 #include <ctype.h>
+#include <poll.h>
 #include "exec_cmd.h"
 #include "signal_handler.h"
 #include "tools.h"
-
-int sigchld_handler_pipe[2] = {-1, -1};
+#include "prompt.h"
+#include "jobserver.h"
+#include "vars.h"
 
 #define PATH_MAX_LEN_GUESS    1024
-#define BG_LIST_ORIG_MAX      10
+#define CHILD_EVENT_BATCH     64
+#define JOB_SLAB_SIZE         64
+#define JOB_INDEX_ORIG_SIZE   64
+#define JOB_CMD_INLINE_LEN    48
+#define MEMBER_INDEX_ORIG_SIZE 64
+#define STATUS_NOT_FOUND      127
+#define PROMPT_DEFAULT        "\\[\\e[1;32m\\]\\u@\\H\\[\\e[0m\\]:\\[\\e[1;34m\\]\\w\\[\\e[0m\\]$ "
 
 struct job_info {
+	int id;                       //stable job id, referred as %id
 	char state;
-	int output_state;
+	int output_state;             //non-zero if state change hasn't been reported
+	pid_t pgid;
+	const char *cmd;              //points to cmd_inline unless command is longer
+	char *cmd_long;               //buffer for longer commands, kept when record is recycled
+	size_t cmd_long_cap;
+	struct job_info *hash_next;   //next job in pgid index bucket, or in free list
+	struct job_info *prev, *next; //job list in id order
+	int members_left;             //processes of job not exited yet
+	int status, status_stage;     //exit code of the end process and its stage index
+	int pipefail_status, pipefail_stage;
+	struct timespec start;
+	struct job_usage usage;
+	char cmd_inline[JOB_CMD_INLINE_LEN];
+};
+
+/* every process of a job, indexed by pid with open addressing (linear probing),
+ * it maps child events to the job and pipeline stage they belong to
+ */
+struct job_member {
+	pid_t pid;                    //0 means empty slot
 	pid_t pgid;
-	const char *cmd;
+	int stage;
 };
 
-static struct job_info exited_job = {'e', 0, 0, NULL};
+struct member_index {
+	struct job_member *slots;
+	size_t cap, count;
+};
+
+/* job records are carved from slabs and recycled through a free list,
+ * looked up by pgid through a chained hash index and by id through an array
+ * a new job takes the lowest free id, so the id array is as long as the most jobs alive at once,
+ * freed ids below the highest one given out wait in a min-heap, so picking one costs O(log n),
+ * the job list is kept in id order
+ */
+struct job_slab {
+	struct job_slab *next;
+	struct job_info jobs[JOB_SLAB_SIZE];
+};
+
+struct job_table {
+	struct job_slab *slabs;
+	struct job_info *free_jobs;
+	struct job_info **pgid_index;
+	size_t bucket_count, count, notice_count;
+	struct job_info **id_index;
+	int id_max, id_next;  //every id from id_next up is free, free ids below it are in id_heap
+	int *id_heap;         //min-heap of id_heap_len ids, room for id_max
+	size_t id_heap_len;
+	struct job_info *head, *tail;
+};
 
 static struct nspt_sh_env {
+	int interactive;
 	char *cwd;
 	long cwd_len_max;
-	char *prompt_format;
+	unsigned long cwd_gen;   //changes whenever cwd does, prompt renders cwd again only then
+	size_t prompt_width;
 	struct utsname sys_info;
 	struct passwd user_info;
-	struct job_info fg_job;
-	struct job_info *bg_jobs;
-	size_t bg_count, bg_max;
+	struct job_info *fg_job;
+	struct job_table jobs;
+	struct member_index members;
+	struct str_buf job_out;
+	int last_status, pipefail;
 } *sh_env = NULL;
 
 static void init_job_ctl()
 {
-	assert(sh_env != NULL && sh_env->bg_jobs == NULL);
+	assert(sh_env != NULL);
 
-	sh_env->bg_count = 0;
-	sh_env->bg_max = BG_LIST_ORIG_MAX;
-	sh_env->bg_jobs = malloc(BG_LIST_ORIG_MAX * sizeof(struct job_info));
-	if (sh_env->bg_jobs == NULL) {
-		syslog(LOG_ERR, "Can't allocate background processes list: %m");
+	struct job_table *table = &sh_env->jobs;
+
+	memset(table, 0, sizeof(struct job_table));
+	table->bucket_count = JOB_INDEX_ORIG_SIZE;
+	table->id_max = JOB_INDEX_ORIG_SIZE;
+	table->id_next = 1;
+	table->pgid_index = calloc(table->bucket_count, sizeof(struct job_info *));
+	table->id_index = calloc(table->id_max + 1, sizeof(struct job_info *));
+	table->id_heap = malloc(table->id_max * sizeof(int));
+	if (table->pgid_index == NULL || table->id_index == NULL || table->id_heap == NULL) {
+		syslog(LOG_ERR, "Can't allocate job index: %m");
 		exit(EXIT_FAILURE);
 	}
+	memset(&sh_env->job_out, 0, sizeof(struct str_buf));
+	sh_env->fg_job = NULL;
+	sh_env->last_status = 0;
+	sh_env->pipefail = 0;
+
+	sh_env->members.cap = MEMBER_INDEX_ORIG_SIZE;
+	sh_env->members.count = 0;
+	if ((sh_env->members.slots = calloc(sh_env->members.cap, sizeof(struct job_member))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate job member index: %m");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static size_t member_slot(pid_t pid, size_t cap)
+{
+	return ((size_t)pid * 2654435761U) & (cap - 1);
+}
+
+static struct job_member *find_member(pid_t pid)
+{
+	struct member_index *index = &sh_env->members;
+
+	for (size_t i = member_slot(pid, index->cap); index->slots[i].pid != 0; i = (i + 1) & (index->cap - 1)) {
+		if (index->slots[i].pid == pid)
+			return &index->slots[i];
+	}
+	return NULL;
+}
 
-	sh_env->fg_job.pgid = 0;
-	sh_env->fg_job.cmd = NULL;
+static void add_member(pid_t pid, pid_t pgid, int stage)
+{
+	struct member_index *index = &sh_env->members;
+	struct job_member *old = index->slots;
+	size_t old_cap = index->cap, i;
+
+	if ((index->count + 1) * 2 > index->cap) {
+		index->cap *= 2;
+		if ((index->slots = calloc(index->cap, sizeof(struct job_member))) == NULL) {
+			syslog(LOG_ERR, "Can't reallocate job member index: %m");
+			exit(EXIT_FAILURE);
+		}
+		index->count = 0;
+		for (i = 0; i < old_cap; ++i) {
+			if (old[i].pid != 0)
+				add_member(old[i].pid, old[i].pgid, old[i].stage);
+		}
+		free(old);
+	}
+
+	for (i = member_slot(pid, index->cap); index->slots[i].pid != 0; i = (i + 1) & (index->cap - 1));
+	index->slots[i].pid = pid;
+	index->slots[i].pgid = pgid;
+	index->slots[i].stage = stage;
+	index->count++;
+}
+
+/* remove member and shift following entries of the probe run back, so no tombstone is needed */
+static void remove_member(struct job_member *member)
+{
+	struct member_index *index = &sh_env->members;
+	size_t mask = index->cap - 1, hole = member - index->slots, i, home;
+
+	for (i = (hole + 1) & mask; index->slots[i].pid != 0; i = (i + 1) & mask) {
+		home = member_slot(index->slots[i].pid, index->cap);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			index->slots[hole] = index->slots[i];
+			hole = i;
+		}
+	}
+	index->slots[hole].pid = 0;
+	index->count--;
+}
+
+static void timespec_diff(const struct timespec *start, struct timespec *result)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	result->tv_sec = now.tv_sec - start->tv_sec;
+	result->tv_nsec = now.tv_nsec - start->tv_nsec;
+	if (result->tv_nsec < 0) {
+		result->tv_sec--;
+		result->tv_nsec += 1000000000L;
+	}
+}
+
+static void add_usage(struct job_usage *usage, const struct rusage *ru)
+{
+	timeradd(&usage->utime, &ru->ru_utime, &usage->utime);
+	timeradd(&usage->stime, &ru->ru_stime, &usage->stime);
+	if (ru->ru_maxrss > usage->maxrss)
+		usage->maxrss = ru->ru_maxrss;
+	usage->nvcsw += ru->ru_nvcsw;
+	usage->nivcsw += ru->ru_nivcsw;
+}
+
+/* record exit code of stage, job status comes from the end stage,
+ * pipefail status from the last stage exited with non-zero code
+ */
+static void set_stage_status(struct job_info *job, int stage, int exit_code)
+{
+	if (stage >= job->status_stage) {
+		job->status = exit_code;
+		job->status_stage = stage;
+	}
+	if (exit_code != 0 && stage >= job->pipefail_stage) {
+		job->pipefail_status = exit_code;
+		job->pipefail_stage = stage;
+	}
+}
+
+static size_t pgid_bucket(pid_t pgid)
+{
+	return ((size_t)pgid * 2654435761U) & (sh_env->jobs.bucket_count - 1);
+}
+
+static void grow_pgid_index()
+{
+	struct job_table *table = &sh_env->jobs;
+	struct job_info *job;
+
+	free(table->pgid_index);
+	table->bucket_count *= 2;
+	if ((table->pgid_index = calloc(table->bucket_count, sizeof(struct job_info *))) == NULL) {
+		syslog(LOG_ERR, "Can't reallocate job index: %m");
+		exit(EXIT_FAILURE);
+	}
+	for (job = table->head; job != NULL; job = job->next) {
+		size_t idx = pgid_bucket(job->pgid);
+		job->hash_next = table->pgid_index[idx];
+		table->pgid_index[idx] = job;
+	}
+}
+
+static struct job_info *find_job(pid_t pgid)
+{
+	struct job_info *job;
+
+	for (job = sh_env->jobs.pgid_index[pgid_bucket(pgid)]; job != NULL; job = job->hash_next) {
+		if (job->pgid == pgid)
+			return job;
+	}
+	return NULL;
+}
+
+static void set_notice(struct job_info *job, int output_state)
+{
+	if (job->output_state == output_state)
+		return;
+	job->output_state = output_state;
+	if (output_state)
+		sh_env->jobs.notice_count++;
+	else
+		sh_env->jobs.notice_count--;
+}
+
+static void push_free_id(struct job_table *table, int id)
+{
+	size_t i = table->id_heap_len++, parent;
+
+	for (; i > 0 && table->id_heap[parent = (i - 1) / 2] > id; i = parent)
+		table->id_heap[i] = table->id_heap[parent];
+	table->id_heap[i] = id;
+}
+
+static int pop_free_id(struct job_table *table)
+{
+	int top = table->id_heap[0], last = table->id_heap[--table->id_heap_len];
+	size_t i = 0, child;
+
+	while ((child = i * 2 + 1) < table->id_heap_len) {
+		if (child + 1 < table->id_heap_len && table->id_heap[child + 1] < table->id_heap[child])
+			++child;
+		if (last <= table->id_heap[child])
+			break;
+		table->id_heap[i] = table->id_heap[child];
+		i = child;
+	}
+	table->id_heap[i] = last;
+	return top;
+}
+
+/* take a record from free list, it gets the lowest free job id and is indexed by pgid */
+static struct job_info *alloc_job(pid_t pgid, const char *cmd)
+{
+	struct job_table *table = &sh_env->jobs;
+	struct job_info *job, *prev;
+	struct job_slab *slab;
+	struct job_member *member;
+	size_t cmd_len = strlen(cmd) + 1, idx;
+	int id;
+
+	if (table->free_jobs == NULL) {
+		if ((slab = malloc(sizeof(struct job_slab))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate job slab: %m");
+			exit(EXIT_FAILURE);
+		}
+		slab->next = table->slabs;
+		table->slabs = slab;
+		for (size_t i = 0; i < JOB_SLAB_SIZE; ++i) {
+			slab->jobs[i].cmd_long = NULL;
+			slab->jobs[i].cmd_long_cap = 0;
+			slab->jobs[i].hash_next = table->free_jobs;
+			table->free_jobs = &slab->jobs[i];
+		}
+	}
+	job = table->free_jobs;
+	table->free_jobs = job->hash_next;
+
+	if (cmd_len <= JOB_CMD_INLINE_LEN) {
+		job->cmd = memcpy(job->cmd_inline, cmd, cmd_len);
+	} else {
+		if (cmd_len > job->cmd_long_cap) {
+			job->cmd_long_cap = cmd_len * 2;
+			if ((job->cmd_long = realloc(job->cmd_long, job->cmd_long_cap)) == NULL) {
+				syslog(LOG_ERR, "Can't allocate job cmd buffer: %m");
+				exit(EXIT_FAILURE);
+			}
+		}
+		job->cmd = memcpy(job->cmd_long, cmd, cmd_len);
+	}
+	job->pgid = pgid;
+	job->state = 'r';
+	job->output_state = 0;
+	job->status = 0;
+	job->status_stage = -1;
+	job->pipefail_status = 0;
+	job->pipefail_stage = -1;
+	memset(&job->usage, 0, sizeof(struct job_usage));
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	//group leader is a member by itself, set_job_members() adds the others
+	job->members_left = 1;
+	if ((member = find_member(pgid)) != NULL) { //stale entry of a dropped job
+		member->pgid = pgid;
+		member->stage = 0;
+	} else {
+		add_member(pgid, pgid, 0);
+	}
+
+	if (table->id_heap_len > 0)
+		id = pop_free_id(table);
+	else if ((id = table->id_next++) > table->id_max) {
+		table->id_max *= 2;
+		table->id_index = realloc(table->id_index, (table->id_max + 1) * sizeof(struct job_info *));
+		table->id_heap = realloc(table->id_heap, table->id_max * sizeof(int));
+		if (table->id_index == NULL || table->id_heap == NULL) {
+			syslog(LOG_ERR, "Can't reallocate job id index: %m");
+			exit(EXIT_FAILURE);
+		}
+		memset(table->id_index + id, 0, (table->id_max + 1 - id) * sizeof(struct job_info *));
+	}
+	job->id = id;
+	table->id_index[id] = job;
+	prev = id > 1 ? table->id_index[id - 1] : NULL; //every lower id is taken
+	job->prev = prev;
+	job->next = prev != NULL ? prev->next : table->head;
+	if (job->next)
+		job->next->prev = job;
+	else
+		table->tail = job;
+	if (prev)
+		prev->next = job;
+	else
+		table->head = job;
+
+	if (++table->count > table->bucket_count / 4 * 3)
+		grow_pgid_index();
+	else {
+		idx = pgid_bucket(pgid);
+		job->hash_next = table->pgid_index[idx];
+		table->pgid_index[idx] = job;
+	}
+	return job;
+}
+
+static void free_job(struct job_info *job)
+{
+	struct job_table *table = &sh_env->jobs;
+	struct job_info **link;
+
+	for (link = &table->pgid_index[pgid_bucket(job->pgid)]; *link != job; link = &(*link)->hash_next);
+	*link = job->hash_next;
+	if (job->prev)
+		job->prev->next = job->next;
+	else
+		table->head = job->next;
+	if (job->next)
+		job->next->prev = job->prev;
+	else
+		table->tail = job->prev;
+	table->id_index[job->id] = NULL;
+	push_free_id(table, job->id);
+	table->count--;
+
+	set_notice(job, 0);
+	if (sh_env->fg_job == job)
+		sh_env->fg_job = NULL;
+	job->hash_next = table->free_jobs;
+	table->free_jobs = job;
 }
 
 static void init_cwd_buf()
@@ -101,7 +461,7 @@ static void init_sys_info()
 	}
 }
 
-void env_init()
+void env_init(int interactive)
 {
 	assert(sh_env == NULL);
 
@@ -112,39 +472,76 @@ void env_init()
 		exit(EXIT_FAILURE);
 	}
 
+	sh_env->interactive = interactive;
 	init_job_ctl();
 	init_cwd_buf();
 	init_user_info();
 	init_sys_info();
 	set_sig_process();
 
-	//format equal to "%s@%s:%s$ " --> "username@hostname:cwd$ "
-	//color specification see: ascii escape sequences
-	sh_env->prompt_format = "\033[1;32m%s@%s\033[0m:\033[1;34m%s\033[0m$ ";
+	sh_env->cwd_gen = 0;
 
-	setpgid(0, 0);
-	if (tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
-		syslog(LOG_ERR, "Can't be foreground process group leader: %m");
-		exit(EXIT_FAILURE);
+	if (interactive) {
+		setpgid(0, 0);
+		if (tcsetpgrp(STDIN_FILENO, getpid()) != 0) {
+			syslog(LOG_ERR, "Can't be foreground process group leader: %m");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	do_cmd("cd");
+	if (interactive)
+		do_cmd("cd");
+	else
+		update_cwd();
 }
 
-int is_bgpgid(pid_t pgid, size_t *index)
+/* return non-zero if shell reads commands from terminal,
+ * terminal control and job control handoff are skipped otherwise
+ */
+int is_interactive()
 {
-	assert(sh_env != NULL && sh_env->bg_jobs != NULL);
+	assert(sh_env != NULL);
 
-	int finded = 0;
-	for (size_t i = 0; i < sh_env->bg_count; ++i) {
-		if (sh_env->bg_jobs[i].pgid == pgid) {
-			if (index != NULL)
-				*index = i;
-			finded = 1;
-			break;
-		}
+	return sh_env->interactive;
+}
+
+/* forked shell running part of a job (a compound command in a pipeline, say) leaves
+ * terminal to the job it is in
+ */
+void leave_interactive()
+{
+	assert(sh_env != NULL);
+
+	sh_env->interactive = 0;
+}
+
+int is_bgpgid(pid_t pgid)
+{
+	assert(sh_env != NULL);
+
+	struct job_info *job = find_job(pgid);
+	return job != NULL && job != sh_env->fg_job;
+}
+
+/* translate job specification to pgid of a background job
+ * spec is "%id" or a pgid, return 0 if there is no such job
+ */
+pid_t job_spec_to_pgid(const char *spec)
+{
+	assert(sh_env != NULL && spec != NULL);
+
+	struct job_info *job = NULL;
+	long long id;
+
+	if (spec[0] == '%') {
+		id = atoll(spec + 1);
+		if (id > 0 && id <= sh_env->jobs.id_max)
+			job = sh_env->jobs.id_index[id];
+	} else {
+		id = atoll(spec);
+		job = find_job((pid_t)(id < 0 ? -id : id));
 	}
-	return finded;
+	return job != NULL && job != sh_env->fg_job ? job->pgid : 0;
 }
 
 void update_cwd()
@@ -166,16 +563,7 @@ void update_cwd()
 		syslog(LOG_ERR, "Can't get current working dir: %m");
 		exit(EXIT_FAILURE);
 	}
-
-	if (strstr(sh_env->cwd, sh_env->user_info.pw_dir) == sh_env->cwd) {
-		int cpy_idx = strlen(sh_env->user_info.pw_dir);
-		sh_env->cwd[0] = '~';
-		for (size_t i = 1; 1; ++cpy_idx, ++i) {
-			sh_env->cwd[i] = sh_env->cwd[cpy_idx];
-			if (sh_env->cwd[cpy_idx] == '\0')
-				break;
-		}
-	}
+	sh_env->cwd_gen++;
 }
 
 const char *get_home_dir()
@@ -185,7 +573,17 @@ const char *get_home_dir()
 	return sh_env->user_info.pw_dir;
 }
 
-/* update job control information
+/* return non-zero if some job is running or stopped, its processes may hold jobserver tokens */
+static int has_live_jobs()
+{
+	for (struct job_info *job = sh_env->jobs.head; job != NULL; job = job->next) {
+		if (job->state != 'e')
+			return 1;
+	}
+	return 0;
+}
+
+/* reap children and update job control information, events are handled in batches of CHILD_EVENT_BATCH
  * parameters:
  *     output:   if it is not zero, job state change information will output to stdout
  *     interest: a list contains jobs we are interest, if a job specified in this list has changed state,
@@ -196,119 +594,187 @@ const char *get_home_dir()
  */
 int update_job_state(int output, struct job_state *interest, size_t length)
 {
-	pid_t pgid = 0;
-	char state;
-	int ecode, read_ret; //ecode is temporary useless
-	size_t bg_index;
+	struct child_event events[CHILD_EVENT_BATCH];
+	size_t event_count;
 	struct job_state *interest_child;
+	struct job_member *member;
+	struct job_info *job;
+	char state;
+	int changed = 0, exited = 0;
 
 	for (size_t i = 0; i < length; ++i) {
 		interest[i].state = 0;
 	}
 
-	for (errno = 0, interest_child = NULL;
-	(read_ret = read(sigchld_handler_pipe[0], &pgid, sizeof(pid_t))) > 0;
-	interest_child = NULL) {
-		for (size_t i = 0; i < length; ++i) {
-			if (interest[i].pgid == pgid)
-				interest_child = &interest[i];
-		}
-		if ((read_ret = read(sigchld_handler_pipe[0], &state, sizeof(char))) <= 0) {
-			syslog(LOG_ERR, "read child state from sigchld_handler_pipe returned: %d: %m", read_ret);
-			exit(EXIT_FAILURE);
-		}
-		if (interest_child)
-			interest_child->state = state == 'c' ? 'r' : state;
-		if (state == 'e') { //child exited
-			if ((read_ret = read(sigchld_handler_pipe[0], &ecode, sizeof(int))) <= 0) {
-				syslog(LOG_ERR, "read child exit code from sigchld_handler_pipe returned: %d: %m", read_ret);
-				exit(EXIT_FAILURE);
+	do {
+		event_count = reap_children(events, CHILD_EVENT_BATCH);
+		for (size_t ev = 0; ev < event_count; ++ev) {
+			state = events[ev].state;
+			changed = 1;
+			if ((member = find_member(events[ev].pid)) == NULL)
+				continue;
+			if ((job = find_job(member->pgid)) == NULL) { //job has been dropped
+				if (state == 'e')
+					remove_member(member);
+				continue;
 			}
-			if (sh_env->fg_job.pgid == pgid) {
-				set_fg_job(0, NULL);
-			} else if (is_bgpgid(pgid, &bg_index)) {
-				sh_env->bg_jobs[bg_index].state = state;
-				sh_env->bg_jobs[bg_index].output_state = 1;
+
+			if (state == 'e') { //a process of job exited
+				add_usage(&job->usage, &events[ev].usage);
+				set_stage_status(job, member->stage, events[ev].exit_code);
+				remove_member(member);
+				if (--job->members_left > 0)
+					continue;
+				timespec_diff(&job->start, &job->usage.wall);
+			} else if (job->state == (state == 'c' ? 'r' : state)) {
+				continue;
+			} else if (state == 's') {
+				timespec_diff(&job->start, &job->usage.wall);
 			}
-		} else if (state == 's') { //child stoped
-			if (sh_env->fg_job.pgid == pgid) {
-				sh_env->fg_job.state = state;
-				sh_env->fg_job.output_state = 1;
-				fg2bg();
-			} else if (is_bgpgid(pgid, &bg_index)) {
-				sh_env->bg_jobs[bg_index].state = state;
-				sh_env->bg_jobs[bg_index].output_state = 1;
+
+			interest_child = NULL;
+			for (size_t i = 0; i < length; ++i) {
+				if (interest[i].pgid == job->pgid)
+					interest_child = &interest[i];
 			}
-		} else if (state == 'c') { //child continued
-			if (is_bgpgid(pgid, &bg_index)) {
-				sh_env->bg_jobs[bg_index].state = 'r';
-				sh_env->bg_jobs[bg_index].output_state = 1;
+			if (interest_child) {
+				interest_child->state = state == 'c' ? 'r' : state;
+				interest_child->status = job->status;
+				interest_child->pipefail_status = job->pipefail_status;
+				interest_child->usage = job->usage;
+			}
+
+			if (state == 'e') { //all processes of job exited
+				exited = 1;
+				if (sh_env->fg_job == job) {
+					set_fg_job(0, NULL);
+				} else {
+					job->state = state;
+					set_notice(job, 1);
+				}
+			} else if (state == 's') { //job stoped
+				job->state = state;
+				set_notice(job, 1);
+				if (sh_env->fg_job == job)
+					fg2bg();
+			} else if (state == 'c') { //job continued
+				job->state = 'r';
+				if (sh_env->fg_job != job)
+					set_notice(job, 1);
 			}
 		}
+	} while (event_count == CHILD_EVENT_BATCH);
+
+	if (exited && jobserver_active() && !has_live_jobs())
+		jobserver_reclaim();
+	if (output)
+		output_job_notices();
+	return changed;
+}
+
+/* return non-zero if some background jobs changed state and haven't been reported */
+int has_job_notices()
+{
+	assert(sh_env != NULL);
+
+	return sh_env->jobs.notice_count != 0;
+}
+
+/* format usage as "user 0.01s sys 0.00s maxrss 1024KB ctxsw 2/1 wall 0.12s" */
+void format_usage(char *buf, size_t length, const struct job_usage *usage)
+{
+	snprintf(buf, length, "user %ld.%02lds sys %ld.%02lds maxrss %ldKB ctxsw %ld/%ld wall %ld.%02lds",
+		(long)usage->utime.tv_sec, (long)usage->utime.tv_usec / 10000,
+		(long)usage->stime.tv_sec, (long)usage->stime.tv_usec / 10000,
+		usage->maxrss, usage->nvcsw, usage->nivcsw,
+		(long)usage->wall.tv_sec, usage->wall.tv_nsec / 10000000);
+}
+
+/* append one line describing job to job output buffer, exited job is removed from table
+ * long format also shows resource usage of exited processes of job
+ */
+static void format_job(struct job_info *job, int long_format)
+{
+	char usage_str[160];
+	
+	const char *state_str;
+
+	switch (job->state) {
+		case 's':
+			state_str = "stoped";
+			break;
+		case 'e':
+			state_str = "exited";
+			break;
+		default:
+			state_str = "running";
+			break;
 	}
+	if (long_format) {
+		if (job->state == 'r')
+			timespec_diff(&job->start, &job->usage.wall);
+		format_usage(usage_str, sizeof(usage_str), &job->usage);
+		str_buf_printf(&sh_env->job_out, "[%d]\t%lu\t %s\t %s", job->id, (unsigned long)job->pgid, job->cmd, state_str);
+		if (job->state == 'e')
+			str_buf_printf(&sh_env->job_out, " (%d)", job->status);
+		str_buf_printf(&sh_env->job_out, "\t %s\n", usage_str);
+	} else {
+		str_buf_printf(&sh_env->job_out, "[%d]\t%lu\t %s\t %s\n", job->id, (unsigned long)job->pgid, job->cmd, state_str);
+	}
+	set_notice(job, 0);
+	if (job->state == 'e')
+		free_job(job);
+}
 
-	if (errno != 0 && errno != EAGAIN && errno != EAGAIN) {
-		syslog(LOG_ERR, "read pid from sigchld_handler_pipe failed: %m");
-		exit(EXIT_FAILURE);
+/* report background jobs changed state since last report, exited jobs are removed */
+void output_job_notices()
+{
+	assert(sh_env != NULL);
+
+	struct job_info *job, *next;
+
+	if (sh_env->jobs.notice_count == 0)
+		return;
+	for (job = sh_env->jobs.head; job != NULL; job = next) {
+		next = job->next;
+		if (job->output_state && job != sh_env->fg_job)
+			format_job(job, 0);
 	}
+	str_buf_flush(&sh_env->job_out);
+}
 
-	if (output) {
-		for (size_t i = 0; i < sh_env->bg_count; ++i) {
-			if (!sh_env->bg_jobs[i].output_state)
-				continue;
-			sh_env->bg_jobs[i].output_state = 0;
-			switch (sh_env->bg_jobs[i].state) {
-				case 's':
-					printf("%lu\t %s\t stoped\n", (unsigned long)sh_env->bg_jobs[i].pgid, sh_env->bg_jobs[i].cmd);
-					break;
-				case 'r':
-					printf("%lu\t %s\t running\n", (unsigned long)sh_env->bg_jobs[i].pgid, sh_env->bg_jobs[i].cmd);
-					break;
-				case 'e':
-					printf("%lu\t %s\t exited\n", (unsigned long)sh_env->bg_jobs[i].pgid, sh_env->bg_jobs[i].cmd);
-					free((void *)sh_env->bg_jobs[i].cmd);
-					sh_env->bg_jobs[i--] = sh_env->bg_jobs[sh_env->bg_count - 1]; //i-- because the last job hasn't handle
-					sh_env->bg_count--;
-					break;
-			}
+/* wait until job stops or exits, other children are reaped meanwhile
+ * job->state is set to 'e' or 's'
+ */
+void wait_job(struct job_state *job)
+{
+	struct pollfd chld_poll = {sigchld_fd, POLLIN, 0};
+
+	while (1) {
+		update_job_state(0, job, 1);
+		if (job->state == 'e' || job->state == 's')
+			break;
+		if (poll(&chld_poll, 1, -1) == -1 && errno != EINTR) {
+			syslog(LOG_ERR, "Can't poll sigchld_fd: %m");
+			exit(EXIT_FAILURE);
 		}
 	}
-	return pgid == 0 ? 0 : 1;
 }
 
 void set_bg_job(pid_t pgid, const char *cmd, int option)
 {
-	struct job_info *bg = sh_env->bg_jobs;
-	size_t *count = &(sh_env->bg_count), *max = &(sh_env->bg_max);
+	assert(sh_env != NULL);
+
+	struct job_info *job;
+
 	if (option == BG_ADD) {
-		char *tmp = malloc(strlen(cmd) + 1);
-		if (tmp == NULL) {
-			syslog(LOG_ERR, "Can't allocate fg_job cmd buffer: %m");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(tmp, cmd);
-	
-		if (*count == sh_env->bg_max) {
-			*max *= 2;
-			bg = realloc(bg, *max * sizeof(struct job_info));
-			if (bg == NULL) {
-				syslog(LOG_ERR, "Can't reallocate bg_jobs memory: %m");
-				exit(EXIT_FAILURE);
-			}
-		}
-		bg[*count].cmd = tmp;
-		bg[*count].pgid = pgid;
-		bg[*count].state = 'r';
-		bg[*count].output_state = 1;
-		(*count)++;
+		job = alloc_job(pgid, cmd);
+		set_notice(job, 1);
+	} else if (option == BG_QUIET) {
+		alloc_job(pgid, cmd);
 	} else if (option == BG_RM) {
-		for (size_t i = 0; i < *count; ++i) {
-			if (bg[i].pgid == pgid) {
-				bg[i] = bg[*count - 1];
-				(*count)--;
-				break;
-			}
-		}
+		if ((job = find_job(pgid)) != NULL && job != sh_env->fg_job)
+			free_job(job);
 	}
 }
 
@@ -316,91 +782,121 @@ void set_fg_job(pid_t pgid, const char *cmd)
 {
 	assert(sh_env != NULL);
 
-	if (pgid == 0 || cmd == NULL) {
-		if (sh_env->fg_job.cmd)
-			free((void *)sh_env->fg_job.cmd);
-		sh_env->fg_job = exited_job;
+	if (sh_env->fg_job)
+		free_job(sh_env->fg_job);
+	if (pgid == 0 || cmd == NULL)
 		return;
-	}
-
-	char *tmp;
-	tmp = malloc(strlen(cmd) + 1);
-	if (tmp == NULL) {
-		syslog(LOG_ERR, "Can't allocate fg_job cmd buffer: %m");
-		exit(EXIT_FAILURE);
-	}
-	strcpy(tmp, cmd);
-	if (sh_env->fg_job.cmd)
-		free((void *)sh_env->fg_job.cmd);
-	sh_env->fg_job.cmd = tmp;
-	sh_env->fg_job.pgid = pgid;
-	sh_env->fg_job.state = 'r';
+	sh_env->fg_job = alloc_job(pgid, cmd);
 }
 
-void fg2bg()
+/* register processes of pipe job, stage_pids[i] is pid launched for stage i, 0 if stage wasn't launched */
+void set_job_members(pid_t pgid, const pid_t *stage_pids, size_t stage_count)
 {
-	assert(sh_env != NULL && sh_env->bg_jobs != NULL && sh_env->fg_job.cmd != NULL);
+	assert(sh_env != NULL);
 
-	struct job_info *fg = &(sh_env->fg_job);
-	struct job_info *bg = sh_env->bg_jobs;
-	size_t *count = &(sh_env->bg_count), *max = &(sh_env->bg_max);
+	struct job_info *job = find_job(pgid);
+	struct job_member *member;
 
-	if (*count == sh_env->bg_max) {
-		*max *= 2;
-		bg = realloc(bg, *max * sizeof(struct job_info));
-		if (bg == NULL) {
-			syslog(LOG_ERR, "Can't reallocate bg_jobs memory: %m");
-			exit(EXIT_FAILURE);
+	if (job == NULL)
+		return;
+	for (size_t i = 0; i < stage_count; ++i) {
+		if (stage_pids[i] == 0) {
+			set_stage_status(job, i, STATUS_NOT_FOUND);
+		} else if ((member = find_member(stage_pids[i])) != NULL) {
+			member->stage = i;
+		} else {
+			add_member(stage_pids[i], pgid, i);
+			job->members_left++;
 		}
 	}
-	bg[*count] = *fg;
-	(*count)++;
-	*fg = exited_job;
+}
+
+void fg2bg()
+{
+	assert(sh_env != NULL && sh_env->fg_job != NULL);
+
+	sh_env->fg_job = NULL;
 }
 
 int bg2fg(pid_t pgid)
 {
-	assert(sh_env != NULL && sh_env->bg_jobs != NULL && sh_env->fg_job.cmd == NULL);
+	assert(sh_env != NULL && sh_env->fg_job == NULL);
 
-	int result = 0;
+	struct job_info *job = find_job(pgid);
 
-	set_fg_job(0, NULL);
-	for (size_t i = 0; i < sh_env->bg_count; ++i) {
-		if (sh_env->bg_jobs[i].pgid == pgid) {
-			sh_env->fg_job = sh_env->bg_jobs[i];
-			sh_env->bg_jobs[i] = sh_env->bg_jobs[sh_env->bg_count - 1];
-			(sh_env->bg_count)--;
-			result = 1;
-			break;
-		}
-	}
-	return result;
-}
-
-void output_jobs()
-{
-	for (size_t i = 0; i < sh_env->bg_count; ++i) {
-		sh_env->bg_jobs[i].output_state = 0;
-		switch (sh_env->bg_jobs[i].state) {
-			case 's':
-				printf("%lu\t %s\t stoped\n", (unsigned long)sh_env->bg_jobs[i].pgid, sh_env->bg_jobs[i].cmd);
-				break;
-			case 'r':
-				printf("%lu\t %s\t running\n", (unsigned long)sh_env->bg_jobs[i].pgid, sh_env->bg_jobs[i].cmd);
-				break;
-			case 'e':
-				printf("%lu\t %s\t exited\n", (unsigned long)sh_env->bg_jobs[i].pgid, sh_env->bg_jobs[i].cmd);
-				free((void *)sh_env->bg_jobs[i].cmd);
-				if (sh_env->bg_jobs[i].pgid != sh_env->bg_jobs[sh_env->bg_count - 1].pgid)
-					sh_env->bg_jobs[i] = sh_env->bg_jobs[sh_env->bg_count - 1];
-				sh_env->bg_count--;
-				break;
-		}
+	if (job == NULL)
+		return 0;
+	set_notice(job, 0);
+	job->state = 'r';
+	sh_env->fg_job = job;
+	return 1;
+}
+
+void output_jobs(int long_format)
+{
+	assert(sh_env != NULL);
+
+	struct job_info *job, *next;
+
+	for (job = sh_env->jobs.head; job != NULL; job = next) {
+		next = job->next;
+		if (job != sh_env->fg_job)
+			format_job(job, long_format);
 	}
+	str_buf_flush(&sh_env->job_out);
+}
+
+int get_last_status()
+{
+	assert(sh_env != NULL);
+
+	return sh_env->last_status;
 }
 
+void set_last_status(int status)
+{
+	assert(sh_env != NULL);
+
+	sh_env->last_status = status;
+}
+
+int get_pipefail()
+{
+	assert(sh_env != NULL);
+
+	return sh_env->pipefail;
+}
+
+void set_pipefail(int enable)
+{
+	assert(sh_env != NULL);
+
+	sh_env->pipefail = enable;
+}
+
+/* print prompt ($PS1, see prompt.c) and remember how many columns it takes on terminal */
 void output_prompt()
 {
 	assert(sh_env != NULL);
-	fprintf(stdout, sh_env->prompt_format, sh_env->user_info.pw_name, sh_env->sys_info.nodename, sh_env->cwd);
+
+	const char *format = vars_get("PS1"), *text;
+	struct prompt_input in;
+	size_t length;
+
+	in.user = sh_env->user_info.pw_name;
+	in.host = sh_env->sys_info.nodename;
+	in.home = sh_env->user_info.pw_dir;
+	in.cwd = sh_env->cwd;
+	in.cwd_gen = sh_env->cwd_gen;
+	in.last_status = sh_env->last_status;
+	in.job_count = sh_env->jobs.count;
+	text = prompt_render(format != NULL ? format : PROMPT_DEFAULT, &in, &length, &sh_env->prompt_width);
+	fwrite(text, 1, length, stdout);
+}
+
+size_t get_prompt_width()
+{
+	assert(sh_env != NULL);
+
+	return sh_env->prompt_width;
 }
@@ -3,34 +3,54 @@
 
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
 
+/* resources used by all processes of a job */
+struct job_usage {
+	struct timeval utime, stime;
+	long maxrss;          //max resident set size of a single process, in KB
+	long nvcsw, nivcsw;   //voluntary and involuntary context switches
+	struct timespec wall; //elapsed time since job was launched
+};
+
+/* status and usage are valid when state is 'e' or 's' */
 struct job_state {
 	pid_t pgid;
 	char state;
+	int status;           //exit code of the end process
+	int pipefail_status;  //exit code of the last failed process, 0 if all succeeded
+	struct job_usage usage;
 };
 
-void env_init();
+void env_init(int interactive);
+int is_interactive();
+void leave_interactive();
 void update_cwd();
 const char *get_home_dir();
-int is_bgpgid(pid_t pgid, size_t *index);
+int is_bgpgid(pid_t pgid);
+pid_t job_spec_to_pgid(const char *spec);
 int update_job_state(int output, struct job_state *interest, size_t length);
+int has_job_notices();
+void output_job_notices();
+void wait_job(struct job_state *job);
 void set_fg_job(pid_t pgid, const char *cmd);
+void set_job_members(pid_t pgid, const pid_t *stage_pids, size_t stage_count);
 void set_bg_job(pid_t pgid, const char *cmd, int option);
 void fg2bg();
-void output_jobs();
+void output_jobs(int long_format);
+void format_usage(char *buf, size_t length, const struct job_usage *usage);
+int get_last_status();
+void set_last_status(int status);
+int get_pipefail();
+void set_pipefail(int enable);
 int bg2fg(pid_t pgid);
 void output_prompt();
+size_t get_prompt_width();
 
-/* this pipe is use for communication between SIGCHLD handler and normal process
- * SIGCHLD handler write child process(group) status to sigchld_handler_pipe[1]
- *     format: a pid_t:      child pid(equal to pgid and job id)
- *     followed by one char: 'e' is exit, 's' is stop, 'c' is continue
- *     followed by a int:    child exit code(if child terminated)
- * normal process will try to read sigchld_handler_pipe[0] in update_job_state()
- */
-extern int sigchld_handler_pipe[2];
 #define BG_ADD 0
 #define BG_RM  1
+#define BG_QUIET 2    //add without reporting it, for jobs run on behalf of a builtin
 #define SET_ECODE 1
 #define GET_ECODE 0
 
@@ -5,54 +5,74 @@
 #include <assert.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/signalfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include "sh_env.h"
 
+#define SIGINFO_BATCH 16
 
-#include <stdio.h>
-
-#define INT_STR_LEN_MAX(int_type) (sizeof(int_type) * 8 / 3 + 2) //enough length to hold string converted from int_type
+int sigchld_fd = -1;
 
 static struct sigaction r_int_act, r_quit_act, r_ttou_act, r_chld_act, r_term_act, r_pipe_act, r_stop_act, r_tstp_act;
 static sigset_t r_sig_mask;
 
-static void sig_child(int signo)
+/* clear SIGCHLD pending on sigchld_fd */
+void consume_sigchld()
+{
+	struct signalfd_siginfo info[SIGINFO_BATCH];
+
+	while (read(sigchld_fd, info, sizeof(info)) > 0);
+}
+
+/* reap children whose state changed since last call, pending SIGCHLD on sigchld_fd is consumed first,
+ * so a child changing state afterwards makes sigchld_fd readable again
+ * at most max events are stored, caller should call again if max events are returned
+ * return:
+ *     number of events stored in events
+ */
+size_t reap_children(struct child_event *events, size_t max)
 {
-	assert(sigchld_handler_pipe[0] != sigchld_handler_pipe[1]);
+	assert(sigchld_fd != -1);
 
 	pid_t chld_pid;
-	int term_stat, exit_code;
-	int olderr = errno;
-	//note: chld_pid is also child pgid and job id, we guarantee that in do_cmd()
-	while ((chld_pid = waitpid(-1, &term_stat, WCONTINUED | WNOHANG | WUNTRACED)) > 0) {
-		write(sigchld_handler_pipe[1], &chld_pid, sizeof(pid_t));
+	int term_stat;
+	size_t count = 0;
+
+	consume_sigchld();
+	//note: chld_pid of group leader is also child pgid and job id, we guarantee that in do_cmd()
+	while (count < max && (chld_pid = wait4(-1, &term_stat, WCONTINUED | WNOHANG | WUNTRACED, &events[count].usage)) > 0) {
+		events[count].pid = chld_pid;
+		events[count].exit_code = 0;
 		if (WIFEXITED(term_stat) || WIFSIGNALED(term_stat)) {
-			exit_code = WIFEXITED(term_stat) ? WEXITSTATUS(term_stat) : WTERMSIG(term_stat) + 255;
-			write(sigchld_handler_pipe[1], "e", 1);
-			write(sigchld_handler_pipe[1], &exit_code, sizeof(int));
-		}
-		else if (WIFSTOPPED(term_stat)) {
-			write(sigchld_handler_pipe[1], "s", 1);
-		}
-		else if (WIFCONTINUED(term_stat)) {
-			write(sigchld_handler_pipe[1], "c", 1);
+			events[count].state = 'e';
+			events[count].exit_code = WIFEXITED(term_stat) ? WEXITSTATUS(term_stat) : WTERMSIG(term_stat) + 128;
+		} else if (WIFSTOPPED(term_stat)) {
+			events[count].state = 's';
+		} else if (WIFCONTINUED(term_stat)) {
+			events[count].state = 'c';
+		} else {
+			continue;
 		}
+		count++;
 	}
-	errno = olderr;
+	return count;
 }
 
 void set_sig_process()
 {
-	assert(sigchld_handler_pipe[0] == sigchld_handler_pipe[1]);
+	assert(sigchld_fd == -1);
 
 	struct sigaction ign_act, chld_act;
-	sigset_t empty_mask;
+	sigset_t chld_mask;
 
-	if (pipe2(sigchld_handler_pipe, O_NONBLOCK) != 0) {
-		syslog(LOG_ERR, "Can't create pipe: sigchld_handler_pipe: %m");
+	/*SIGCHLD is kept blocked and read from sigchld_fd*/
+	sigemptyset(&chld_mask);
+	sigaddset(&chld_mask, SIGCHLD);
+	if ((sigchld_fd = signalfd(-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+		syslog(LOG_ERR, "Can't create signalfd: sigchld_fd: %m");
 		exit(EXIT_FAILURE);
 	}
 
@@ -68,20 +88,19 @@ void set_sig_process()
 	sigaction(SIGSTOP, &ign_act, &r_stop_act);
 	sigaction(SIGTSTP, &ign_act, &r_tstp_act);
 
-	/*cat SIGCHLD*/
-	chld_act.sa_handler = sig_child;
-	sigfillset(&chld_act.sa_mask);
-	chld_act.sa_flags = SA_RESTART;
+	/*SIGCHLD must not be ignored, or children are reaped by kernel*/
+	chld_act.sa_handler = SIG_DFL;
+	sigemptyset(&chld_act.sa_mask);
+	chld_act.sa_flags = 0;
 	sigaction(SIGCHLD, &chld_act, &r_chld_act);
 
-	/*unblock all mask*/
-	sigemptyset(&empty_mask);
-	sigprocmask(SIG_SETMASK, &empty_mask, &r_sig_mask);
+	/*block SIGCHLD only*/
+	sigprocmask(SIG_SETMASK, &chld_mask, &r_sig_mask);
 }
 
 void reset_sig_process()
 {
-	assert(sigchld_handler_pipe[0] != sigchld_handler_pipe[1]);
+	assert(sigchld_fd != -1);
 
 	sigaction(SIGTTOU, &r_ttou_act, NULL);
 	sigaction(SIGINT, &r_int_act, NULL);
@@ -93,3 +112,40 @@ void reset_sig_process()
 	sigaction(SIGSTOP, &r_stop_act, NULL);
 	sigprocmask(SIG_SETMASK, &r_sig_mask, NULL);
 }
+
+/* signals of a forked shell that runs commands of a job: dispositions are reset like
+ * reset_sig_process() does, but SIGCHLD stays blocked for sigchld_fd
+ */
+void reset_sig_subshell()
+{
+	sigset_t mask = r_sig_mask;
+
+	reset_sig_process();
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+/* posix_spawn equivalent of reset_sig_process():
+ *     sig_default: signals to be reset to SIG_DFL in child,
+ *                  signals the shell inherited as ignored stay ignored across exec
+ *     sig_mask:    signal mask the shell was started with
+ */
+void get_reset_sig_attr(sigset_t *sig_default, sigset_t *sig_mask)
+{
+	assert(sig_default != NULL && sig_mask != NULL);
+
+	const struct {
+		int signo;
+		struct sigaction *act;
+	} saved[] = {
+		{SIGTTOU, &r_ttou_act}, {SIGINT, &r_int_act}, {SIGQUIT, &r_quit_act}, {SIGTERM, &r_term_act},
+		{SIGCHLD, &r_chld_act}, {SIGPIPE, &r_pipe_act}, {SIGTSTP, &r_tstp_act}
+	};
+
+	sigemptyset(sig_default);
+	for (size_t i = 0; i < sizeof(saved) / sizeof(saved[0]); ++i) {
+		if (saved[i].act->sa_handler != SIG_IGN)
+			sigaddset(sig_default, saved[i].signo);
+	}
+	*sig_mask = r_sig_mask;
+}
@@ -1,5 +1,32 @@
 #ifndef NSPT_SIG_HANDLER
 #define NSPT_SIG_HANDLER
+
+#include <stddef.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* state change of one child, reaped by reap_children()
+ *     state:     'e' is exit, 's' is stop, 'c' is continue
+ *     exit_code: exit status, or 128 + signal number if child was killed
+ *     usage:     resource usage of child, valid if child exited
+ */
+struct child_event {
+	pid_t pid;
+	char state;
+	int exit_code;
+	struct rusage usage;
+};
+
+/* SIGCHLD is blocked in shell and delivered through this signalfd,
+ * it becomes readable when reap_children() has work to do
+ */
+extern int sigchld_fd;
+
 void set_sig_process();
 void reset_sig_process();
+void reset_sig_subshell();
+void consume_sigchld();
+size_t reap_children(struct child_event *events, size_t max);
+void get_reset_sig_attr(sigset_t *sig_default, sigset_t *sig_mask);
 #endif
\ No newline at end of file
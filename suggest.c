@@ -0,0 +1,182 @@
+#include "suggest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "history.h"
+
+#define SUGGEST_LOAD_MAX 20000 //newest history entries indexed at startup
+#define FREQ_WEIGHT      64    //each earlier use of a command counts as much as 64 newer commands
+
+/* past commands are kept in a radix tree, edge labels point into command text,
+ * each node remembers best ranked command below it, so a lookup is one walk down the prefix
+ * and ranking is never computed at lookup time,
+ * a command's rank only goes up when it is used again, so keeping best up to date
+ * is one comparison per node on the command's own path
+ */
+struct sugg_entry {
+	unsigned long seq, count;  //newest use and number of uses
+	size_t len;
+	char text[];
+};
+
+struct sugg_node {
+	const char *label;
+	size_t label_len;
+	struct sugg_node *child, *sibling;
+	struct sugg_entry *best, *entry;  //entry is the command ending at this node
+};
+
+static struct {
+	struct sugg_node root;
+	unsigned long seq;
+} sugg = {{"", 0, NULL, NULL, NULL, NULL}, SUGGEST_LOAD_MAX};
+
+static unsigned long score(const struct sugg_entry *entry)
+{
+	return entry->seq + FREQ_WEIGHT * (entry->count - 1);
+}
+
+static void bump(struct sugg_node *node, struct sugg_entry *entry)
+{
+	if (node->best == NULL || score(entry) >= score(node->best))
+		node->best = entry;
+}
+
+static struct sugg_node *new_node(const char *label, size_t label_len, struct sugg_node *child,
+		struct sugg_node *sibling, struct sugg_entry *best, struct sugg_entry *entry)
+{
+	struct sugg_node *node;
+
+	if ((node = malloc(sizeof(struct sugg_node))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate suggestion node: %m");
+		exit(EXIT_FAILURE);
+	}
+	node->label = label;
+	node->label_len = label_len;
+	node->child = child;
+	node->sibling = sibling;
+	node->best = best;
+	node->entry = entry;
+	return node;
+}
+
+/* find child of node whose label starts with ch, link is set to the pointer that refers to it */
+static struct sugg_node *find_child(struct sugg_node *node, char ch, struct sugg_node ***link)
+{
+	struct sugg_node **cur;
+
+	for (cur = &node->child; *cur != NULL && (*cur)->label[0] != ch; cur = &(*cur)->sibling);
+	if (link != NULL)
+		*link = cur;
+	return *cur;
+}
+
+static size_t common_len(const char *a, const char *b, size_t max)
+{
+	size_t len = 0;
+
+	while (len < max && a[len] == b[len])
+		++len;
+	return len;
+}
+
+/* record one use of command, seq orders uses, a larger seq is a newer use */
+static void add_use(const char *line, size_t length, unsigned long seq)
+{
+	struct sugg_node *node = &sugg.root, *child, **link;
+	struct sugg_entry *entry;
+	const char *text;
+	size_t pos = 0, common;
+
+	//walk existing path first, command may be known already
+	while (pos < length) {
+		if ((child = find_child(node, line[pos], NULL)) == NULL)
+			break;
+		common = common_len(child->label, line + pos, child->label_len < length - pos ? child->label_len : length - pos);
+		if (common < child->label_len)
+			break;
+		node = child;
+		pos += common;
+	}
+	if (pos == length && node->entry != NULL) {
+		entry = node->entry;
+		entry->count++;
+		if (seq > entry->seq)
+			entry->seq = seq;
+	} else {
+		if ((entry = malloc(sizeof(struct sugg_entry) + length)) == NULL) {
+			syslog(LOG_ERR, "Can't allocate suggestion entry: %m");
+			exit(EXIT_FAILURE);
+		}
+		entry->seq = seq;
+		entry->count = 1;
+		entry->len = length;
+		memcpy(entry->text, line, length);
+	}
+
+	text = entry->text;
+	node = &sugg.root;
+	pos = 0;
+	while (1) {
+		bump(node, entry);
+		if (pos == length) {
+			node->entry = entry;
+			return;
+		}
+		if ((child = find_child(node, text[pos], &link)) == NULL) {
+			*link = new_node(text + pos, length - pos, NULL, NULL, entry, entry);
+			return;
+		}
+		common = common_len(child->label, text + pos, child->label_len < length - pos ? child->label_len : length - pos);
+		if (common < child->label_len) { //split edge, the shared part becomes a new node
+			*link = new_node(child->label, common, child, child->sibling, child->best, NULL);
+			child->label += common;
+			child->label_len -= common;
+			child->sibling = NULL;
+			child = *link;
+		}
+		node = child;
+		pos += common;
+	}
+}
+
+/* index newest SUGGEST_LOAD_MAX history entries, cost does not depend on history size */
+void suggest_init()
+{
+	size_t pos = history_end(), entry_len;
+	const char *entry;
+
+	for (unsigned long seq = SUGGEST_LOAD_MAX; seq > 0 && history_prev(&pos, &entry, &entry_len); --seq)
+		add_use(entry, entry_len, seq);
+}
+
+void suggest_add(const char *line, size_t length)
+{
+	if (length == 0)
+		return;
+	add_use(line, length, ++sugg.seq);
+}
+
+/* best ranked past command starting with prefix
+ * return the part of it after prefix, or NULL if there is none
+ */
+const char *suggest_lookup(const char *prefix, size_t length, size_t *rest_length)
+{
+	struct sugg_node *node = &sugg.root;
+	size_t pos = 0, max;
+
+	if (length == 0)
+		return NULL;
+	while (pos < length) {
+		if ((node = find_child(node, prefix[pos], NULL)) == NULL)
+			return NULL;
+		max = node->label_len < length - pos ? node->label_len : length - pos;
+		if (common_len(node->label, prefix + pos, max) < max)
+			return NULL;
+		pos += max;
+	}
+	if (node->best == NULL || node->best->len == length)
+		return NULL;
+	*rest_length = node->best->len - length;
+	return node->best->text + length;
+}
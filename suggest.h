@@ -0,0 +1,10 @@
+#ifndef NSPT_SUGGEST
+#define NSPT_SUGGEST
+
+#include <stddef.h>
+
+void suggest_init();
+void suggest_add(const char *line, size_t length);
+const char *suggest_lookup(const char *prefix, size_t length, size_t *rest_length);
+
+#endif
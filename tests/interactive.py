@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# run nspt_sh interactively under a pty and check command output
+# usage: tests/interactive.py [path/to/nspt_sh]
+import os
+import pty
+import select
+import sys
+import tempfile
+import time
+
+PROMPT = b'PROMPT> '
+PASTE_START = b'\x1b[200~'
+PASTE_END = b'\x1b[201~'
+TIMEOUT = 5
+
+# command line, output expected between the echoed line and the next prompt (or a check of it)
+CASES = [
+	# a substitution runs in background, one that stops on the terminal must not hang the shell
+	('echo $(exit 3) $?', '3'),
+	('X=$(exit 4); echo $?', '4'),
+	('X=$(head -c1); echo "[$X] $?"', 'nspt_sh: command substitution stopped, killed\n[] 137'),
+	('echo $(if true; then exit 5; fi) $?', '5'),
+	('echo $(echo a | head -c1 | cat) $?', 'a 0'),
+	# nothing to launch
+	('echo $(X=1) $?', '0'),
+	# a job exiting while a substitution is read is still reported
+	('sleep 0.2 & x=$(sleep 0.5); jobs', lambda out: out.endswith('sleep 0.2\t exited')),
+	# $(jobs) runs in a forked shell, the exited job is still listed by jobs afterwards
+	('sleep 0.1 & sleep 0.3; x=$(jobs); jobs', lambda out: out.endswith('sleep 0.1\t exited')),
+	# a pasted line break separates commands, a line with one is pasted
+	('echo one\necho two', 'one\ntwo'),
+	# parallel items run in children, a builtin item leaves shell alone, a nested parallel works
+	('cd /; parallel "cd /tmp" "X=5" "exit 3"; pwd; echo "[$X]"', lambda out: out.endswith('\n/\n[]')),
+	('parallel -j 2 -k "echo a" "parallel -j 2 -k \'echo b\' \'echo c\'" "echo d"',
+		lambda out: [l for l in out.split('\n') if not l.startswith('parallel: ')] == ['a', 'b', 'c', 'd']),
+]
+
+
+def read_until(fd, token):
+	buf = b''
+	end = time.time() + TIMEOUT
+	while token not in buf:
+		ready, _, _ = select.select([fd], [], [], max(0, end - time.time()))
+		if not ready:
+			return buf, False
+		try:
+			data = os.read(fd, 4096)
+		except OSError:
+			return buf, False
+		if not data:
+			return buf, False
+		buf += data
+	return buf, True
+
+
+def output_of(raw, cmd):
+	text = raw.decode(errors='replace').replace('\r\n', '\n').replace('\x1b[?2004h', '').replace('\x1b[?2004l', '')
+	text = text.replace('\u21b5', '\n')  #line break of a paste as shown
+	text = text[:text.rfind(PROMPT.decode())]
+	head, _, rest = text.partition(cmd + '\n')
+	return rest.rstrip('\n')
+
+
+def history_truncated(fd, histfile):
+	"""walk and search history after the file has been truncated behind the shell's back"""
+	os.write(fd, b'\x1b[A')  #Up maps the file
+	time.sleep(0.2)
+	os.truncate(histfile, 0)
+	os.write(fd, b'\x1b[A\x1b[A\x1b[B\x12echo\x07' + b'\x7f' * 200 + b'echo alive\r')
+	raw, ok = read_until(fd, PROMPT)
+	return ok and output_of(raw, 'echo alive') == 'alive'
+
+
+def main():
+	shell = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else './nspt_sh')
+	home = tempfile.mkdtemp(prefix='nspt_test.')
+	histfile = os.path.join(home, 'history')
+	pid, fd = pty.fork()
+	if pid == 0:
+		os.environ['PS1'] = PROMPT.decode()
+		os.environ['HISTFILE'] = histfile
+		os.environ['XDG_CACHE_HOME'] = home
+		os.execv(shell, [shell])
+	failed = 0
+	_, ok = read_until(fd, PROMPT)
+	if not ok:
+		print('FAIL: no prompt')
+		return 1
+	for cmd, expected in CASES:
+		if '\n' in cmd:  #pasted
+			os.write(fd, PASTE_START + cmd.encode() + PASTE_END + b'\r')
+		else:
+			os.write(fd, cmd.encode() + b'\r')
+		raw, ok = read_until(fd, PROMPT)
+		got = output_of(raw, cmd)
+		if not ok:
+			print('FAIL (hangs): %s' % cmd)
+			failed += 1
+			break
+		if (got != expected) if isinstance(expected, str) else not expected(got):
+			print('FAIL: %s\n  expected: %r\n  got:      %r' % (cmd, expected, got))
+			failed += 1
+		else:
+			print('ok: %s' % cmd)
+	if history_truncated(fd, histfile):
+		print('ok: history file truncated while browsing it')
+	else:
+		print('FAIL: history file truncated while browsing it')
+		failed += 1
+	os.kill(pid, 9)
+	os.waitpid(pid, 0)
+	print('%d of %d failed' % (failed, len(CASES) + 1))
+	return 1 if failed else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
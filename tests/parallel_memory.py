@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# parallel keeps memory per job in flight: peak RSS of the shell must not grow with the number
+# of items run, also while another job (which holds its job id) stays alive
+# usage: tests/parallel_memory.py [path/to/nspt_sh]
+import os
+import signal
+import subprocess
+import sys
+
+SMALL = 2000
+LARGE = 60000
+SLACK_KB = 256  #a job id slot per item would add 8 bytes * (LARGE - SMALL), about 450 kB
+ITEM = b'/bin/sleep 0.01\n'  #items overlap, so some job is always running when the next starts
+
+
+def peak_kb(shell, items):
+	script = 'sleep 600 >/dev/null & parallel -j 32 -u; grep VmHWM /proc/$$/status; jobs'
+	out = subprocess.run([shell, '-c', script], input=ITEM * items, stdout=subprocess.PIPE,
+		stderr=subprocess.DEVNULL, env={'PATH': '/usr/bin:/bin'}).stdout.decode()
+	peak = None
+	for line in out.splitlines():
+		if line.startswith('VmHWM:'):
+			peak = int(line.split()[1])
+		elif line.startswith('[1]'):  #the sleep, its pgid follows
+			os.killpg(int(line.split()[1]), signal.SIGKILL)
+	if peak is None:
+		raise RuntimeError('no VmHWM in output: %r' % out)
+	return peak
+
+
+def main():
+	shell = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else './nspt_sh')
+	small, large = peak_kb(shell, SMALL), peak_kb(shell, LARGE)
+	print('peak RSS: %d items %d kB, %d items %d kB' % (SMALL, small, LARGE, large))
+	if large - small > SLACK_KB:
+		print('FAIL: peak memory grows with item count')
+		return 1
+	print('ok: parallel memory stays flat')
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
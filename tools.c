@@ -4,67 +4,70 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <stdio.h>
+#include <stdarg.h>
 
-void strip_space(char *str, size_t *length)
+/* make room for at least extra more bytes (plus '\0') in buf */
+void str_buf_reserve(struct str_buf *buf, size_t extra)
 {
-	assert(str != NULL);
+	assert(buf != NULL);
 
-	size_t i, spare_length;
-	
-	if (length == NULL) {
-		spare_length = strlen(str);
-		length = &spare_length;
-	}
-	/*strip space at tail*/
-	for (i = *length - 1; isspace(str[i]); --i) {
-		str[i] = '\0';
-		(*length)--;
+	if (buf->len + extra + 1 <= buf->cap)
+		return;
+	while (buf->len + extra + 1 > buf->cap)
+		buf->cap = buf->cap == 0 ? 256 : buf->cap * 2;
+	if ((buf->data = realloc(buf->data, buf->cap)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate output buffer: %m");
+		exit(EXIT_FAILURE);
 	}
-	/*strip space at head*/
-	for (i = 0; isspace(str[i]); ++i);
-	for (size_t j = 0, k = i; k <= spare_length; ++j,++k)
-		str[j] = str[k];
-	*length = *length - i;
 }
 
-/*
- * according to delimiter, break command into array of pointers to string(subcommand or arguments)
- * if success
- *     return array of pointers to string,
- *         the last pointer in this array has the value NULL,
- *         caller should free the array after use
- *     *number will be number of pointers
- * if command is full of delimiter(e.g. all-space when space is delimiter) or error occurred during parsing
- *     return NULL
- *     *number will be 0
- */
-char **split_cmd(char *cmd_buf, const char *delimiter, size_t *number)
+void str_buf_append(struct str_buf *buf, const char *data, size_t length)
 {
-	assert(cmd_buf != NULL && delimiter != NULL);
+	str_buf_reserve(buf, length);
+	memcpy(buf->data + buf->len, data, length);
+	buf->len += length;
+	buf->data[buf->len] = '\0';
+}
 
-	char **args;
-	size_t arg_num = 0;
+void str_buf_printf(struct str_buf *buf, const char *format, ...)
+{
+	va_list ap;
+	int need;
 
-	args = calloc(strlen(cmd_buf) / 2 + 1, sizeof(char *)); //allocate absolutely sufficient memory
-	if (args == NULL) {
-		syslog(LOG_ERR, "Can't allocate cmd_buf: %m");
-		exit(EXIT_FAILURE);
-	}
+	va_start(ap, format);
+	need = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+	if (need < 0)
+		return;
+	str_buf_reserve(buf, need);
+	va_start(ap, format);
+	vsnprintf(buf->data + buf->len, need + 1, format, ap);
+	va_end(ap);
+	buf->len += need;
+}
 
-	args[0] = strtok(cmd_buf, delimiter);
-	if (args[0] == NULL) { //command is empty or full of delimiter
-		free(args);
-		if (number)
-			*number = 0;
-		return NULL;
-	}
-	arg_num++;
-	for (size_t i = 1; (args[i] = strtok(NULL, delimiter)) != NULL; i++, arg_num++);
+/* write buffered text to stdout with a single call and empty buf, memory is kept for reuse */
+void str_buf_flush(struct str_buf *buf)
+{
+	assert(buf != NULL);
 
-	args = realloc(args, (arg_num + 1) * sizeof(char *));
-	args[arg_num] = NULL;
-	if (number)
-		*number = arg_num;
-	return args;
+	if (buf->len == 0)
+		return;
+	fwrite(buf->data, 1, buf->len, stdout);
+	fflush(stdout);
+	buf->len = 0;
 }
 
+/* command text of one line of batch input, NULL if there is nothing to run:
+ * blank lines and '#' comments (including the "#!" line of a script) are skipped,
+ * a trailing '\r' is dropped in place
+ */
+char *batch_line_text(char *line, size_t length)
+{
+	if (length > 0 && line[length - 1] == '\r')
+		line[--length] = '\0';
+	while (*line == ' ' || *line == '\t')
+		++line;
+	return *line == '\0' || *line == '#' ? NULL : line;
+}
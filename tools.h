@@ -3,7 +3,17 @@
 
 #include <stddef.h>
 
-void strip_space(char *str, size_t *length);
-char **split_cmd(char *cmd_buf, const char *delimiter, size_t *number);
+/* growable output buffer, text is built up in memory and written with one call */
+struct str_buf {
+	char *data;
+	size_t len, cap;
+};
+
+void str_buf_reserve(struct str_buf *buf, size_t extra);
+void str_buf_append(struct str_buf *buf, const char *data, size_t length);
+void str_buf_printf(struct str_buf *buf, const char *format, ...);
+void str_buf_flush(struct str_buf *buf);
+
+char *batch_line_text(char *line, size_t length);
 
 #endif
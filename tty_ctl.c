@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "tty_ctl.h"
 #include <assert.h>
 #include <string.h>
@@ -7,17 +8,43 @@
 #include <syslog.h>
 #include <unistd.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <poll.h>
+#include "signal_handler.h"
 #include "sh_env.h"
 #include "tools.h"
+#include "gap_buf.h"
+#include "history.h"
+#include "suggest.h"
+#include "complete.h"
 
 #define KEY_TAB       9
 #define KEY_BACKSPACE 127
 #define KEY_ESCAPE    27
 #define KEY_L_BRACKET 91
 #define KEY_CTRL_D    4
+#define KEY_CTRL_G    7
+#define KEY_CTRL_R    18
+#define KEY_JOB_EVENT (-2)
+
+#define INPUT_BUF_LEN 65536
+
+#define PASTE_ON       "\033[?2004h"
+#define PASTE_OFF      "\033[?2004l"
+#define PASTE_END      "\033[201~"
+#define PASTE_MARK_LEN 6
+#define NEWLINE_SHOWN  "\342\206\265"  //a line break kept from a paste is shown as a one column wide return arrow
+
+#define SEARCH_PATTERN_MAX 256
 
 static struct termios *save_term = NULL;
 
+static struct {
+	unsigned char buf[INPUT_BUF_LEN];
+	size_t pos, len;
+} input = {{0}, 0, 0};
+
 void tty_cbreak() /* put terminal into a cbreak mode */
 {
 	static int inited = 0;
@@ -57,123 +84,511 @@ void tty_reset()
 	tcsetattr(STDIN_FILENO, TCSANOW, save_term);
 }
 
-static void remove_char(char *cmd_buf, size_t *cur_idx, size_t *end_idx)
+/* line editing only changes buffer, render() brings terminal up to date:
+ * screen keeps what is shown after prompt and where the cursor is, render() finds the first
+ * byte that differs, moves cursor there, rewrites the rest and clears what is left over,
+ * all output is collected in screen.out and flushed with one write() per input batch
+ */
+static struct {
+	struct str_buf out;
+	char *shown;
+	size_t shown_len, shown_cap, shown_cur;
+	const char *hint;  //suggestion shown in grey after the text
+	size_t hint_len;
+	size_t prompt_width, cols;
+} screen = {{NULL, 0, 0}, NULL, 0, 0, 0, NULL, 0, 0, 80};
+
+/* start rendering a new line right after prompt has been printed */
+static void screen_reset()
 {
-	if (*cur_idx == 0)
-		return;
+	struct winsize ws;
 
-	if (*cur_idx == *end_idx) {
-		(*cur_idx)--;
-		(*end_idx)--;
-		fputs("\b \b", stdout);
+	screen.shown_len = 0;
+	screen.shown_cur = 0;
+	screen.hint = NULL;
+	screen.hint_len = 0;
+	screen.prompt_width = get_prompt_width();
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		screen.cols = ws.ws_col;
+}
+
+/* move cursor from index from to index to of shown text, text may wrap over several rows */
+static void screen_move(size_t from, size_t to)
+{
+	size_t from_row = (screen.prompt_width + from) / screen.cols, from_col = (screen.prompt_width + from) % screen.cols;
+	size_t to_row = (screen.prompt_width + to) / screen.cols, to_col = (screen.prompt_width + to) % screen.cols;
+
+	if (to_row < from_row)
+		str_buf_printf(&screen.out, "\033[%zuA", from_row - to_row);
+	else if (to_row > from_row)
+		str_buf_printf(&screen.out, "\033[%zuB", to_row - from_row);
+	if (to_col < from_col)
+		str_buf_printf(&screen.out, "\033[%zuD", from_col - to_col);
+	else if (to_col > from_col)
+		str_buf_printf(&screen.out, "\033[%zuC", to_col - from_col);
+}
+
+/* write text at end of line, text must end at index end */
+static void screen_write_end(const char *text, size_t length, size_t end)
+{
+	const char *p = text, *nl;
+
+	while ((nl = memchr(p, '\n', text + length - p)) != NULL) {
+		str_buf_append(&screen.out, p, nl - p);
+		str_buf_append(&screen.out, NEWLINE_SHOWN, strlen(NEWLINE_SHOWN));
+		p = nl + 1;
+	}
+	str_buf_append(&screen.out, p, text + length - p);
+	if (length > 0 && (screen.prompt_width + end) % screen.cols == 0)
+		str_buf_append(&screen.out, "\r\n", 2); //leave pending-wrap state, cursor goes to next row
+}
+
+/* bring screen up to date with line, a suggestion from history is shown after the text
+ * if suggest is non-zero and cursor is at end of line
+ */
+static void render(const struct gap_buf *line, int suggest)
+{
+	size_t diff = 0, end_idx = gap_buf_len(line), cur_idx = gap_buf_cursor(line), hint_len = 0;
+	const char *hint = NULL;
+	int same_text;
+
+	while (diff < end_idx && diff < screen.shown_len && gap_buf_at(line, diff) == screen.shown[diff])
+		++diff;
+	same_text = diff == end_idx && diff == screen.shown_len;
+	if (end_idx > screen.shown_cap) {
+		screen.shown_cap = end_idx * 2;
+		if ((screen.shown = realloc(screen.shown, screen.shown_cap)) == NULL) {
+			syslog(LOG_ERR, "Can't allocate screen buffer: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	gap_buf_copy(line, diff, end_idx - diff, screen.shown + diff);
+	if (suggest && cur_idx == end_idx)
+		hint = suggest_lookup(screen.shown, end_idx, &hint_len);
+
+	if (same_text && hint == screen.hint && hint_len == screen.hint_len) {
+		screen_move(screen.shown_cur, cur_idx);
+		screen.shown_cur = cur_idx;
 		return;
 	}
 
-	size_t num_steps = 0;
-	for (size_t i = *cur_idx; i < *end_idx; ++i) {
-		cmd_buf[i - 1] = cmd_buf[i];
+	if (same_text)
+		screen_move(screen.shown_cur, end_idx);
+	else {
+		screen_move(screen.shown_cur, diff);
+		screen_write_end(screen.shown + diff, end_idx - diff, end_idx);
 	}
-	(*cur_idx)--;
-	(*end_idx)--;
-	putchar('\b');
-	for (size_t i = *cur_idx; i < *end_idx; ++num_steps, ++i) {
-		putchar(cmd_buf[i]);	
+	if (end_idx < screen.shown_len || screen.hint_len > 0)
+		str_buf_append(&screen.out, "\033[J", 3);
+	if (hint != NULL) {
+		str_buf_append(&screen.out, "\033[90m", 5);
+		screen_write_end(hint, hint_len, end_idx + hint_len);
+		str_buf_append(&screen.out, "\033[0m", 4);
 	}
-	putchar(' ');
-	++num_steps;
-	for (size_t i = 0; i < num_steps; ++i) {
-		putchar('\b');
+	screen_move(end_idx + hint_len, cur_idx);
+
+	screen.shown_len = end_idx;
+	screen.shown_cur = cur_idx;
+	screen.hint = hint;
+	screen.hint_len = hint_len;
+}
+
+static void screen_flush()
+{
+	ssize_t write_ret;
+	size_t written = 0;
+
+	fflush(stdout);
+	while (written < screen.out.len) {
+		if ((write_ret = write(STDOUT_FILENO, screen.out.data + written, screen.out.len - written)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		written += write_ret;
 	}
+	screen.out.len = 0;
 }
 
-static void insert_char(char *cmd_buf, size_t buf_length, char ch, size_t *cur_idx, size_t *end_idx)
+/* wait for input and append what is available to input buffer, consumed bytes are dropped first
+ * return:
+ *     number of bytes read,
+ *     0 on end of input or error,
+ *     KEY_JOB_EVENT if job_event is non-zero and some children changed state
+ */
+static int fill_input(int job_event)
 {
-	if (*end_idx == buf_length - 1)
-		return;
+	struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {sigchld_fd, POLLIN, 0}};
+	ssize_t read_ret;
 
-	if (*cur_idx == *end_idx) {
-		putchar(ch);
-		cmd_buf[*cur_idx] = ch;
-		(*cur_idx)++;
-		(*end_idx)++;
-		return;
+	if (input.pos > 0) {
+		memmove(input.buf, input.buf + input.pos, input.len - input.pos);
+		input.len -= input.pos;
+		input.pos = 0;
 	}
 
-	for (size_t i = *end_idx - 1; i >= *cur_idx; --i) {
-		cmd_buf[i + 1] = cmd_buf[i];
+	fflush(stdout);
+	while (1) {
+		if (poll(fds, job_event ? 2 : 1, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		if (job_event && (fds[1].revents & POLLIN))
+			return KEY_JOB_EVENT;
+		if (fds[0].revents == 0)
+			continue;
+		if ((read_ret = read(STDIN_FILENO, input.buf + input.len, INPUT_BUF_LEN - input.len)) <= 0) {
+			if (read_ret == -1 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			return 0;
+		}
+		input.len += read_ret;
+		return read_ret;
 	}
-	cmd_buf[*cur_idx] = ch;
-	(*end_idx)++;
+}
+
+/* get next input byte, waiting for terminal input and child state change at the same time
+ * return:
+ *     next byte,
+ *     EOF on end of input or error,
+ *     KEY_JOB_EVENT if job_event is non-zero and some children changed state
+ */
+static int get_key(int job_event)
+{
+	int fill_ret;
+
+	if (input.pos == input.len && (fill_ret = fill_input(job_event)) <= 0)
+		return fill_ret == 0 ? EOF : fill_ret;
+	return input.buf[input.pos++];
+}
+
+/* collect bracketed paste up to end mark ESC[201~ into paste, input is consumed chunk by chunk,
+ * a tail that may be the start of end mark is kept in input buffer until more bytes arrive
+ */
+static void read_paste(struct str_buf *paste)
+{
+	const char *chunk, *mark;
+	size_t avail, keep;
 
-	size_t num_steps = 0;
-	for (size_t i = *cur_idx; i < *end_idx; ++num_steps, ++i) {
-		putchar(cmd_buf[i]);	
+	paste->len = 0;
+	while (1) {
+		if (input.pos == input.len && fill_input(0) <= 0)
+			return;
+		chunk = (const char *)input.buf + input.pos;
+		avail = input.len - input.pos;
+		if ((mark = memmem(chunk, avail, PASTE_END, PASTE_MARK_LEN)) != NULL) {
+			str_buf_append(paste, chunk, mark - chunk);
+			input.pos += mark - chunk + PASTE_MARK_LEN;
+			return;
+		}
+		for (keep = PASTE_MARK_LEN - 1; keep > 0; --keep) {
+			if (keep <= avail && memcmp(chunk + avail - keep, PASTE_END, keep) == 0)
+				break;
+		}
+		str_buf_append(paste, chunk, avail - keep);
+		input.pos += avail - keep;
+		if (keep > 0 && fill_input(0) <= 0)
+			return;
 	}
-	(*cur_idx)++;
-	for (size_t i = 0; i < num_steps - 1; ++i) {
-		putchar('\b');
+}
+
+/* make pasted text fit on one command line:
+ * trailing line breaks are dropped, other ones are kept ("\r\n" and '\r' become '\n'),
+ * so pasted lines run as separate commands as they would from a script, tabs become spaces,
+ * other control characters are removed
+ * return new length
+ */
+static size_t clean_paste(char *text, size_t length)
+{
+	size_t out = 0;
+
+	while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r'))
+		--length;
+	for (size_t i = 0; i < length; ++i) {
+		unsigned char ch = text[i];
+		if (ch == '\r' && i + 1 < length && text[i + 1] == '\n')
+			continue;
+		if (ch == '\n' || ch == '\r')
+			text[out++] = '\n';
+		else if (ch == '\t')
+			text[out++] = ' ';
+		else if (ch >= 0x20 && ch != 0x7f)
+			text[out++] = ch;
 	}
+	return out;
 }
 
-size_t get_cmd(char *cmd_buf, size_t buf_length, int *err)
+/* read rest of a control sequence after ESC [, parameter bytes go to param
+ * return final byte, or EOF
+ */
+static int read_csi(char *param, size_t param_length)
 {
-	size_t end_idx = 0, cur_idx = 0;
+	size_t len = 0;
 	int ch;
 
+	while ((ch = get_key(0)) != EOF && (ch < 0x40 || ch > 0x7e)) {
+		if (len + 1 < param_length)
+			param[len++] = ch;
+	}
+	param[len] = '\0';
+	return ch;
+}
+
+/* reap children, if any background job changed state,
+ * clear current line, report it and redraw prompt and command line
+ */
+static void report_job_event(const struct gap_buf *line)
+{
+	update_job_state(0, NULL, 0);
+	if (!has_job_notices())
+		return;
+	screen_move(screen.shown_cur, 0);
+	str_buf_append(&screen.out, "\r\033[J", 4);
+	screen_flush();
+	output_job_notices();
+	output_prompt();
+	screen_reset();
+	render(line, 1);
+}
+
+static void set_line(struct gap_buf *line, const char *text, size_t length)
+{
+	gap_buf_clear(line);
+	gap_buf_insert(line, text, length);
+}
+
+/* clear what is shown of current line and draw prompt again, prompt is the normal prompt
+ * if search_prompt is NULL
+ */
+static void redraw_line(const struct gap_buf *line, const char *search_prompt, size_t search_length)
+{
+	screen_move(screen.shown_cur, 0);
+	str_buf_append(&screen.out, "\r\033[J", 4);
+	if (search_prompt == NULL) {
+		screen_flush();
+		output_prompt();
+		screen_reset();
+	} else {
+		screen_reset();
+		screen.prompt_width = 0;
+		for (size_t i = 0; i < search_length; ++i) {
+			if (((unsigned char)search_prompt[i] & 0xc0) != 0x80)
+				screen.prompt_width++;
+		}
+		str_buf_append(&screen.out, search_prompt, search_length);
+	}
+	render(line, search_prompt == NULL);
+}
+
+/* incremental history search started by Ctrl-R, line shows newest entry containing what is typed,
+ * Ctrl-R again goes to an older match, Ctrl-G gives up and brings back the line before search
+ * return key that ended search, which caller should handle, or 0 if it has been consumed
+ */
+static int search_history(struct gap_buf *line)
+{
+	static struct str_buf pattern = {NULL, 0, 0}, prompt = {NULL, 0, 0}, saved = {NULL, 0, 0};
+	size_t match_pos = 0, entry_len, limit, miss_len = 0;
+	const char *entry;
+	int ch, have_match = 0, found;
+	char byte;
+
+	saved.len = 0;
+	str_buf_reserve(&saved, gap_buf_len(line));
+	gap_buf_copy(line, 0, gap_buf_len(line), saved.data);
+	saved.len = gap_buf_len(line);
+	pattern.len = 0;
+	str_buf_reserve(&pattern, 0);
+	while (1) {
+		if (input.pos == input.len) {
+			prompt.len = 0;
+			str_buf_printf(&prompt, "(search)`%.*s': ", (int)pattern.len, pattern.data);
+			redraw_line(line, prompt.data, prompt.len);
+			screen_flush();
+		}
+
+		ch = get_key(0);
+		if (ch == KEY_CTRL_R) {
+			limit = have_match ? match_pos : history_end();
+		} else if (ch == KEY_BACKSPACE) {
+			if (pattern.len > 0)
+				pattern.len--;
+			if (pattern.len < miss_len)
+				miss_len = 0;
+			limit = history_end();
+		} else if ((isprint(ch) || ch >= 0x80) && pattern.len < SEARCH_PATTERN_MAX) {
+			byte = (char)ch;
+			str_buf_append(&pattern, &byte, 1);
+			limit = have_match ? match_pos + gap_buf_len(line) + 1 : history_end(); //current match may still do
+		} else {
+			if (ch == KEY_CTRL_G)
+				set_line(line, saved.data, saved.len);
+			redraw_line(line, NULL, 0);
+			return ch == KEY_CTRL_G ? 0 : ch;
+		}
+
+		if (pattern.len == 0) {
+			have_match = 0;
+			set_line(line, saved.data, saved.len);
+			continue;
+		}
+		//a pattern extending one that found nothing can't match either, skip the scan
+		found = miss_len == 0 && history_search(pattern.data, pattern.len, limit, &match_pos, &entry, &entry_len);
+		if (!found && miss_len == 0 && ch != KEY_CTRL_R)
+			miss_len = pattern.len;
+		if (found) {
+			have_match = 1;
+			set_line(line, entry, entry_len);
+			gap_buf_move(line, (const char *)memmem(entry, entry_len, pattern.data, pattern.len) - entry);
+		} else
+			str_buf_append(&screen.out, "\a", 1);
+	}
+}
+
+/* complete word before cursor, word is a command name if it starts the line or follows '|',
+ * matches are listed below the line if list is non-zero and nothing could be added
+ */
+static void complete_word(struct gap_buf *line, int list)
+{
+	static struct str_buf before = {NULL, 0, 0}, insert = {NULL, 0, 0}, listing = {NULL, 0, 0};
+	size_t cur_idx = gap_buf_cursor(line), word_start, prev, count;
+
+	before.len = 0;
+	str_buf_reserve(&before, cur_idx);
+	gap_buf_copy(line, 0, cur_idx, before.data);
+	before.data[before.len = cur_idx] = '\0';
+	for (word_start = cur_idx; word_start > 0 && before.data[word_start - 1] != ' '; --word_start);
+	for (prev = word_start; prev > 0 && before.data[prev - 1] == ' '; --prev);
+
+	count = complete(before.data + word_start, cur_idx - word_start, prev == 0 || before.data[prev - 1] == '|',
+			&insert, list ? &listing : NULL, screen.cols);
+	if (insert.len > 0) {
+		gap_buf_insert(line, insert.data, insert.len);
+	} else if (count > 1 && list) { //matches go below line in one write, then line is drawn again
+		screen_move(screen.shown_cur, screen.shown_len + screen.hint_len);
+		str_buf_append(&screen.out, "\n", 1);
+		str_buf_append(&screen.out, listing.data, listing.len);
+		screen_flush();
+		output_prompt();
+		screen_reset();
+	} else
+		str_buf_append(&screen.out, "\a", 1);
+}
+
+/* read one command line from terminal into line, *err is set if input ended
+ * return length of command
+ */
+size_t get_cmd(struct gap_buf *line, int *err)
+{
+	static struct str_buf paste = {NULL, 0, 0}, saved = {NULL, 0, 0};
+	size_t run, hist_pos, entry_len;
+	const char *entry;
+	char param[16];
+	int ch, browsing = 0, tabs = 0;
+
 	*err = 0;
+	update_job_state(1, NULL, 0);
 	output_prompt();
+	screen_reset();
+	str_buf_append(&screen.out, PASTE_ON, strlen(PASTE_ON));
+	hist_pos = history_end();
 	while (1) {
-		if ((ch = getchar()) == EOF || ch == KEY_CTRL_D) {
-			if (end_idx == 0) {
+		if (input.pos == input.len) { //input batch handled, bring screen up to date before waiting
+			render(line, 1);
+			screen_flush();
+		}
+		if ((ch = get_key(1)) == KEY_JOB_EVENT) {
+			report_job_event(line);
+			continue;
+		}
+		tabs = ch == KEY_TAB ? tabs + 1 : 0;
+		if (ch == KEY_CTRL_R) {
+			browsing = 0;
+			hist_pos = history_end();
+			if ((ch = search_history(line)) == 0)
+				continue;
+		}
+		if (ch == EOF || ch == KEY_CTRL_D) {
+			if (gap_buf_len(line) == 0) {
 				*err = 1;
-				return 0;	
-			} else 
+				str_buf_append(&screen.out, PASTE_OFF, strlen(PASTE_OFF));
+				screen_flush();
+				return 0;
+			} else
 				continue;
 		}
 		if (ch == KEY_TAB) {
-			putchar('\a');
+			complete_word(line, tabs > 1);
 			continue;
 		} //KEY_TAB
 		if (ch == KEY_ESCAPE) {
-			if ((ch = getchar()) != KEY_L_BRACKET)
+			if ((ch = get_key(0)) != KEY_L_BRACKET)
 				continue;
-			switch (ch = getchar()) {
-				case 'A':
-				case 'B':
-					putchar('\a');
+			switch (ch = read_csi(param, sizeof(param))) {
+				case 'A': //older history entry, line being edited is kept until we come back down
+					if (!browsing) {
+						saved.len = 0;
+						str_buf_reserve(&saved, gap_buf_len(line));
+						gap_buf_copy(line, 0, gap_buf_len(line), saved.data);
+						saved.len = gap_buf_len(line);
+					}
+					if (history_prev(&hist_pos, &entry, &entry_len)) {
+						browsing = 1;
+						set_line(line, entry, entry_len);
+					} else
+						str_buf_append(&screen.out, "\a", 1);
 					continue;
-				case 'C':
-					if (cur_idx < end_idx) {
-						fputs("\e[C", stdout);
-						cur_idx++;
+				case 'B':
+					if (!browsing)
+						str_buf_append(&screen.out, "\a", 1);
+					else if (history_next(&hist_pos, &entry, &entry_len))
+						set_line(line, entry, entry_len);
+					else {
+						browsing = 0;
+						set_line(line, saved.data, saved.len);
 					}
 					continue;
+				case 'C': //at end of line, take the suggestion shown
+					if (gap_buf_cursor(line) < gap_buf_len(line))
+						gap_buf_move(line, gap_buf_cursor(line) + 1);
+					else if (screen.hint != NULL)
+						gap_buf_insert(line, screen.hint, screen.hint_len);
+					continue;
 				case 'D':
-					if (cur_idx > 0) {
-						fputs("\e[D", stdout);
-						cur_idx--;
+					if (gap_buf_cursor(line) > 0)
+						gap_buf_move(line, gap_buf_cursor(line) - 1);
+					continue;
+				case '~':
+					if (strcmp(param, "200") == 0) { //bracketed paste, insert all at once
+						read_paste(&paste);
+						gap_buf_insert(line, paste.data, clean_paste(paste.data, paste.len));
 					}
 					continue;
 				default:
-					break;
+					continue;
 			}
 		} //KEY_ESCAPE
 		if (ch == KEY_BACKSPACE) {
-			remove_char(cmd_buf, &cur_idx, &end_idx);
+			gap_buf_delete(line, 1);
 			continue;
 		} //KEY_BACKSPACE
 
 		if (ch == '\n') {
-			putchar(ch);
+			gap_buf_move(line, gap_buf_len(line));
+			render(line, 0);
+			str_buf_append(&screen.out, PASTE_OFF, strlen(PASTE_OFF));
+			str_buf_append(&screen.out, "\n", 1);
+			screen_flush();
 			break;
 		}
-		if (isprint(ch)) {
-			insert_char(cmd_buf, buf_length, (char)ch, &cur_idx, &end_idx);
+		if (isprint(ch)) { //take the whole run of printable input and insert it in one move
+			for (run = 0; input.pos + run < input.len && isprint(input.buf[input.pos + run]); ++run);
+			gap_buf_insert(line, (const char *)input.buf + input.pos - 1, run + 1);
+			input.pos += run;
 		}
 	}
 
-	cmd_buf[end_idx] = '\0';
-	return end_idx;
+	return gap_buf_len(line);
 }
 
 void tty_init()
@@ -2,8 +2,9 @@
 #define NSPT_TTY_CTL
 
 #include <stddef.h>
+#include "gap_buf.h"
 
-size_t get_cmd(char *cmd_buf, size_t buf_length, int *err);
+size_t get_cmd(struct gap_buf *line, int *err);
 void tty_init();
 void tty_reset();
 void tty_cbreak();
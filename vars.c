@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define VARS_ORIG_CAP  256
+#define ENV_ORIG_ROOM  16
+
+/* shell variables are "NAME=value" strings in an open addressing hash (linear probing),
+ * env is the vector handed to exec, it points at the strings of exported variables, so a new
+ * value of an exported variable is patched into env in place and a newly exported one is
+ * appended, env is only rebuilt when a variable leaves it or it runs out of room
+ */
+struct var {
+	char *str;          //"NAME=value", or "NAME" if it is exported but not set, NULL if slot is empty
+	size_t name_len;
+	int exported;
+	size_t env_idx;     //index in env, valid if variable is listed there and env isn't dirty
+};
+
+struct env_patch {
+	size_t idx;
+	char *old;
+};
+
+static struct var_table {
+	struct var *slots;
+	size_t cap, count;
+	char **env_buf;     //room spare entries for NAME=value prefixes of a command, then env, then NULL
+	size_t room, env_count, env_cap;
+	int env_dirty;
+	char **stale;       //replaced strings env may still point at, freed when env is rebuilt
+	size_t stale_count, stale_cap;
+	struct env_patch *patches;  //entries of env replaced by a prefix, see vars_environ_overlay()
+	size_t patch_count, patch_cap;
+	pid_t shell_pid;
+	unsigned long layout_gen;   //changes whenever variables move to other slots, see vars_get_ref()
+	char **params;      //$1..., not copied, whoever sets them keeps them alive
+	size_t param_count;
+	const char *arg0;
+} vars = {NULL, 0, 0, NULL, ENV_ORIG_ROOM, 0, 0, 1, NULL, 0, 0, NULL, 0, 0, 0, 1, NULL, 0, "nspt_sh"};
+
+static size_t hash_name(const char *name, size_t length)
+{
+	size_t hash = 14695981039346656037UL;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+static int has_value(const struct var *var)
+{
+	return var->str[var->name_len] == '=';
+}
+
+static int is_listed(const struct var *var)
+{
+	return var->exported && has_value(var);
+}
+
+/* free str of a variable, or keep it until env is rebuilt if environ still points at it */
+static void retire_str(char *str, int listed)
+{
+	if (!listed || vars.env_buf == NULL) {
+		free(str);
+		return;
+	}
+	if (vars.stale_count == vars.stale_cap) {
+		vars.stale_cap = vars.stale_cap ? vars.stale_cap * 2 : 16;
+		if ((vars.stale = realloc(vars.stale, vars.stale_cap * sizeof(char *))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate stale variable list: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	vars.stale[vars.stale_count++] = str;
+}
+
+/* var has just become listed, append it to env if there is room, rebuild env otherwise */
+static void list_var(struct var *var)
+{
+	if (vars.env_dirty || vars.room + vars.env_count + 2 > vars.env_cap) {
+		vars.env_dirty = 1;
+		return;
+	}
+	var->env_idx = vars.env_count;
+	vars.env_buf[vars.room + vars.env_count++] = var->str;
+	vars.env_buf[vars.room + vars.env_count] = NULL;
+}
+
+/* slot of name, or the empty slot it would go to */
+static struct var *find_slot(const char *name, size_t length)
+{
+	size_t mask = vars.cap - 1, i;
+
+	for (i = hash_name(name, length) & mask; vars.slots[i].str != NULL; i = (i + 1) & mask) {
+		if (vars.slots[i].name_len == length && memcmp(vars.slots[i].str, name, length) == 0)
+			break;
+	}
+	return &vars.slots[i];
+}
+
+static struct var *lookup(const char *name, size_t length)
+{
+	struct var *var = find_slot(name, length);
+	return var->str != NULL ? var : NULL;
+}
+
+static void grow_slots()
+{
+	struct var *old = vars.slots, *var;
+	size_t old_cap = vars.cap;
+
+	vars.cap *= 2;
+	vars.layout_gen++;
+	if ((vars.slots = calloc(vars.cap, sizeof(struct var))) == NULL) {
+		syslog(LOG_ERR, "Can't reallocate variable table: %m");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < old_cap; ++i) {
+		if (old[i].str == NULL)
+			continue;
+		var = find_slot(old[i].str, old[i].name_len);
+		*var = old[i];
+	}
+	free(old);
+}
+
+/* remove var and shift following entries of the probe run back, so no tombstone is needed */
+static void remove_slot(struct var *var)
+{
+	size_t mask = vars.cap - 1, hole = var - vars.slots, i, home;
+
+	if (is_listed(var))
+		vars.env_dirty = 1;
+	retire_str(var->str, is_listed(var));
+	vars.layout_gen++;
+	for (i = (hole + 1) & mask; vars.slots[i].str != NULL; i = (i + 1) & mask) {
+		home = hash_name(vars.slots[i].str, vars.slots[i].name_len) & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			vars.slots[hole] = vars.slots[i];
+			hole = i;
+		}
+	}
+	vars.slots[hole].str = NULL;
+	vars.count--;
+}
+
+/* store str ("NAME=value" or "NAME", allocated by caller) as variable name */
+static void set_var(char *str, size_t name_len, int exported)
+{
+	struct var *var;
+	char *old;
+	int listed;
+
+	if ((vars.count + 1) * 4 > vars.cap * 3)
+		grow_slots();
+	var = find_slot(str, name_len);
+	if (var->str == NULL) {
+		var->str = str;
+		var->name_len = name_len;
+		var->exported = exported;
+		vars.count++;
+		if (is_listed(var))
+			list_var(var);
+		return;
+	}
+	listed = is_listed(var);
+	old = var->str;
+	var->str = str;
+	var->exported |= exported;
+	if (listed && is_listed(var) && !vars.env_dirty) { //only the value changed
+		vars.env_buf[vars.room + var->env_idx] = str;
+		free(old);
+		return;
+	}
+	retire_str(old, listed);
+	if (listed)
+		vars.env_dirty = 1;
+	else if (is_listed(var))
+		list_var(var);
+}
+
+static char *dup_str(const char *str, size_t length)
+{
+	char *dup;
+
+	if ((dup = strndup(str, length)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate variable: %m");
+		exit(EXIT_FAILURE);
+	}
+	return dup;
+}
+
+/* variables start as the exported environment shell was started with */
+void vars_init()
+{
+	extern char **environ;
+	const char *eq;
+
+	vars.cap = VARS_ORIG_CAP;
+	if ((vars.slots = calloc(vars.cap, sizeof(struct var))) == NULL) {
+		syslog(LOG_ERR, "Can't allocate variable table: %m");
+		exit(EXIT_FAILURE);
+	}
+	for (char **env = environ; *env != NULL; ++env) {
+		if ((eq = strchr(*env, '=')) != NULL && is_var_name(*env, eq - *env))
+			set_var(dup_str(*env, strlen(*env)), eq - *env, 1);
+	}
+	vars.shell_pid = getpid();
+	vars_environ();
+}
+
+pid_t vars_shell_pid()
+{
+	return vars.shell_pid;
+}
+
+const char *vars_getn(const char *name, size_t name_len)
+{
+	struct var *var = lookup(name, name_len);
+	return var != NULL && has_value(var) ? var->str + name_len + 1 : NULL;
+}
+
+/* vars_getn() through ref, which remembers the slot name has been found in until
+ * variables move (table grows or one is removed)
+ */
+const char *vars_get_ref(struct var_ref *ref, const char *name, size_t name_len)
+{
+	struct var *var;
+
+	if (ref->gen == vars.layout_gen) {
+		var = &vars.slots[ref->slot];
+	} else if ((var = lookup(name, name_len)) != NULL) {
+		ref->slot = var - vars.slots;
+		ref->gen = vars.layout_gen;
+	} else {
+		return NULL;
+	}
+	return has_value(var) ? var->str + name_len + 1 : NULL;
+}
+
+/* value of variable name, NULL if it isn't set */
+const char *vars_get(const char *name)
+{
+	return vars_getn(name, strlen(name));
+}
+
+void vars_set(const char *name, const char *value, int flags)
+{
+	size_t name_len = strlen(name), value_len = strlen(value);
+	char *str;
+
+	if ((str = malloc(name_len + value_len + 2)) == NULL) {
+		syslog(LOG_ERR, "Can't allocate variable: %m");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(str, name, name_len);
+	str[name_len] = '=';
+	memcpy(str + name_len + 1, value, value_len + 1);
+	set_var(str, name_len, flags & VAR_EXPORT);
+}
+
+/* set variable from "NAME=value" */
+void vars_assign(const char *assign, int flags)
+{
+	set_var(dup_str(assign, strlen(assign)), strchr(assign, '=') - assign, flags & VAR_EXPORT);
+}
+
+int vars_unset(const char *name)
+{
+	struct var *var = lookup(name, strlen(name));
+
+	if (var != NULL)
+		remove_slot(var);
+	return 0;
+}
+
+/* mark name exported, a variable that isn't set is exported once it is */
+void vars_export(const char *name)
+{
+	struct var *var = lookup(name, strlen(name));
+
+	if (var == NULL) {
+		set_var(dup_str(name, strlen(name)), strlen(name), 1);
+		return;
+	}
+	if (!var->exported) {
+		var->exported = 1;
+		if (has_value(var))
+			list_var(var);
+	}
+}
+
+/* print exported variables as commands that set them again */
+void vars_output_exported()
+{
+	const char *value;
+
+	for (size_t i = 0; i < vars.cap; ++i) {
+		if (vars.slots[i].str == NULL || !vars.slots[i].exported)
+			continue;
+		if (!has_value(&vars.slots[i])) {
+			printf("export %s\n", vars.slots[i].str);
+			continue;
+		}
+		printf("export %.*s='", (int)vars.slots[i].name_len, vars.slots[i].str);
+		for (value = vars.slots[i].str + vars.slots[i].name_len + 1; *value; ++value) {
+			if (*value == '\'')
+				fputs("'\\''", stdout);
+			else
+				putchar(*value);
+		}
+		printf("'\n");
+	}
+}
+
+int is_var_name(const char *name, size_t length)
+{
+	if (length == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+		return 0;
+	for (size_t i = 1; i < length; ++i) {
+		if (!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+			return 0;
+	}
+	return 1;
+}
+
+/* length of NAME if word is "NAME=value", 0 otherwise */
+size_t assign_name_len(const char *word)
+{
+	const char *eq = strchr(word, '=');
+	return eq != NULL && is_var_name(word, eq - word) ? eq - word : 0;
+}
+
+/* environment of exported variables, rebuilt only if exported set changed since last call,
+ * environ follows it, so getenv() sees what children see
+ */
+char **vars_environ()
+{
+	extern char **environ;
+	size_t need = vars.room + vars.count + 1, n = 0;
+
+	if (!vars.env_dirty)
+		return vars.env_buf + vars.room;
+	if (need > vars.env_cap) {
+		vars.env_cap = need * 2;
+		if ((vars.env_buf = realloc(vars.env_buf, vars.env_cap * sizeof(char *))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate environment: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (size_t i = 0; i < vars.cap; ++i) {
+		if (vars.slots[i].str == NULL || !is_listed(&vars.slots[i]))
+			continue;
+		vars.slots[i].env_idx = n;
+		vars.env_buf[vars.room + n++] = vars.slots[i].str;
+	}
+	vars.env_buf[vars.room + n] = NULL;
+	vars.env_count = n;
+	vars.env_dirty = 0;
+	while (vars.stale_count > 0)
+		free(vars.stale[--vars.stale_count]);
+	environ = vars.env_buf + vars.room;
+	return environ;
+}
+
+/* environment of a command with NAME=value prefixes assigns, nothing is copied:
+ * a prefix of an exported variable replaces its entry in env, other prefixes go into the spare
+ * room in front of env, vars_environ_restore() undoes it once command has been launched
+ */
+char **vars_environ_overlay(char **assigns, size_t count)
+{
+	struct var *var;
+	size_t name_len, front = 0, j;
+	char **env_base;
+
+	if (count > vars.room) {
+		vars.room = count;
+		vars.env_dirty = 1;
+	}
+	vars_environ();
+	if (count > vars.patch_cap) {
+		vars.patch_cap = count * 2;
+		if ((vars.patches = realloc(vars.patches, vars.patch_cap * sizeof(struct env_patch))) == NULL) {
+			syslog(LOG_ERR, "Can't allocate environment patches: %m");
+			exit(EXIT_FAILURE);
+		}
+	}
+	vars.patch_count = 0;
+	env_base = vars.env_buf + vars.room;
+	for (size_t i = 0; i < count; ++i) {
+		name_len = strchr(assigns[i], '=') - assigns[i];
+		if ((var = lookup(assigns[i], name_len)) != NULL && is_listed(var)) {
+			vars.patches[vars.patch_count].idx = var->env_idx;
+			vars.patches[vars.patch_count++].old = env_base[var->env_idx];
+			env_base[var->env_idx] = assigns[i];
+			continue;
+		}
+		for (j = 1; j <= front && strncmp(env_base[-j], assigns[i], name_len + 1) != 0; ++j); //same prefix twice
+		if (j > front)
+			front++;
+		env_base[-j] = assigns[i];
+	}
+	return env_base - front;
+}
+
+void vars_environ_restore()
+{
+	char **env_base = vars.env_buf + vars.room;
+
+	while (vars.patch_count > 0) {
+		vars.patch_count--;
+		env_base[vars.patches[vars.patch_count].idx] = vars.patches[vars.patch_count].old;
+	}
+}
+
+/* positional parameters $1..., *count is set to their number */
+char **vars_params(size_t *count)
+{
+	*count = vars.param_count;
+	return vars.params;
+}
+
+/* args must stay valid until parameters are set again */
+void vars_set_params(char **args, size_t count)
+{
+	vars.params = args;
+	vars.param_count = count;
+}
+
+/* drop first count parameters, return -1 if there aren't that many */
+int vars_shift(size_t count)
+{
+	if (count > vars.param_count)
+		return -1;
+	vars.params += count;
+	vars.param_count -= count;
+	return 0;
+}
+
+/* $0 */
+const char *vars_arg0()
+{
+	return vars.arg0;
+}
+
+void vars_set_arg0(const char *name)
+{
+	vars.arg0 = name;
+}
@@ -0,0 +1,39 @@
+#ifndef NSPT_VARS
+#define NSPT_VARS
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define VAR_KEEP   0  //keep export attribute of an existing variable
+#define VAR_EXPORT 1
+
+/* where a variable was found, so a command that runs again reads it without a lookup,
+ * a zeroed ref is unresolved, see vars_get_ref()
+ */
+struct var_ref {
+	size_t slot;
+	unsigned long gen;
+};
+
+void vars_init();
+pid_t vars_shell_pid();
+const char *vars_get(const char *name);
+const char *vars_getn(const char *name, size_t name_len);
+const char *vars_get_ref(struct var_ref *ref, const char *name, size_t name_len);
+void vars_set(const char *name, const char *value, int flags);
+void vars_assign(const char *assign, int flags);
+int vars_unset(const char *name);
+void vars_export(const char *name);
+void vars_output_exported();
+int is_var_name(const char *name, size_t length);
+size_t assign_name_len(const char *word);
+char **vars_environ();
+char **vars_environ_overlay(char **assigns, size_t count);
+void vars_environ_restore();
+char **vars_params(size_t *count);
+void vars_set_params(char **args, size_t count);
+int vars_shift(size_t count);
+const char *vars_arg0();
+void vars_set_arg0(const char *name);
+
+#endif